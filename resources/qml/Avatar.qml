@@ -73,10 +73,8 @@ AbstractButton {
         height: avatar.height / 6
         width: height
         radius: Settings.avatarCircles ? height / 2 : height / 8
-        color: updatePresence()
-
-        function updatePresence() {
-            switch (Presence.userPresence(userid)) {
+        color: {
+            switch (userPresence.presence) {
             case "online":
                 return Nheko.theme.online;
             case "unavailable":
@@ -88,12 +86,10 @@ AbstractButton {
             }
         }
 
-        Connections {
-            target: Presence
+        UserPresence {
+            id: userPresence
 
-            function onPresenceChanged(id) {
-                if (id == userid) onlineIndicator.color = onlineIndicator.updatePresence();
-            }
+            userId: avatar.userid
         }
     }
 
@@ -70,6 +70,10 @@ Item {
             // Mark timeline as read
             if (atYEnd && room) model.currentIndex = 0;
         }
+        onContentYChanged: {
+            // load the visible rows in one batch instead of one delegate at a time
+            if (room && model === room) room.prefetch(indexAt(width / 2, contentY + height - 1), indexAt(width / 2, contentY));
+        }
 
         ScrollBar.vertical: scrollbar
 
@@ -388,12 +392,10 @@ Item {
                             id: statusMsgHoverHandler
                         }
 
-                        property string userStatus: Presence.userStatus(userId)
-                        Connections {
-                            target: Presence
-                            function onPresenceChanged(id) {
-                                if (id == userId) statusMsg.userStatus = Presence.userStatus(userId);
-                            }
+                        property string userStatus: userPresence.status
+                        UserPresence {
+                            id: userPresence
+                            userId: messageUserAvatar.userid
                         }
                     }
 
@@ -166,7 +166,7 @@ ApplicationWindow {
             font.pixelSize: fontMetrics.font.pixelSize
             color: Nheko.colors.text
             placeholderText: qsTr("Search for public rooms")
-            onTextChanged: searchTimer.restart()
+            onTextChanged: roomDirView.model.setSearchTerm(text)
 
             Component.onCompleted: forceActiveFocus()
         }
@@ -181,13 +181,6 @@ ApplicationWindow {
             onTextChanged: publicRooms.setMatrixServer(text)
         }
 
-        Timer {
-            id: searchTimer
-
-            interval: 350
-            onTriggered: roomDirView.model.setSearchTerm(roomSearch.text)
-        }
-
     }
 
 }
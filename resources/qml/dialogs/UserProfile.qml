@@ -188,12 +188,10 @@ ApplicationWindow {
                 Layout.rightMargin: Nheko.paddingMedium
                 font.pointSize: Math.floor(fontMetrics.font.pointSize * 0.9)
 
-                property string userStatus: Presence.userStatus(profile.userid)
-                Connections {
-                    target: Presence
-                    function onPresenceChanged(id) {
-                        if (id == profile.userid) statusMsg.userStatus = Presence.userStatus(profile.userid);
-                    }
+                property string userStatus: userPresence.status
+                UserPresence {
+                    id: userPresence
+                    userId: profile.userid
                 }
             }
 
@@ -18,6 +18,10 @@ Rectangle {
     property bool collapsed: width < collapsePoint
     color: Nheko.colors.window
 
+    onVisibleChanged: UserSettingsModel.setPageVisible(visible)
+    Component.onCompleted: UserSettingsModel.setPageVisible(visible)
+    Component.onDestruction: UserSettingsModel.setPageVisible(false)
+
     ScrollView {
         id: scroll
 
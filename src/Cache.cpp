@@ -5,6 +5,8 @@
 #include "Cache.h"
 #include "Cache_p.h"
 
+#include <algorithm>
+#include <chrono>
 #include <stdexcept>
 #include <unordered_set>
 #include <variant>
@@ -13,10 +15,12 @@
 #include <QCryptographicHash>
 #include <QDir>
 #include <QFile>
+#include <QFuture>
 #include <QHash>
 #include <QMap>
 #include <QMessageBox>
 #include <QStandardPaths>
+#include <QtConcurrent>
 
 #if __has_include(<keychain.h>)
 #include <keychain.h>
@@ -31,19 +35,22 @@
 #include "EventAccessors.h"
 #include "Logging.h"
 #include "MatrixClient.h"
+#include "Metrics.h"
+#include "StartupProfile.h"
 #include "UserSettingsPage.h"
 #include "Utils.h"
 #include "encryption/Olm.h"
 
 //! Should be changed when a breaking change occurs in the cache format.
 //! This will reset client's data.
-static const std::string CURRENT_CACHE_FORMAT_VERSION{"2022.11.06"};
+static const std::string CURRENT_CACHE_FORMAT_VERSION{"2023.04.09"};
 
 //! Keys used for the DB
 static const std::string_view NEXT_BATCH_KEY("next_batch");
 static const std::string_view OLM_ACCOUNT_KEY("olm_account");
 static const std::string_view CACHE_FORMAT_VERSION_KEY("cache_format_version");
 static const std::string_view CURRENT_ONLINE_BACKUP_VERSION("current_online_backup_version");
+static const std::string_view SYNC_FILTER_KEY("sync_filter");
 
 static constexpr auto MAX_DBS    = 32384UL;
 static constexpr auto BATCH_SIZE = 100;
@@ -68,6 +75,10 @@ static constexpr auto INVITES_DB("invites");
 static constexpr auto SPACES_PARENTS_DB("space_parents");
 //! maps each space to its current children (id->id)
 static constexpr auto SPACES_CHILDREN_DB("space_children");
+//! maps each space to all rooms below it, including the rooms of subspaces (id->id)
+static constexpr auto SPACES_DESCENDANTS_DB("space_descendants");
+//! maps each room to all spaces above it (id->id)
+static constexpr auto SPACES_ANCESTORS_DB("space_ancestors");
 //! Information that  must be kept between sync requests.
 static constexpr auto SYNC_STATE_DB("sync_state");
 //! Read receipts per room/event.
@@ -83,6 +94,8 @@ static constexpr auto DEVICES_DB("devices");
 static constexpr auto DEVICE_KEYS_DB("device_keys");
 //! room_ids that have encryption enabled.
 static constexpr auto ENCRYPTED_ROOMS_DB("encrypted_rooms");
+//! user_id -> the verification status and a hash of the keys it was calculated from
+static constexpr auto VERIFICATION_STATUS_DB("verification_status");
 
 //! room_id -> pickled OlmInboundGroupSession
 static constexpr auto INBOUND_MEGOLM_SESSIONS_DB("inbound_megolm_sessions");
@@ -91,6 +104,49 @@ static constexpr auto OUTBOUND_MEGOLM_SESSIONS_DB("outbound_megolm_sessions");
 //! MegolmSessionIndex -> session data about which devices have access to this
 static constexpr auto MEGOLM_SESSIONS_DATA_DB("megolm_sessions_data_db");
 
+//! Tables shared by all rooms. Keys are prefixed with the room number (see RoomDb).
+
+//! room_id -> room number
+static constexpr auto ROOM_IDS_DB("room_ids");
+//! room number -> room_id
+static constexpr auto ROOM_NUMS_DB("room_nums");
+//! event_id -> event json
+static constexpr auto EVENTS_DB("events");
+//! index -> event_id
+static constexpr auto EVENT_ORDER_DB("event_order");
+//! index -> pagination token to fetch the events before index
+static constexpr auto BATCH_TOKENS_DB("batch_tokens");
+//! event_id -> index
+static constexpr auto EVENT_TO_ORDER_DB("event2order");
+//! event_id -> visible index
+static constexpr auto MSG_TO_ORDER_DB("msg2order");
+//! visible index -> event_id
+static constexpr auto ORDER_TO_MSG_DB("order2msg");
+//! index -> event_id, only for visible events
+static constexpr auto VISIBLE_ORDER_DB("visible_order");
+//! timestamp -> transaction id of an unsent message
+static constexpr auto PENDING_DB("pending");
+//! event_id -> ids of related events
+static constexpr auto RELATIONS_DB("related");
+//! type -> state event without state key
+static constexpr auto STATES_DB("state");
+//! type -> {"key", "id"} of state events with state key
+static constexpr auto STATES_KEY_DB("state_by_key");
+//! type -> account data event, the room "" holds the global account data
+static constexpr auto ACCOUNT_DATA_DB("account_data");
+//! user_id -> MemberInfo
+static constexpr auto MEMBERS_DB("members");
+//! room_id -> "1", if the room has all members cached and not only the lazy loaded ones
+static constexpr auto MEMBERS_LOADED_DB("members_loaded");
+//! room_id -> joined and invited member counts and heroes from the room summary of the sync
+static constexpr auto MEMBER_COUNTS_DB("member_counts");
+//! user_id -> room_id of every joined room, in which the user is joined or invited
+static constexpr auto USER_ROOMS_DB("user_rooms");
+static constexpr auto INVITE_STATES_DB("invite_state");
+static constexpr auto INVITE_MEMBERS_DB("invite_members");
+//! name -> number of entries of a room in a counted table
+static constexpr auto ENTRY_COUNTS_DB("entry_counts");
+
 using CachedReceipts = std::multimap<uint64_t, std::string, std::greater<uint64_t>>;
 using Receipts       = std::map<std::string, std::map<std::string, uint64_t>>;
 
@@ -103,9 +159,69 @@ namespace {
 std::unique_ptr<Cache> instance_ = nullptr;
 }
 
+namespace {
+//! The read transaction of a thread. It is shared by everyone reading on that thread at the same
+//! time and reset, once the last of them is done.
+struct ThreadReadTxn
+{
+    std::optional<lmdb::txn> txn;
+    int users         = 0;
+    int reuse_counter = 0;
+    std::chrono::steady_clock::time_point since;
+};
+thread_local ThreadReadTxn readTxn;
+
+//! Readers pin the pages of their snapshot, so holding one for longer than this is logged.
+constexpr auto STALE_READ_TXN = std::chrono::seconds(1);
+
+lmdb::txn &
+acquireReadTxn(lmdb::env &env)
+{
+    if (readTxn.users == 0) {
+        if (!readTxn.txn || readTxn.reuse_counter >= 100 || readTxn.txn->env() != env.handle()) {
+            readTxn.txn.reset();
+            readTxn.txn           = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            readTxn.reuse_counter = 0;
+        } else {
+            try {
+                readTxn.txn->renew();
+            } catch (...) {
+                readTxn.txn.reset();
+                readTxn.txn           = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+                readTxn.reuse_counter = 0;
+            }
+        }
+        readTxn.reuse_counter++;
+        readTxn.since = std::chrono::steady_clock::now();
+    }
+
+    readTxn.users++;
+    return *readTxn.txn;
+}
+
+void
+releaseReadTxn()
+{
+    if (--readTxn.users > 0)
+        return;
+
+    readTxn.txn->reset();
+
+    auto held = std::chrono::steady_clock::now() - readTxn.since;
+    if (held > STALE_READ_TXN)
+        nhlog::db()->warn("read transaction was held for {}ms",
+                          std::chrono::duration_cast<std::chrono::milliseconds>(held).count());
+}
+}
+
 struct RO_txn
 {
-    ~RO_txn() { txn.reset(); }
+    explicit RO_txn(lmdb::txn &txn)
+      : txn(txn)
+    {}
+    RO_txn(const RO_txn &)            = delete;
+    RO_txn &operator=(const RO_txn &) = delete;
+    ~RO_txn() { releaseReadTxn(); }
     operator MDB_txn *() const noexcept { return txn.handle(); }
     operator lmdb::txn &() noexcept { return txn; }
 
@@ -115,25 +231,367 @@ struct RO_txn
 RO_txn
 ro_txn(lmdb::env &env)
 {
-    thread_local lmdb::txn txn     = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
-    thread_local int reuse_counter = 0;
+    return RO_txn(acquireReadTxn(env));
+}
+
+Cache::ReadSnapshot::ReadSnapshot(lmdb::env &env)
+{
+    acquireReadTxn(env);
+}
 
-    if (reuse_counter >= 100 || txn.env() != env.handle()) {
-        txn.abort();
-        txn           = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
-        reuse_counter = 0;
-    } else if (reuse_counter > 0) {
-        try {
-            txn.renew();
-        } catch (...) {
-            txn.abort();
-            txn           = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
-            reuse_counter = 0;
-        }
+Cache::ReadSnapshot::~ReadSnapshot() { releaseReadTxn(); }
+
+namespace {
+template<typename T>
+void
+appendBigEndian(std::string &s, T value)
+{
+    for (int i = sizeof(T) - 1; i >= 0; i--)
+        s.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+}
+
+template<typename T>
+T
+readBigEndian(const char *data)
+{
+    T value = 0;
+    for (std::size_t i = 0; i < sizeof(T); i++)
+        value = (value << 8) | static_cast<unsigned char>(data[i]);
+    return value;
+}
+
+MDB_val
+toVal(std::string_view sv)
+{
+    MDB_val val;
+    val.mv_size = sv.size();
+    val.mv_data = const_cast<char *>(sv.data());
+    return val;
+}
+}
+
+RoomDb::RoomDb(MDB_dbi dbi, RoomNum room, unsigned flags)
+  : dbi_(dbi)
+  , flags_(flags)
+{
+    std::string p;
+    appendBigEndian(p, room);
+    std::copy(p.begin(), p.end(), prefix_);
+}
+
+RoomDb::RoomDb(MDB_dbi dbi, RoomNum room, MDB_dbi countsDb, std::string_view countName)
+  : RoomDb(dbi, room)
+{
+    countsDb_  = countsDb;
+    countName_ = countName;
+}
+
+std::string
+RoomDb::prefixed(std::string_view key) const
+{
+    std::string k(prefix_, sizeof(prefix_));
+    if (flags_ & IntegerKey) {
+        if (key.size() != sizeof(uint64_t))
+            throw lmdb::error("Integer key has the wrong size", MDB_BAD_VALSIZE);
+        appendBigEndian(k, lmdb::from_sv<uint64_t>(key));
+    } else {
+        k.append(key);
+    }
+    return k;
+}
+
+bool
+RoomDb::hasPrefix(const MDB_val &key) const
+{
+    return key.mv_size >= sizeof(prefix_) &&
+           std::equal(prefix_, prefix_ + sizeof(prefix_), static_cast<const char *>(key.mv_data));
+}
+
+bool
+RoomDb::get(MDB_txn *txn, std::string_view key, std::string_view &val) const
+{
+    auto k      = prefixed(key);
+    MDB_val mk  = toVal(k);
+    MDB_val res = {};
+    if (!lmdb::dbi_get(txn, dbi_, &mk, &res))
+        return false;
+
+    val = std::string_view(static_cast<const char *>(res.mv_data), res.mv_size);
+    return true;
+}
+
+bool
+RoomDb::put(MDB_txn *txn, std::string_view key, std::string_view val, unsigned flags)
+{
+    auto k     = prefixed(key);
+    MDB_val mk = toVal(k);
+    MDB_val mv = toVal(val);
+
+    bool existed = false;
+    if (countsDb_) {
+        MDB_val old = {};
+        existed     = lmdb::dbi_get(txn, dbi_, &mk, &old);
+    }
+
+    bool inserted = lmdb::dbi_put(txn, dbi_, &mk, &mv, flags);
+    if (inserted && countsDb_ && !existed)
+        addToCount(txn, 1);
+    return inserted;
+}
+
+bool
+RoomDb::del(MDB_txn *txn, std::string_view key)
+{
+    auto k     = prefixed(key);
+    MDB_val mk = toVal(k);
+
+    bool deleted = lmdb::dbi_del(txn, dbi_, &mk, nullptr);
+    if (deleted && countsDb_)
+        addToCount(txn, -1);
+    return deleted;
+}
+
+bool
+RoomDb::del(MDB_txn *txn, std::string_view key, std::string_view val)
+{
+    // counted tables have no duplicates, so the value doesn't matter
+    if (countsDb_)
+        return del(txn, key);
+
+    auto k     = prefixed(key);
+    MDB_val mk = toVal(k);
+    MDB_val mv = toVal(val);
+    return lmdb::dbi_del(txn, dbi_, &mk, &mv);
+}
+
+std::size_t
+RoomDb::size(MDB_txn *txn) const
+{
+    if (countsDb_) {
+        std::string k(prefix_, sizeof(prefix_));
+        k.append(countName_);
+        MDB_val mk    = toVal(k);
+        MDB_val count = {};
+        if (!lmdb::dbi_get(txn, countsDb_, &mk, &count) || count.mv_size != sizeof(uint64_t))
+            return 0;
+        return static_cast<std::size_t>(lmdb::from_sv<uint64_t>(
+          std::string_view(static_cast<const char *>(count.mv_data), count.mv_size)));
+    }
+
+    std::size_t count = 0;
+    auto cursor       = RoomCursor::open(txn, *this);
+    std::string_view key, val;
+    while (cursor.get(key, val, MDB_NEXT))
+        count++;
+    return count;
+}
+
+void
+RoomDb::drop(MDB_txn *txn)
+{
+    auto cursor = lmdb::cursor::open(txn, dbi_);
+    while (true) {
+        std::string_view prefix(prefix_, sizeof(prefix_));
+        MDB_val key = toVal(prefix);
+        MDB_val val = {};
+        if (!lmdb::cursor_get(cursor.handle(), &key, &val, MDB_SET_RANGE) || !hasPrefix(key))
+            break;
+        lmdb::cursor_del(cursor.handle());
+    }
+    cursor.close();
+
+    if (countsDb_) {
+        std::string k(prefix_, sizeof(prefix_));
+        k.append(countName_);
+        MDB_val mk = toVal(k);
+        lmdb::dbi_del(txn, countsDb_, &mk, nullptr);
+    }
+}
+
+void
+RoomDb::addToCount(MDB_txn *txn, int64_t diff)
+{
+    std::string k(prefix_, sizeof(prefix_));
+    k.append(countName_);
+    MDB_val mk = toVal(k);
+
+    uint64_t count = 0;
+    MDB_val old    = {};
+    if (lmdb::dbi_get(txn, countsDb_, &mk, &old) && old.mv_size == sizeof(uint64_t))
+        count = lmdb::from_sv<uint64_t>(
+          std::string_view(static_cast<const char *>(old.mv_data), old.mv_size));
+
+    count      = (diff < 0 && count == 0) ? 0 : count + diff;
+    MDB_val mv = toVal(lmdb::to_sv(count));
+    lmdb::dbi_put(txn, countsDb_, &mk, &mv, 0);
+}
+
+RoomCursor
+RoomCursor::open(MDB_txn *txn, const RoomDb &db)
+{
+    return RoomCursor(lmdb::cursor::open(txn, db.dbi_), db);
+}
+
+std::string_view
+RoomCursor::unprefixed(const MDB_val &key)
+{
+    const char *data = static_cast<const char *>(key.mv_data) + sizeof(RoomNum);
+    std::size_t size = key.mv_size - sizeof(RoomNum);
+
+    if ((db_.flags_ & RoomDb::IntegerKey) && size == sizeof(uint64_t)) {
+        intKey_ = readBigEndian<uint64_t>(data);
+        return lmdb::to_sv(intKey_);
+    }
+    return std::string_view(data, size);
+}
+
+bool
+RoomCursor::seek(MDB_val &key, MDB_val &val, MDB_cursor_op op)
+{
+    positioned_ = lmdb::cursor_get(cursor_.handle(), &key, &val, op) && db_.hasPrefix(key);
+    return positioned_;
+}
+
+bool
+RoomCursor::step(MDB_val &key, MDB_val &val, MDB_cursor_op op, MDB_cursor_op back)
+{
+    if (!lmdb::cursor_get(cursor_.handle(), &key, &val, op))
+        return false;
+    if (db_.hasPrefix(key))
+        return true;
+
+    // We left the room, move back to its first or last entry.
+    MDB_val k = {}, v = {};
+    positioned_ = lmdb::cursor_get(cursor_.handle(), &k, &v, back) && db_.hasPrefix(k);
+    return false;
+}
+
+bool
+RoomCursor::get(std::string_view &key, std::string_view &val, MDB_cursor_op op)
+{
+    MDB_val k = {}, v = {};
+    bool found = false;
+
+    switch (op) {
+    case MDB_FIRST:
+        keyBuf_.assign(db_.prefix_, sizeof(db_.prefix_));
+        k     = toVal(keyBuf_);
+        found = seek(k, v, MDB_SET_RANGE);
+        break;
+    case MDB_LAST: {
+        auto room = readBigEndian<RoomNum>(db_.prefix_);
+        keyBuf_.clear();
+        appendBigEndian(keyBuf_, static_cast<RoomNum>(room + 1));
+        k = toVal(keyBuf_);
+        if (lmdb::cursor_get(cursor_.handle(), &k, &v, MDB_SET_RANGE))
+            found = seek(k, v, MDB_PREV);
+        else
+            found = seek(k, v, MDB_LAST);
+        break;
+    }
+    case MDB_NEXT:
+    case MDB_NEXT_NODUP:
+        if (!positioned_)
+            return get(key, val, MDB_FIRST);
+        found = step(k, v, op, MDB_PREV);
+        break;
+    case MDB_PREV:
+    case MDB_PREV_NODUP:
+        if (!positioned_)
+            return get(key, val, MDB_LAST);
+        found = step(k, v, op, MDB_NEXT);
+        break;
+    case MDB_SET:
+    case MDB_SET_KEY:
+    case MDB_SET_RANGE:
+    case MDB_GET_BOTH:
+    case MDB_GET_BOTH_RANGE:
+        keyBuf_ = db_.prefixed(key);
+        k       = toVal(keyBuf_);
+        v       = toVal(val);
+        found   = seek(k, v, op);
+        break;
+    default:
+        // operations on the duplicates of the current key never leave the room
+        if (!positioned_)
+            return false;
+        // some of them, like MDB_FIRST_DUP, don't return the key, so start from the current one
+        if (!lmdb::cursor_get(cursor_.handle(), &k, &v, MDB_GET_CURRENT))
+            return false;
+        found = lmdb::cursor_get(cursor_.handle(), &k, &v, op);
+        break;
+    }
+
+    if (!found)
+        return false;
+
+    key = unprefixed(k);
+    val = std::string_view(static_cast<const char *>(v.mv_data), v.mv_size);
+    return true;
+}
+
+bool
+RoomCursor::put(std::string_view key, std::string_view val, unsigned flags)
+{
+    auto k      = db_.prefixed(key);
+    bool result = cursor_.put(k, val, flags & ~(MDB_APPEND | MDB_APPENDDUP));
+    positioned_ = true;
+    return result;
+}
+
+void
+RoomCursor::del(unsigned flags)
+{
+    if (positioned_)
+        lmdb::cursor_del(cursor_.handle(), flags);
+}
+
+RoomNum
+Cache::roomNum(lmdb::txn &txn, std::string_view room_id)
+{
+    std::string_view val;
+    if (roomIdsDb_.get(txn, room_id, val) && val.size() == sizeof(RoomNum))
+        return lmdb::from_sv<RoomNum>(val);
+
+    RoomNum num = 1;
+    {
+        auto cursor = lmdb::cursor::open(txn, roomNumsDb_);
+        std::string_view key;
+        if (cursor.get(key, val, MDB_LAST))
+            num = lmdb::from_sv<RoomNum>(key) + 1;
+    }
+
+    try {
+        roomIdsDb_.put(txn, room_id, lmdb::to_sv(num));
+        roomNumsDb_.put(txn, lmdb::to_sv(num), room_id);
+    } catch (const lmdb::error &e) {
+        // Read only transactions can't assign a number, but then the room has no entries either.
+        if (e.code() != EACCES)
+            throw;
+        return std::numeric_limits<RoomNum>::max();
+    }
+
+    return num;
+}
+
+static bool
+isDisplaynameSafe(const std::string &s)
+{
+    for (QChar c : QString::fromStdString(s).toStdU32String()) {
+        if (c.isPrint() && !c.isSpace())
+            return false;
     }
-    reuse_counter++;
 
-    return RO_txn{txn};
+    return true;
+}
+
+static CachedMember
+makeCachedMember(const std::string &user_id, std::optional<MemberInfo> info)
+{
+    CachedMember member;
+    member.display_name = (info && !isDisplaynameSafe(info->name)) ? info->name : user_id;
+    member.info = std::move(info);
+    return member;
 }
 
 template<class T>
@@ -156,27 +614,11 @@ containsStateUpdates(const mtx::events::collections::StrippedEvents &e)
            std::holds_alternative<StrippedEvent<Topic>>(e);
 }
 
-bool
-Cache::isHiddenEvent(lmdb::txn &txn,
-                     mtx::events::collections::TimelineEvents e,
-                     const std::string &room_id)
+std::vector<mtx::events::EventType>
+Cache::hiddenEventTypes(lmdb::txn &txn, const std::string &room_id)
 {
     using namespace mtx::events;
 
-    // Always hide edits
-    if (mtx::accessors::relations(e).replaces())
-        return true;
-
-    if (auto encryptedEvent = std::get_if<EncryptedEvent<msg::Encrypted>>(&e)) {
-        MegolmSessionIndex index;
-        index.room_id    = room_id;
-        index.session_id = encryptedEvent->content.session_id;
-
-        auto result = olm::decryptEvent(index, *encryptedEvent, true);
-        if (!result.error)
-            e = result.event.value();
-    }
-
     mtx::events::account_data::nheko_extensions::HiddenEvents hiddenEvents;
     hiddenEvents.hidden_event_types = std::vector{
       EventType::Reaction,
@@ -209,10 +651,33 @@ Cache::isHiddenEvent(lmdb::txn &txn,
             hiddenEvents = std::move(h.content);
     }
 
-    return std::find(hiddenEvents.hidden_event_types->begin(),
-                     hiddenEvents.hidden_event_types->end(),
-                     std::visit([](const auto &ev) { return ev.type; }, e)) !=
-           hiddenEvents.hidden_event_types->end();
+    return std::move(*hiddenEvents.hidden_event_types);
+}
+
+bool
+Cache::isHiddenEvent(mtx::events::collections::TimelineEvents e,
+                     const std::string &room_id,
+                     const std::vector<mtx::events::EventType> &hiddenTypes)
+{
+    using namespace mtx::events;
+
+    // Always hide edits
+    if (mtx::accessors::relations(e).replaces())
+        return true;
+
+    if (auto encryptedEvent = std::get_if<EncryptedEvent<msg::Encrypted>>(&e)) {
+        MegolmSessionIndex index;
+        index.room_id    = room_id;
+        index.session_id = encryptedEvent->content.session_id;
+
+        auto result = olm::decryptEvent(index, *encryptedEvent, true);
+        if (!result.error)
+            e = result.event.value();
+    }
+
+    return std::find(hiddenTypes.begin(),
+                     hiddenTypes.end(),
+                     std::visit([](const auto &ev) { return ev.type; }, e)) != hiddenTypes.end();
 }
 
 Cache::Cache(const QString &userId, QObject *parent)
@@ -238,6 +703,8 @@ Cache::Cache(const QString &userId, QObject *parent)
 void
 Cache::setup()
 {
+    startupprofile::Scope profile("cache setup");
+
     auto settings = UserSettings::instance();
 
     nhlog::db()->debug("setting up cache");
@@ -270,6 +737,7 @@ Cache::setup()
         nhlog::db()->info("completed state migration");
     }
 
+    startupprofile::begin("open database");
     env_ = lmdb::env::create();
     env_.set_mapsize(DB_SIZE);
     env_.set_max_dbs(MAX_DBS);
@@ -313,15 +781,17 @@ Cache::setup()
         env_.open(cacheDirectory_.toStdString().c_str());
     }
 
-    auto txn          = lmdb::txn::begin(env_);
-    syncStateDb_      = lmdb::dbi::open(txn, SYNC_STATE_DB, MDB_CREATE);
-    roomsDb_          = lmdb::dbi::open(txn, ROOMS_DB, MDB_CREATE);
-    spacesChildrenDb_ = lmdb::dbi::open(txn, SPACES_CHILDREN_DB, MDB_CREATE | MDB_DUPSORT);
-    spacesParentsDb_  = lmdb::dbi::open(txn, SPACES_PARENTS_DB, MDB_CREATE | MDB_DUPSORT);
-    invitesDb_        = lmdb::dbi::open(txn, INVITES_DB, MDB_CREATE);
-    readReceiptsDb_   = lmdb::dbi::open(txn, READ_RECEIPTS_DB, MDB_CREATE);
-    notificationsDb_  = lmdb::dbi::open(txn, NOTIFICATIONS_DB, MDB_CREATE);
-    presenceDb_       = lmdb::dbi::open(txn, PRESENCE_DB, MDB_CREATE);
+    auto txn             = lmdb::txn::begin(env_);
+    syncStateDb_         = lmdb::dbi::open(txn, SYNC_STATE_DB, MDB_CREATE);
+    roomsDb_             = lmdb::dbi::open(txn, ROOMS_DB, MDB_CREATE);
+    spacesChildrenDb_    = lmdb::dbi::open(txn, SPACES_CHILDREN_DB, MDB_CREATE | MDB_DUPSORT);
+    spacesParentsDb_     = lmdb::dbi::open(txn, SPACES_PARENTS_DB, MDB_CREATE | MDB_DUPSORT);
+    spacesDescendantsDb_ = lmdb::dbi::open(txn, SPACES_DESCENDANTS_DB, MDB_CREATE | MDB_DUPSORT);
+    spacesAncestorsDb_   = lmdb::dbi::open(txn, SPACES_ANCESTORS_DB, MDB_CREATE | MDB_DUPSORT);
+    invitesDb_           = lmdb::dbi::open(txn, INVITES_DB, MDB_CREATE);
+    readReceiptsDb_      = lmdb::dbi::open(txn, READ_RECEIPTS_DB, MDB_CREATE);
+    notificationsDb_     = lmdb::dbi::open(txn, NOTIFICATIONS_DB, MDB_CREATE);
+    presenceDb_          = lmdb::dbi::open(txn, PRESENCE_DB, MDB_CREATE);
 
     // Device management
     devicesDb_    = lmdb::dbi::open(txn, DEVICES_DB, MDB_CREATE);
@@ -337,8 +807,38 @@ Cache::setup()
     [[maybe_unused]] auto verificationDb = getVerificationDb(txn);
     [[maybe_unused]] auto userKeysDb     = getUserKeysDb(txn);
 
+    // Verification status calculated from the keys
+    verificationStatusDb_ = lmdb::dbi::open(txn, VERIFICATION_STATUS_DB, MDB_CREATE);
+
+    // Per room data
+    roomIdsDb_         = lmdb::dbi::open(txn, ROOM_IDS_DB, MDB_CREATE);
+    roomNumsDb_        = lmdb::dbi::open(txn, ROOM_NUMS_DB, MDB_CREATE | MDB_INTEGERKEY);
+    eventsDb_          = lmdb::dbi::open(txn, EVENTS_DB, MDB_CREATE);
+    eventOrderDb_      = lmdb::dbi::open(txn, EVENT_ORDER_DB, MDB_CREATE);
+    eventToOrderDb_    = lmdb::dbi::open(txn, EVENT_TO_ORDER_DB, MDB_CREATE);
+    batchTokensDb_     = lmdb::dbi::open(txn, BATCH_TOKENS_DB, MDB_CREATE);
+    messageToOrderDb_  = lmdb::dbi::open(txn, MSG_TO_ORDER_DB, MDB_CREATE);
+    orderToMessageDb_  = lmdb::dbi::open(txn, ORDER_TO_MSG_DB, MDB_CREATE);
+    visibleOrderDb_    = lmdb::dbi::open(txn, VISIBLE_ORDER_DB, MDB_CREATE);
+    pendingMessagesDb_ = lmdb::dbi::open(txn, PENDING_DB, MDB_CREATE);
+    relationsDb_       = lmdb::dbi::open(txn, RELATIONS_DB, MDB_CREATE | MDB_DUPSORT);
+    statesDb_          = lmdb::dbi::open(txn, STATES_DB, MDB_CREATE);
+    statesKeyDb_       = lmdb::dbi::open(txn, STATES_KEY_DB, MDB_CREATE | MDB_DUPSORT);
+    lmdb::dbi_set_dupsort(txn, statesKeyDb_, compare_state_key);
+    accountDataDb_   = lmdb::dbi::open(txn, ACCOUNT_DATA_DB, MDB_CREATE);
+    membersDb_       = lmdb::dbi::open(txn, MEMBERS_DB, MDB_CREATE);
+    membersLoadedDb_ = lmdb::dbi::open(txn, MEMBERS_LOADED_DB, MDB_CREATE);
+    memberCountsDb_  = lmdb::dbi::open(txn, MEMBER_COUNTS_DB, MDB_CREATE);
+    userRoomsDb_     = lmdb::dbi::open(txn, USER_ROOMS_DB, MDB_CREATE | MDB_DUPSORT);
+    inviteStatesDb_  = lmdb::dbi::open(txn, INVITE_STATES_DB, MDB_CREATE);
+    inviteMembersDb_ = lmdb::dbi::open(txn, INVITE_MEMBERS_DB, MDB_CREATE);
+    entryCountsDb_   = lmdb::dbi::open(txn, ENTRY_COUNTS_DB, MDB_CREATE);
+
     txn.commit();
+    startupprofile::end("open database");
 
+    // ends once the secrets are loaded, see loadSecretsFromStore
+    startupprofile::begin("load secrets");
     loadSecretsFromStore(
       {
         {"pickle_secret", true},
@@ -392,6 +892,7 @@ Cache::loadSecretsFromStore(
         // So we set the database to be ready, but not emit the signal, because that would start the
         // migrations again. :D
         if (databaseReadyOnFinished) {
+            startupprofile::end("load secrets");
             emit databaseReady();
             nhlog::db()->debug("Database ready");
         }
@@ -1124,8 +1625,8 @@ void
 Cache::removeInvite(lmdb::txn &txn, const std::string &room_id)
 {
     invitesDb_.del(txn, room_id);
-    getInviteStatesDb(txn, room_id).drop(txn, true);
-    getInviteMembersDb(txn, room_id).drop(txn, true);
+    getInviteStatesDb(txn, room_id).drop(txn);
+    getInviteMembersDb(txn, room_id).drop(txn);
 }
 
 void
@@ -1140,9 +1641,28 @@ void
 Cache::removeRoom(lmdb::txn &txn, const std::string &roomid)
 {
     roomsDb_.del(txn, roomid);
-    getStatesDb(txn, roomid).drop(txn, true);
-    getAccountDataDb(txn, roomid).drop(txn, true);
-    getMembersDb(txn, roomid).drop(txn, true);
+    getStatesDb(txn, roomid).drop(txn);
+    updatePowerLevelsCache(roomid, std::nullopt);
+    getStatesKeyDb(txn, roomid).drop(txn);
+    getAccountDataDb(txn, roomid).drop(txn);
+    dropMembers(txn, roomid);
+    membersLoadedDb_.del(txn, roomid);
+    memberCountsDb_.del(txn, roomid);
+}
+
+void
+Cache::dropMembers(lmdb::txn &txn, const std::string &room_id)
+{
+    auto membersdb = getMembersDb(txn, room_id);
+
+    std::string_view user_id, ignored;
+    auto cursor = RoomCursor::open(txn, membersdb);
+    while (cursor.get(user_id, ignored, MDB_NEXT))
+        userRoomsDb_.del(txn, user_id, room_id);
+    cursor.close();
+
+    membersdb.drop(txn);
+    clearMemberCache(room_id);
 }
 
 void
@@ -1159,6 +1679,36 @@ Cache::setNextBatchToken(lmdb::txn &txn, const std::string &token)
     syncStateDb_.put(txn, NEXT_BATCH_KEY, token);
 }
 
+std::optional<std::string>
+Cache::syncFilterId(const std::string &definition)
+{
+    try {
+        auto txn = ro_txn(env_);
+        std::string_view data;
+        if (!syncStateDb_.get(txn, SYNC_FILTER_KEY, data))
+            return std::nullopt;
+
+        auto j = nlohmann::json::parse(data);
+        if (j.at("definition").get<std::string>() != definition)
+            return std::nullopt;
+        return j.at("filter_id").get<std::string>();
+    } catch (const std::exception &e) {
+        nhlog::db()->warn("failed to read sync filter: {}", e.what());
+        return std::nullopt;
+    }
+}
+
+void
+Cache::saveSyncFilterId(const std::string &definition, const std::string &filter_id)
+{
+    auto txn = lmdb::txn::begin(env_);
+    syncStateDb_.put(
+      txn,
+      SYNC_FILTER_KEY,
+      nlohmann::json{{"definition", definition}, {"filter_id", filter_id}}.dump());
+    txn.commit();
+}
+
 bool
 Cache::isInitialized()
 {
@@ -1195,6 +1745,7 @@ Cache::deleteData()
 {
     if (this->databaseReady_) {
         this->databaseReady_ = false;
+        verificationPool_.waitForDone();
         // TODO: We need to remove the env_ while not accepting new requests.
         lmdb::dbi_close(env_, syncStateDb_);
         lmdb::dbi_close(env_, roomsDb_);
@@ -1208,10 +1759,51 @@ Cache::deleteData()
         lmdb::dbi_close(env_, inboundMegolmSessionDb_);
         lmdb::dbi_close(env_, outboundMegolmSessionDb_);
         lmdb::dbi_close(env_, megolmSessionDataDb_);
+        lmdb::dbi_close(env_, verificationStatusDb_);
+
+        for (auto db : {&roomIdsDb_,
+                        &roomNumsDb_,
+                        &eventsDb_,
+                        &eventOrderDb_,
+                        &eventToOrderDb_,
+                        &batchTokensDb_,
+                        &messageToOrderDb_,
+                        &orderToMessageDb_,
+                        &visibleOrderDb_,
+                        &pendingMessagesDb_,
+                        &relationsDb_,
+                        &statesDb_,
+                        &statesKeyDb_,
+                        &accountDataDb_,
+                        &membersDb_,
+                        &membersLoadedDb_,
+                        &memberCountsDb_,
+                        &userRoomsDb_,
+                        &spacesDescendantsDb_,
+                        &spacesAncestorsDb_,
+                        &inviteStatesDb_,
+                        &inviteMembersDb_,
+                        &entryCountsDb_})
+            lmdb::dbi_close(env_, *db);
 
         env_.close();
 
-        verification_storage.status.clear();
+        {
+            std::unique_lock<std::mutex> lock(verification_storage.verification_storage_mtx);
+            verification_storage.status.clear();
+            verification_storage.unsaved.clear();
+            verification_storage.generation++;
+        }
+        {
+            std::unique_lock<std::mutex> lock(member_storage.mtx);
+            member_storage.rooms.clear();
+            member_storage.generation++;
+        }
+        {
+            std::unique_lock<std::mutex> lock(power_levels_storage.mtx);
+            power_levels_storage.rooms.clear();
+            power_levels_storage.generation++;
+        }
 
         if (!cacheDirectory_.isEmpty()) {
             QDir(cacheDirectory_).removeRecursively();
@@ -1515,26 +2107,228 @@ Cache::runMigrations()
 
            return true;
        }},
-    };
+      {"2023.03.12",
+       [this]() {
+           try {
+               auto txn = lmdb::txn::begin(env_, nullptr);
 
-    nhlog::db()->info("Running migrations, this may take a while!");
-    for (const auto &[target_version, migration] : migrations) {
-        if (target_version > stored_version)
-            if (!migration()) {
-                nhlog::db()->critical("migration failure!");
-                return false;
-            }
-    }
-    nhlog::db()->info("Migrations finished.");
+               std::vector<std::string> dbNames;
+               {
+                   auto mainDb = lmdb::dbi::open(txn, nullptr);
+                   std::string_view dbName, ignored;
+                   auto cursor = lmdb::cursor::open(txn, mainDb);
+                   while (cursor.get(dbName, ignored, MDB_NEXT))
+                       if (dbName.find('/') != std::string_view::npos &&
+                           dbName.find("olm_sessions") != 0)
+                           dbNames.emplace_back(dbName);
+               }
 
-    setCurrentFormat();
-    return true;
-}
+               for (const auto &dbName : dbNames) {
+                   auto pos     = dbName.rfind('/');
+                   auto room_id = dbName.substr(0, pos);
+                   auto suffix  = std::string_view(dbName).substr(pos + 1);
+
+                   std::string_view ignored;
+                   bool isInvite = suffix == "invite_state" || suffix == "invite_members";
+                   bool exists   = (suffix == "account_data" && room_id.empty()) ||
+                                 (isInvite ? invitesDb_.get(txn, room_id, ignored)
+                                           : roomsDb_.get(txn, room_id, ignored));
+
+                   static const std::map<std::string_view, unsigned> oldFlags{
+                     {"events", 0},
+                     {"event_order", MDB_INTEGERKEY},
+                     {"event2order", 0},
+                     {"msg2order", 0},
+                     {"order2msg", MDB_INTEGERKEY},
+                     {"pending", MDB_INTEGERKEY},
+                     {"related", MDB_DUPSORT},
+                     {"state", 0},
+                     {"state_by_key", MDB_DUPSORT},
+                     {"account_data", 0},
+                     {"members", 0},
+                     {"invite_state", 0},
+                     {"invite_members", 0},
+                   };
+                   auto flags = oldFlags.find(suffix);
+                   if (flags == oldFlags.end())
+                       continue;
 
-cache::CacheVersion
-Cache::formatVersion()
-{
-    auto txn = ro_txn(env_);
+                   auto oldDb = lmdb::dbi::open(txn, dbName.c_str(), flags->second);
+                   if (suffix == "state_by_key")
+                       lmdb::dbi_set_dupsort(txn, oldDb, compare_state_key);
+
+                   if (exists) {
+                       RoomDb target;
+                       if (suffix == "events")
+                           target = getEventsDb(txn, room_id);
+                       else if (suffix == "event_order")
+                           target = getEventOrderDb(txn, room_id);
+                       else if (suffix == "event2order")
+                           target = getEventToOrderDb(txn, room_id);
+                       else if (suffix == "msg2order")
+                           target = getMessageToOrderDb(txn, room_id);
+                       else if (suffix == "order2msg")
+                           target = getOrderToMessageDb(txn, room_id);
+                       else if (suffix == "pending")
+                           target = getPendingMessagesDb(txn, room_id);
+                       else if (suffix == "related")
+                           target = getRelationsDb(txn, room_id);
+                       else if (suffix == "state")
+                           target = getStatesDb(txn, room_id);
+                       else if (suffix == "state_by_key")
+                           target = getStatesKeyDb(txn, room_id);
+                       else if (suffix == "account_data")
+                           target = getAccountDataDb(txn, room_id);
+                       else if (suffix == "members")
+                           target = getMembersDb(txn, room_id);
+                       else if (suffix == "invite_state")
+                           target = getInviteStatesDb(txn, room_id);
+                       else
+                           target = getInviteMembersDb(txn, room_id);
+
+                       std::string_view key, value;
+                       auto cursor = lmdb::cursor::open(txn, oldDb);
+                       while (cursor.get(key, value, MDB_NEXT))
+                           target.put(txn, key, value);
+                       cursor.close();
+                   }
+
+                   oldDb.drop(txn, true);
+               }
+
+               txn.commit();
+           } catch (const lmdb::error &e) {
+               nhlog::db()->critical("Failed to move rooms into shared tables: {}", e.what());
+               return false;
+           }
+
+           nhlog::db()->info("Successfully moved rooms into shared tables.");
+           return true;
+       }},
+      {"2023.03.19",
+       [this]() {
+           try {
+               auto txn = lmdb::txn::begin(env_, nullptr);
+
+               // Both tables use the same room prefixed keys, so we can just copy them over.
+               std::string_view key, value;
+               auto cursor = lmdb::cursor::open(txn, eventOrderDb_);
+               while (cursor.get(key, value, MDB_NEXT)) {
+                   std::string event_id;
+                   try {
+                       auto obj = nlohmann::json::parse(value);
+                       event_id = obj.value("event_id", "");
+                       if (obj.contains("prev_batch"))
+                           batchTokensDb_.put(txn, key, obj["prev_batch"].get<std::string>());
+                   } catch (std::exception &) {
+                       // the initial db format sometimes stored just the event id
+                       continue;
+                   }
+                   cursor.put(key, event_id, MDB_CURRENT);
+               }
+               cursor.close();
+
+               txn.commit();
+           } catch (const lmdb::error &e) {
+               nhlog::db()->critical("Failed to split batch tokens from event order: {}", e.what());
+               return false;
+           }
+
+           nhlog::db()->info("Successfully split batch tokens from event order.");
+           return true;
+       }},
+      {"2023.03.26",
+       [this]() {
+           try {
+               auto txn = lmdb::txn::begin(env_, nullptr);
+
+               for (const auto &room_id : getRoomIds(txn)) {
+                   auto evToOrderDb = getEventToOrderDb(txn, room_id);
+                   auto visibleDb   = getVisibleOrderDb(txn, room_id);
+
+                   std::string_view event_id, ignored, index;
+                   auto cursor = RoomCursor::open(txn, getMessageToOrderDb(txn, room_id));
+                   while (cursor.get(event_id, ignored, MDB_NEXT))
+                       if (evToOrderDb.get(txn, event_id, index))
+                           visibleDb.put(txn, index, event_id);
+                   cursor.close();
+               }
+
+               txn.commit();
+           } catch (const lmdb::error &e) {
+               nhlog::db()->critical("Failed to index visible events: {}", e.what());
+               return false;
+           }
+
+           nhlog::db()->info("Successfully indexed visible events.");
+           return true;
+       }},
+      {"2023.04.02",
+       [this]() {
+           try {
+               auto txn = lmdb::txn::begin(env_, nullptr);
+
+               for (const auto &room_id : getRoomIds(txn)) {
+                   std::string_view user_id, ignored;
+                   auto cursor = RoomCursor::open(txn, getMembersDb(txn, room_id));
+                   while (cursor.get(user_id, ignored, MDB_NEXT))
+                       userRoomsDb_.put(txn, user_id, room_id);
+                   cursor.close();
+               }
+
+               txn.commit();
+           } catch (const lmdb::error &e) {
+               nhlog::db()->critical("Failed to index the rooms of users: {}", e.what());
+               return false;
+           }
+
+           nhlog::db()->info("Successfully indexed the rooms of users.");
+           return true;
+       }},
+      {"2023.04.09",
+       [this]() {
+           try {
+               auto txn = lmdb::txn::begin(env_, nullptr);
+
+               std::set<std::string> rooms;
+               for (auto db : {&spacesChildrenDb_, &spacesParentsDb_}) {
+                   std::string_view room_id, ignored;
+                   auto cursor = lmdb::cursor::open(txn, *db);
+                   while (cursor.get(room_id, ignored, MDB_NEXT_NODUP))
+                       rooms.emplace(room_id);
+                   cursor.close();
+               }
+               updateSpaceClosure(txn, rooms);
+
+               txn.commit();
+           } catch (const lmdb::error &e) {
+               nhlog::db()->critical("Failed to index space hierarchies: {}", e.what());
+               return false;
+           }
+
+           nhlog::db()->info("Successfully indexed space hierarchies.");
+           return true;
+       }},
+    };
+
+    nhlog::db()->info("Running migrations, this may take a while!");
+    for (const auto &[target_version, migration] : migrations) {
+        if (target_version > stored_version)
+            if (!migration()) {
+                nhlog::db()->critical("migration failure!");
+                return false;
+            }
+    }
+    nhlog::db()->info("Migrations finished.");
+
+    setCurrentFormat();
+    return true;
+}
+
+cache::CacheVersion
+Cache::formatVersion()
+{
+    auto txn = ro_txn(env_);
 
     std::string_view current_version;
     bool res = syncStateDb_.get(txn, CACHE_FORMAT_VERSION_KEY, current_version);
@@ -1700,16 +2494,19 @@ Cache::calculateRoomReadStatus(const std::string &room_id)
 void
 Cache::updateState(const std::string &room, const mtx::responses::StateEvents &state, bool wipe)
 {
-    auto txn         = lmdb::txn::begin(env_);
+    auto txn         = beginWithCacheUpdates();
     auto statesdb    = getStatesDb(txn, room);
     auto stateskeydb = getStatesKeyDb(txn, room);
     auto membersdb   = getMembersDb(txn, room);
     auto eventsDb    = getEventsDb(txn, room);
 
     if (wipe) {
-        membersdb.drop(txn);
+        dropMembers(txn, room);
         statesdb.drop(txn);
+        updatePowerLevelsCache(room, std::nullopt);
         stateskeydb.drop(txn);
+        // a full state resync contains every member
+        membersLoadedDb_.put(txn, room, "1");
     }
 
     saveStateEvents(txn, statesdb, stateskeydb, membersdb, eventsDb, room, state.events);
@@ -1739,7 +2536,7 @@ Cache::updateState(const std::string &room, const mtx::responses::StateEvents &s
 
     roomsDb_.put(txn, room, nlohmann::json(updatedInfo).dump());
     updateSpaces(txn, {room}, {room});
-    txn.commit();
+    commitWithCacheUpdates(txn);
 }
 
 namespace {
@@ -1798,7 +2595,7 @@ Cache::saveState(const mtx::responses::Sync &res)
 
     auto currentBatchToken = res.next_batch;
 
-    auto txn = lmdb::txn::begin(env_);
+    auto txn = beginWithCacheUpdates();
 
     setNextBatchToken(txn, res.next_batch);
 
@@ -1981,12 +2778,17 @@ Cache::saveState(const mtx::responses::Sync &res)
     savePresence(txn, res.presence);
 
     markUserKeysOutOfDate(txn, userKeyCacheDb, res.device_lists.changed, currentBatchToken);
+    saveVerificationStatuses(txn);
 
     removeLeftRooms(txn, res.rooms.leave);
 
     updateSpaces(txn, spaces_with_updates, std::move(rooms_with_space_updates));
 
-    txn.commit();
+    {
+        static auto &commitMs = metrics::histogram("db.sync_commit_ms");
+        metrics::Timer commitTimer(commitMs);
+        commitWithCacheUpdates(txn);
+    }
 
     std::map<QString, bool> readStatus;
 
@@ -2041,8 +2843,8 @@ Cache::saveInvites(lmdb::txn &txn, const std::map<std::string, mtx::responses::I
 
 void
 Cache::saveInvite(lmdb::txn &txn,
-                  lmdb::dbi &statesdb,
-                  lmdb::dbi &membersdb,
+                  RoomDb &statesdb,
+                  RoomDb &membersdb,
                   const mtx::responses::InvitedRoom &room)
 {
     using namespace mtx::events;
@@ -2131,7 +2933,7 @@ Cache::singleRoomInfo(const std::string &room_id)
         if (roomsDb_.get(txn, room_id, data)) {
             try {
                 RoomInfo tmp     = nlohmann::json::parse(data).get<RoomInfo>();
-                tmp.member_count = getMembersDb(txn, room_id).size(txn);
+                tmp.member_count = memberCount_(txn, room_id);
                 tmp.join_rule    = getRoomJoinRule(txn, statesdb);
                 tmp.guest_access = getRoomGuestAccess(txn, statesdb);
 
@@ -2195,7 +2997,7 @@ Cache::getRoomInfo(const std::vector<std::string> &rooms)
         if (roomsDb_.get(txn, room, data)) {
             try {
                 RoomInfo tmp     = nlohmann::json::parse(data).get<RoomInfo>();
-                tmp.member_count = getMembersDb(txn, room).size(txn);
+                tmp.member_count = memberCount_(txn, room);
                 tmp.join_rule    = getRoomJoinRule(txn, statesdb);
                 tmp.guest_access = getRoomGuestAccess(txn, statesdb);
 
@@ -2254,15 +3056,17 @@ Cache::previousBatchToken(const std::string &room_id)
     try {
         auto orderDb = getEventOrderDb(txn, room_id);
 
-        auto cursor = lmdb::cursor::open(txn, orderDb);
+        auto cursor = RoomCursor::open(txn, orderDb);
         std::string_view indexVal, val;
         if (!cursor.get(indexVal, val, MDB_FIRST)) {
             return "";
         }
 
-        auto j = nlohmann::json::parse(val);
+        std::string_view token;
+        if (!getBatchTokensDb(txn, room_id).get(txn, indexVal, token))
+            return "";
 
-        return j.value("prev_batch", "");
+        return std::string(token);
     } catch (...) {
         return "";
     }
@@ -2279,7 +3083,7 @@ Cache::getTimelineMessages(lmdb::txn &txn, const std::string &room_id, uint64_t
 
     std::string_view indexVal, event_id;
 
-    auto cursor = lmdb::cursor::open(txn, orderDb);
+    auto cursor = RoomCursor::open(txn, orderDb);
     if (index == std::numeric_limits<uint64_t>::max()) {
         if (!cursor.get(indexVal, event_id, forward ? MDB_FIRST : MDB_LAST)) {
             messages.end_of_cache = true;
@@ -2345,6 +3149,47 @@ Cache::getEvent(const std::string &room_id, std::string_view event_id)
 
     return te;
 }
+
+std::optional<Cache::EventFields>
+Cache::getEventFields(const std::string &room_id, std::string_view event_id)
+{
+    auto txn      = ro_txn(env_);
+    auto eventsDb = getEventsDb(txn, room_id);
+
+    std::string_view event{};
+    if (!eventsDb.get(txn, event_id, event))
+        return std::nullopt;
+
+    // The json is parsed in place from the database. Everything but the fields below is dropped
+    // while parsing, so no tree is built for bodies, formatting or unsigned data, and no event
+    // variant at all.
+    auto keep = [](int depth, nlohmann::json::parse_event_t e, nlohmann::json &parsed) {
+        if (e != nlohmann::json::parse_event_t::key)
+            return true;
+        if (depth == 1)
+            return parsed == "sender" || parsed == "type" || parsed == "origin_server_ts" ||
+                   parsed == "content";
+        if (depth == 2)
+            return parsed == "m.relates_to" || parsed == "im.nheko.relations.v1.relations";
+        return true;
+    };
+
+    try {
+        auto j = nlohmann::json::parse(event, keep);
+
+        EventFields fields;
+        fields.sender           = j.value("sender", "");
+        fields.type             = j.value("type", "");
+        fields.origin_server_ts = j.value("origin_server_ts", uint64_t{0});
+        if (auto content = j.find("content"); content != j.end() && content->is_object())
+            fields.relations = mtx::common::parse_relations(*content);
+        return fields;
+    } catch (const std::exception &e) {
+        nhlog::db()->error("Failed to parse message from cache {}", e.what());
+        return std::nullopt;
+    }
+}
+
 void
 Cache::storeEvent(const std::string &room_id,
                   const std::string &event_id,
@@ -2386,7 +3231,7 @@ Cache::relatedEvents(const std::string &room_id, const std::string &event_id)
 
     std::vector<std::string> related_ids;
 
-    auto related_cursor         = lmdb::cursor::open(txn, relationsDb);
+    auto related_cursor         = RoomCursor::open(txn, relationsDb);
     std::string_view related_to = event_id, related_event;
     bool first                  = true;
 
@@ -2413,9 +3258,105 @@ size_t
 Cache::memberCount(const std::string &room_id)
 {
     auto txn = ro_txn(env_);
+    return memberCount_(txn, room_id);
+}
+
+size_t
+Cache::memberCount_(lmdb::txn &txn, const std::string &room_id)
+{
+    // lazy loading only syncs some members, but the summary has the real counts
+    std::string_view data;
+    if (!membersLoadedDb_.get(txn, room_id, data) && memberCountsDb_.get(txn, room_id, data)) {
+        try {
+            auto counts = nlohmann::json::parse(data);
+            return counts.value("joined", size_t{0}) + counts.value("invited", size_t{0});
+        } catch (const nlohmann::json::exception &e) {
+            nhlog::db()->warn("failed to parse member counts of {}: {}", room_id, e.what());
+        }
+    }
     return getMembersDb(txn, room_id).size(txn);
 }
 
+void
+Cache::saveRoomSummaries(const nlohmann::json &joinedRooms)
+{
+    auto txn = lmdb::txn::begin(env_);
+    for (const auto &[room_id, room] : joinedRooms.items()) {
+        auto summary = room.find("summary");
+        if (summary == room.end() || !summary->is_object())
+            continue;
+
+        // only the counts that changed are sent
+        nlohmann::json counts = nlohmann::json::object();
+        std::string_view data;
+        if (memberCountsDb_.get(txn, room_id, data)) {
+            try {
+                counts = nlohmann::json::parse(data);
+            } catch (const nlohmann::json::exception &e) {
+                nhlog::db()->warn("failed to parse member counts of {}: {}", room_id, e.what());
+            }
+        }
+
+        bool changed = false;
+        for (const auto &[field, key] : {std::pair{"m.joined_member_count", "joined"},
+                                         std::pair{"m.invited_member_count", "invited"}}) {
+            if (auto count = summary->find(field);
+                count != summary->end() && count->is_number_unsigned()) {
+                counts[key] = count->get<size_t>();
+                changed     = true;
+            }
+        }
+        // the other members of a room without a name, which is how direct chats are found
+        if (auto heroes = summary->find("m.heroes");
+            heroes != summary->end() && heroes->is_array()) {
+            counts["heroes"] = *heroes;
+            changed          = true;
+        }
+        if (changed)
+            memberCountsDb_.put(txn, room_id, counts.dump());
+    }
+    txn.commit();
+}
+
+bool
+Cache::membersFullyLoaded(const std::string &room_id)
+{
+    auto txn = ro_txn(env_);
+    std::string_view unused;
+    return membersLoadedDb_.get(txn, room_id, unused);
+}
+
+bool
+Cache::saveMembers(const std::string &room_id,
+                   const std::vector<mtx::events::StateEvent<mtx::events::state::Member>> &members,
+                   const std::string &at)
+{
+    mtx::responses::StateEvents state;
+    state.events.reserve(members.size());
+    for (const auto &member : members)
+        state.events.emplace_back(member);
+
+    auto txn = beginWithCacheUpdates();
+
+    // Syncs after `at` may have changed some of the members already. Checked in the write txn, so
+    // no sync can be saved between the check and the members.
+    std::string_view token;
+    if (!syncStateDb_.get(txn, NEXT_BATCH_KEY, token))
+        token = "";
+    if (token != at)
+        return false;
+
+    auto statesdb    = getStatesDb(txn, room_id);
+    auto stateskeydb = getStatesKeyDb(txn, room_id);
+    auto membersdb   = getMembersDb(txn, room_id);
+    auto eventsDb    = getEventsDb(txn, room_id);
+
+    saveStateEvents(txn, statesdb, stateskeydb, membersdb, eventsDb, room_id, state.events);
+    membersLoadedDb_.put(txn, room_id, "1");
+    commitWithCacheUpdates(txn);
+    return true;
+}
+
 QMap<QString, RoomInfo>
 Cache::roomInfo(bool withInvites)
 {
@@ -2430,7 +3371,7 @@ Cache::roomInfo(bool withInvites)
     auto roomsCursor = lmdb::cursor::open(txn, roomsDb_);
     while (roomsCursor.get(room_id, room_data, MDB_NEXT)) {
         RoomInfo tmp     = nlohmann::json::parse(std::move(room_data)).get<RoomInfo>();
-        tmp.member_count = getMembersDb(txn, std::string(room_id)).size(txn);
+        tmp.member_count = memberCount_(txn, std::string(room_id));
         result.insert(QString::fromStdString(std::string(room_id)), std::move(tmp));
     }
     roomsCursor.close();
@@ -2485,7 +3426,7 @@ Cache::roomNamesAndAliases()
 std::string
 Cache::getLastEventId(lmdb::txn &txn, const std::string &room_id)
 {
-    lmdb::dbi orderDb;
+    RoomDb orderDb;
     try {
         orderDb = getOrderToMessageDb(txn, room_id);
     } catch (lmdb::runtime_error &e) {
@@ -2496,7 +3437,7 @@ Cache::getLastEventId(lmdb::txn &txn, const std::string &room_id)
 
     std::string_view indexVal, val;
 
-    auto cursor = lmdb::cursor::open(txn, orderDb);
+    auto cursor = RoomCursor::open(txn, orderDb);
     if (!cursor.get(indexVal, val, MDB_LAST)) {
         return {};
     }
@@ -2508,7 +3449,7 @@ std::optional<Cache::TimelineRange>
 Cache::getTimelineRange(const std::string &room_id)
 {
     auto txn = ro_txn(env_);
-    lmdb::dbi orderDb;
+    RoomDb orderDb;
     try {
         orderDb = getOrderToMessageDb(txn, room_id);
     } catch (lmdb::runtime_error &e) {
@@ -2519,7 +3460,7 @@ Cache::getTimelineRange(const std::string &room_id)
 
     std::string_view indexVal, val;
 
-    auto cursor = lmdb::cursor::open(txn, orderDb);
+    auto cursor = RoomCursor::open(txn, orderDb);
     if (!cursor.get(indexVal, val, MDB_LAST)) {
         return {};
     }
@@ -2542,7 +3483,7 @@ Cache::getTimelineIndex(const std::string &room_id, std::string_view event_id)
 
     auto txn = ro_txn(env_);
 
-    lmdb::dbi orderDb;
+    RoomDb orderDb;
     try {
         orderDb = getMessageToOrderDb(txn, room_id);
     } catch (lmdb::runtime_error &e) {
@@ -2569,7 +3510,7 @@ Cache::getEventIndex(const std::string &room_id, std::string_view event_id)
 
     auto txn = ro_txn(env_);
 
-    lmdb::dbi orderDb;
+    RoomDb orderDb;
     try {
         orderDb = getEventToOrderDb(txn, room_id);
     } catch (lmdb::runtime_error &e) {
@@ -2596,13 +3537,13 @@ Cache::lastInvisibleEventAfter(const std::string &room_id, std::string_view even
 
     auto txn = ro_txn(env_);
 
-    lmdb::dbi orderDb;
-    lmdb::dbi eventOrderDb;
-    lmdb::dbi timelineDb;
+    RoomDb orderDb;
+    RoomDb eventOrderDb;
+    RoomDb visibleDb;
     try {
         orderDb      = getEventToOrderDb(txn, room_id);
         eventOrderDb = getEventOrderDb(txn, room_id);
-        timelineDb   = getMessageToOrderDb(txn, room_id);
+        visibleDb    = getVisibleOrderDb(txn, room_id);
     } catch (lmdb::runtime_error &e) {
         nhlog::db()->error(
           "Can't open db for room '{}', probably doesn't exist yet. ({})", room_id, e.what());
@@ -2617,23 +3558,24 @@ Cache::lastInvisibleEventAfter(const std::string &room_id, std::string_view even
     }
 
     try {
-        uint64_t prevIdx = lmdb::from_sv<uint64_t>(indexVal);
-        std::string prevId{event_id};
-
-        auto cursor = lmdb::cursor::open(txn, eventOrderDb);
-        cursor.get(indexVal, MDB_SET);
-        while (cursor.get(indexVal, event_id, MDB_NEXT)) {
-            std::string evId = nlohmann::json::parse(event_id)["event_id"].get<std::string>();
-            std::string_view temp;
-            if (timelineDb.get(txn, evId, temp)) {
-                return std::pair{prevIdx, std::string(prevId)};
-            } else {
-                prevIdx = lmdb::from_sv<uint64_t>(indexVal);
-                prevId  = std::move(evId);
-            }
-        }
+        uint64_t idx = lmdb::from_sv<uint64_t>(indexVal);
+
+        // the event before the next visible one or the last event
+        std::string_view idVal;
+        auto visibleCursor = RoomCursor::open(txn, visibleDb);
+        auto cursor        = RoomCursor::open(txn, eventOrderDb);
+        uint64_t nextIdx   = idx + 1;
+        indexVal           = lmdb::to_sv(nextIdx);
+
+        bool found = false;
+        if (visibleCursor.get(indexVal, MDB_SET_RANGE))
+            found = cursor.get(indexVal, MDB_SET) && cursor.get(indexVal, idVal, MDB_PREV);
+        else
+            found = cursor.get(indexVal, idVal, MDB_LAST);
+        if (!found)
+            return std::pair{idx, std::string(event_id)};
 
-        return std::pair{prevIdx, std::string(prevId)};
+        return std::pair{lmdb::from_sv<uint64_t>(indexVal), std::string(idVal)};
     } catch (lmdb::runtime_error &e) {
         nhlog::db()->error("Failed to get last invisible event after {}", event_id, e.what());
         return {};
@@ -2647,13 +3589,13 @@ Cache::lastVisibleEvent(const std::string &room_id, std::string_view event_id)
         return {};
 
     auto txn = ro_txn(env_);
-    lmdb::dbi orderDb;
-    lmdb::dbi eventOrderDb;
-    lmdb::dbi timelineDb;
+    RoomDb orderDb;
+    RoomDb eventOrderDb;
+    RoomDb visibleDb;
     try {
         orderDb      = getEventToOrderDb(txn, room_id);
         eventOrderDb = getEventOrderDb(txn, room_id);
-        timelineDb   = getMessageToOrderDb(txn, room_id);
+        visibleDb    = getVisibleOrderDb(txn, room_id);
 
         std::string_view indexVal;
 
@@ -2663,21 +3605,23 @@ Cache::lastVisibleEvent(const std::string &room_id, std::string_view event_id)
         }
 
         uint64_t idx = lmdb::from_sv<uint64_t>(indexVal);
-        std::string evId{event_id};
-
-        auto cursor = lmdb::cursor::open(txn, eventOrderDb);
-        if (cursor.get(indexVal, event_id, MDB_SET)) {
-            do {
-                evId = nlohmann::json::parse(event_id)["event_id"].get<std::string>();
-                std::string_view temp;
-                idx = lmdb::from_sv<uint64_t>(indexVal);
-                if (timelineDb.get(txn, evId, temp)) {
-                    return std::pair{idx, evId};
-                }
-            } while (cursor.get(indexVal, event_id, MDB_PREV));
-        }
 
-        return std::pair{idx, evId};
+        // the visible event at or before idx or the first event
+        std::string_view idVal;
+        auto cursor      = RoomCursor::open(txn, visibleDb);
+        auto orderCursor = RoomCursor::open(txn, eventOrderDb);
+        indexVal         = lmdb::to_sv(idx);
+
+        bool found = false;
+        if (cursor.get(indexVal, idVal, MDB_SET_RANGE))
+            found = lmdb::from_sv<uint64_t>(indexVal) == idx ||
+                    cursor.get(indexVal, idVal, MDB_PREV);
+        else
+            found = cursor.get(indexVal, idVal, MDB_LAST);
+        if (!found && !orderCursor.get(indexVal, idVal, MDB_FIRST))
+            return std::pair{idx, std::string(event_id)};
+
+        return std::pair{lmdb::from_sv<uint64_t>(indexVal), std::string(idVal)};
     } catch (lmdb::runtime_error &e) {
         nhlog::db()->error("Failed to get last visible event after {}", event_id, e.what());
         return {};
@@ -2688,7 +3632,7 @@ std::optional<std::string>
 Cache::getTimelineEventId(const std::string &room_id, uint64_t index)
 {
     auto txn = ro_txn(env_);
-    lmdb::dbi orderDb;
+    RoomDb orderDb;
     try {
         orderDb = getOrderToMessageDb(txn, room_id);
     } catch (lmdb::runtime_error &e) {
@@ -2707,6 +3651,51 @@ Cache::getTimelineEventId(const std::string &room_id, uint64_t index)
     return std::string(val);
 }
 
+std::vector<Cache::TimelineEntry>
+Cache::getTimelineEvents(const std::string &room_id, uint64_t first, uint64_t last)
+{
+    std::vector<TimelineEntry> entries;
+    if (first > last)
+        return entries;
+
+    try {
+        auto txn         = ro_txn(env_);
+        auto orderDb     = getOrderToMessageDb(txn, room_id);
+        auto eventsDb    = getEventsDb(txn, room_id);
+        auto relationsDb = getRelationsDb(txn, room_id);
+
+        std::string_view indexVal = lmdb::to_sv(first), event_id;
+
+        auto cursor = RoomCursor::open(txn, orderDb);
+        bool found  = cursor.get(indexVal, event_id, MDB_SET_RANGE);
+        for (; found; found = cursor.get(indexVal, event_id, MDB_NEXT)) {
+            auto index = lmdb::from_sv<uint64_t>(indexVal);
+            if (index > last)
+                break;
+
+            std::string_view event;
+            if (!eventsDb.get(txn, event_id, event))
+                continue;
+
+            TimelineEntry entry{index, {}, false};
+            try {
+                from_json(nlohmann::json::parse(event), entry.event);
+            } catch (std::exception &e) {
+                nhlog::db()->error("Failed to parse message from cache {}", e.what());
+                continue;
+            }
+
+            std::string_view unused;
+            entry.has_relations = relationsDb.get(txn, event_id, unused);
+            entries.push_back(std::move(entry));
+        }
+    } catch (const lmdb::error &e) {
+        nhlog::db()->error("Failed to load timeline of {}: {}", room_id, e.what());
+    }
+
+    return entries;
+}
+
 QHash<QString, RoomInfo>
 Cache::invites()
 {
@@ -2763,7 +3752,7 @@ Cache::invite(std::string_view roomid)
 }
 
 QString
-Cache::getRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
+Cache::getRoomAvatarUrl(lmdb::txn &txn, RoomDb &statesdb, RoomDb &membersdb)
 {
     using namespace mtx::events;
     using namespace mtx::events::state;
@@ -2788,7 +3777,7 @@ Cache::getRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersd
     if (membersdb.size(txn) > 2)
         return QString();
 
-    auto cursor = lmdb::cursor::open(txn, membersdb);
+    auto cursor = RoomCursor::open(txn, membersdb);
     std::string_view user_id;
     std::string_view member_data;
     std::string fallback_url;
@@ -2816,7 +3805,7 @@ Cache::getRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersd
 }
 
 QString
-Cache::getRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
+Cache::getRoomName(lmdb::txn &txn, RoomDb &statesdb, RoomDb &membersdb)
 {
     using namespace mtx::events;
     using namespace mtx::events::state;
@@ -2852,7 +3841,7 @@ Cache::getRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
         }
     }
 
-    auto cursor      = lmdb::cursor::open(txn, membersdb);
+    auto cursor      = RoomCursor::open(txn, membersdb);
     const auto total = membersdb.size(txn);
 
     std::size_t ii = 0;
@@ -2893,7 +3882,7 @@ Cache::getRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
 }
 
 mtx::events::state::JoinRule
-Cache::getRoomJoinRule(lmdb::txn &txn, lmdb::dbi &statesdb)
+Cache::getRoomJoinRule(lmdb::txn &txn, RoomDb &statesdb)
 {
     using namespace mtx::events;
     using namespace mtx::events::state;
@@ -2914,7 +3903,7 @@ Cache::getRoomJoinRule(lmdb::txn &txn, lmdb::dbi &statesdb)
 }
 
 bool
-Cache::getRoomGuestAccess(lmdb::txn &txn, lmdb::dbi &statesdb)
+Cache::getRoomGuestAccess(lmdb::txn &txn, RoomDb &statesdb)
 {
     using namespace mtx::events;
     using namespace mtx::events::state;
@@ -2935,7 +3924,7 @@ Cache::getRoomGuestAccess(lmdb::txn &txn, lmdb::dbi &statesdb)
 }
 
 QString
-Cache::getRoomTopic(lmdb::txn &txn, lmdb::dbi &statesdb)
+Cache::getRoomTopic(lmdb::txn &txn, RoomDb &statesdb)
 {
     using namespace mtx::events;
     using namespace mtx::events::state;
@@ -2958,7 +3947,7 @@ Cache::getRoomTopic(lmdb::txn &txn, lmdb::dbi &statesdb)
 }
 
 QString
-Cache::getRoomVersion(lmdb::txn &txn, lmdb::dbi &statesdb)
+Cache::getRoomVersion(lmdb::txn &txn, RoomDb &statesdb)
 {
     using namespace mtx::events;
     using namespace mtx::events::state;
@@ -2982,7 +3971,7 @@ Cache::getRoomVersion(lmdb::txn &txn, lmdb::dbi &statesdb)
 }
 
 bool
-Cache::getRoomIsSpace(lmdb::txn &txn, lmdb::dbi &statesdb)
+Cache::getRoomIsSpace(lmdb::txn &txn, RoomDb &statesdb)
 {
     using namespace mtx::events;
     using namespace mtx::events::state;
@@ -3005,7 +3994,7 @@ Cache::getRoomIsSpace(lmdb::txn &txn, lmdb::dbi &statesdb)
 }
 
 QString
-Cache::getInviteRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
+Cache::getInviteRoomName(lmdb::txn &txn, RoomDb &statesdb, RoomDb &membersdb)
 {
     using namespace mtx::events;
     using namespace mtx::events::state;
@@ -3023,7 +4012,7 @@ Cache::getInviteRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &members
         }
     }
 
-    auto cursor = lmdb::cursor::open(txn, membersdb);
+    auto cursor = RoomCursor::open(txn, membersdb);
     std::string_view user_id, member_data;
 
     while (cursor.get(user_id, member_data, MDB_NEXT)) {
@@ -3046,7 +4035,7 @@ Cache::getInviteRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &members
 }
 
 QString
-Cache::getInviteRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
+Cache::getInviteRoomAvatarUrl(lmdb::txn &txn, RoomDb &statesdb, RoomDb &membersdb)
 {
     using namespace mtx::events;
     using namespace mtx::events::state;
@@ -3064,7 +4053,7 @@ Cache::getInviteRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &me
         }
     }
 
-    auto cursor = lmdb::cursor::open(txn, membersdb);
+    auto cursor = RoomCursor::open(txn, membersdb);
     std::string_view user_id, member_data;
 
     while (cursor.get(user_id, member_data, MDB_NEXT)) {
@@ -3087,7 +4076,7 @@ Cache::getInviteRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &me
 }
 
 QString
-Cache::getInviteRoomTopic(lmdb::txn &txn, lmdb::dbi &db)
+Cache::getInviteRoomTopic(lmdb::txn &txn, RoomDb &db)
 {
     using namespace mtx::events;
     using namespace mtx::events::state;
@@ -3108,7 +4097,7 @@ Cache::getInviteRoomTopic(lmdb::txn &txn, lmdb::dbi &db)
 }
 
 bool
-Cache::getInviteRoomIsSpace(lmdb::txn &txn, lmdb::dbi &db)
+Cache::getInviteRoomIsSpace(lmdb::txn &txn, RoomDb &db)
 {
     using namespace mtx::events;
     using namespace mtx::events::state;
@@ -3146,23 +4135,83 @@ Cache::joinedRooms()
     return room_ids;
 }
 
+std::vector<std::string>
+Cache::sharedRooms(const std::string &user_id)
+{
+    std::vector<std::string> rooms;
+    std::unordered_set<std::string> seen;
+
+    try {
+        auto txn = ro_txn(env_);
+
+        std::string_view key = user_id, room_id;
+        auto cursor          = lmdb::cursor::open(txn, userRoomsDb_);
+        if (cursor.get(key, room_id, MDB_SET)) {
+            bool first = true;
+            while (cursor.get(key, room_id, first ? MDB_FIRST_DUP : MDB_NEXT_DUP)) {
+                first = false;
+                rooms.emplace_back(room_id);
+                seen.emplace(room_id);
+            }
+        }
+        cursor.close();
+
+        // With lazy loading the index misses rooms, in which the user didn't speak recently.
+        // m.direct and the heroes of the summaries name the other members of direct chats, so
+        // they are used for joined rooms without all members.
+        std::string_view unused;
+        auto addUnloaded = [&](const std::string &candidate) {
+            if (!seen.count(candidate) && roomsDb_.get(txn, candidate, unused) &&
+                !membersLoadedDb_.get(txn, candidate, unused)) {
+                rooms.push_back(candidate);
+                seen.insert(candidate);
+            }
+        };
+
+        if (auto ev = getAccountData(txn, mtx::events::EventType::Direct, "")) {
+            if (auto direct =
+                  std::get_if<mtx::events::AccountDataEvent<mtx::events::account_data::Direct>>(
+                    &ev.value())) {
+                if (auto it = direct->content.user_to_rooms.find(user_id);
+                    it != direct->content.user_to_rooms.end())
+                    for (const auto &candidate : it->second)
+                        addUnloaded(candidate);
+            }
+        }
+
+        std::string_view summary_room, data;
+        auto summaries = lmdb::cursor::open(txn, memberCountsDb_);
+        while (summaries.get(summary_room, data, MDB_NEXT)) {
+            try {
+                auto heroes = nlohmann::json::parse(data).value("heroes", nlohmann::json::array());
+                if (std::find(heroes.begin(), heroes.end(), user_id) != heroes.end())
+                    addUnloaded(std::string(summary_room));
+            } catch (const nlohmann::json::exception &e) {
+                nhlog::db()->warn("failed to parse the summary of {}: {}", summary_room, e.what());
+            }
+        }
+        summaries.close();
+    } catch (const lmdb::error &e) {
+        nhlog::db()->warn("failed to read the rooms of {}: {}", user_id, e.what());
+    }
+
+    return rooms;
+}
+
 std::map<std::string, RoomInfo>
 Cache::getCommonRooms(const std::string &user_id)
 {
     std::map<std::string, RoomInfo> result;
 
-    auto txn = ro_txn(env_);
+    auto rooms = sharedRooms(user_id);
+    auto txn   = ro_txn(env_);
 
-    std::string_view room_id;
     std::string_view room_data;
-    std::string_view member_info;
-
-    auto roomsCursor = lmdb::cursor::open(txn, roomsDb_);
-    while (roomsCursor.get(room_id, room_data, MDB_NEXT)) {
+    for (auto &room_id : rooms) {
         try {
-            if (getMembersDb(txn, std::string(room_id)).get(txn, user_id, member_info)) {
-                RoomInfo tmp = nlohmann::json::parse(std::move(room_data)).get<RoomInfo>();
-                result.emplace(std::string(room_id), std::move(tmp));
+            if (roomsDb_.get(txn, room_id, room_data)) {
+                RoomInfo tmp = nlohmann::json::parse(room_data).get<RoomInfo>();
+                result.emplace(std::move(room_id), std::move(tmp));
             }
         } catch (std::exception &e) {
             nhlog::db()->warn("Failed to read common room for member ({}) in room ({}): {}",
@@ -3171,7 +4220,6 @@ Cache::getCommonRooms(const std::string &user_id)
                               e.what());
         }
     }
-    roomsCursor.close();
 
     return result;
 }
@@ -3182,43 +4230,177 @@ Cache::getMember(const std::string &room_id, const std::string &user_id)
     if (user_id.empty() || !env_.handle())
         return std::nullopt;
 
+    return cachedMember(room_id, user_id).info;
+}
+
+CachedMember
+Cache::cachedMember(const std::string &room_id, const std::string &user_id)
+{
+    uint64_t generation = 0;
+    {
+        std::unique_lock<std::mutex> lock(member_storage.mtx);
+        if (auto room = member_storage.rooms.find(room_id); room != member_storage.rooms.end())
+            if (auto member = room->second.find(user_id); member != room->second.end())
+                return member->second;
+        generation = member_storage.generation;
+    }
+
+    std::optional<MemberInfo> info;
     try {
         auto txn = ro_txn(env_);
 
         auto membersdb = getMembersDb(txn, room_id);
 
-        std::string_view info;
-        if (membersdb.get(txn, user_id, info)) {
-            MemberInfo m = nlohmann::json::parse(info).get<MemberInfo>();
-            return m;
-        }
+        std::string_view data;
+        if (membersdb.get(txn, user_id, data))
+            info = nlohmann::json::parse(data).get<MemberInfo>();
     } catch (std::exception &e) {
         nhlog::db()->warn(
           "Failed to read member ({}) in room ({}): {}", user_id, room_id, e.what());
+        return CachedMember{std::nullopt, user_id};
     }
-    return std::nullopt;
-}
 
-std::vector<RoomMember>
-Cache::getMembers(const std::string &room_id, std::size_t startIndex, std::size_t len)
-{
-    try {
-        auto txn    = ro_txn(env_);
-        auto db     = getMembersDb(txn, room_id);
-        auto cursor = lmdb::cursor::open(txn, db);
+    auto member = makeCachedMember(user_id, std::move(info));
 
-        std::size_t currentIndex = 0;
+    // Don't remember users, that are no members, otherwise every sender of every event ever seen
+    // would stay in memory.
+    if (!member.info)
+        return member;
 
-        const auto endIndex = std::min(startIndex + len, db.size(txn));
+    std::unique_lock<std::mutex> lock(member_storage.mtx);
+    // don't cache what we read, if the members changed in the mean time
+    if (generation != member_storage.generation)
+        return member;
+    return member_storage.rooms[room_id].try_emplace(user_id, std::move(member)).first->second;
+}
 
-        std::vector<RoomMember> members;
+void
+Cache::updateMemberCache(const std::string &room_id,
+                         const std::string &user_id,
+                         std::optional<MemberInfo> info)
+{
+    pendingCacheUpdates_.push_back(
+      [this, room_id, user_id, member = makeCachedMember(user_id, std::move(info))]() mutable {
+          std::unique_lock<std::mutex> lock(member_storage.mtx);
+          ++member_storage.generation;
+          if (member.info) {
+              member_storage.rooms[room_id].insert_or_assign(user_id, std::move(member));
+          } else if (auto room = member_storage.rooms.find(room_id);
+                     room != member_storage.rooms.end()) {
+              room->second.erase(user_id);
+          }
+      });
+}
 
-        std::string_view user_id, user_data;
-        while (cursor.get(user_id, user_data, MDB_NEXT)) {
-            if (currentIndex < startIndex) {
-                currentIndex += 1;
-                continue;
-            }
+void
+Cache::clearMemberCache(const std::string &room_id)
+{
+    pendingCacheUpdates_.push_back([this, room_id] {
+        std::unique_lock<std::mutex> lock(member_storage.mtx);
+        ++member_storage.generation;
+        member_storage.rooms.erase(room_id);
+    });
+}
+
+lmdb::txn
+Cache::beginWithCacheUpdates()
+{
+    auto txn = lmdb::txn::begin(env_);
+    // We hold the write lock now, so anything still queued is from a txn, that was aborted.
+    pendingCacheUpdates_.clear();
+    return txn;
+}
+
+void
+Cache::commitWithCacheUpdates(lmdb::txn &txn)
+{
+    auto updates = std::move(pendingCacheUpdates_);
+    pendingCacheUpdates_.clear();
+
+    // Taken before the commit, so the next write txn can't apply its updates before ours.
+    std::unique_lock<std::mutex> lock(cacheUpdatesMtx_);
+    txn.commit();
+    for (auto &update : updates)
+        update();
+}
+
+std::shared_ptr<const CachedPowerLevels>
+Cache::powerLevels(const std::string &room_id)
+{
+    uint64_t generation = 0;
+    {
+        std::unique_lock<std::mutex> lock(power_levels_storage.mtx);
+        if (auto it = power_levels_storage.rooms.find(room_id);
+            it != power_levels_storage.rooms.end())
+            return it->second;
+        generation = power_levels_storage.generation;
+    }
+
+    std::shared_ptr<CachedPowerLevels> pl;
+    try {
+        auto txn = ro_txn(env_);
+        pl       = powerLevels_(txn, room_id);
+    } catch (const lmdb::error &e) {
+        nhlog::db()->warn("failed to read power levels of {}: {}", room_id, e.what());
+        return std::make_shared<const CachedPowerLevels>();
+    }
+
+    std::unique_lock<std::mutex> lock(power_levels_storage.mtx);
+    // don't cache what we read, if the power levels changed in the mean time
+    if (generation == power_levels_storage.generation) {
+        pl->generation = generation;
+        power_levels_storage.rooms[room_id] = pl;
+    }
+    return pl;
+}
+
+std::shared_ptr<CachedPowerLevels>
+Cache::powerLevels_(lmdb::txn &txn, const std::string &room_id)
+{
+    auto pl = std::make_shared<CachedPowerLevels>();
+    if (auto event = getStateEvent<mtx::events::state::PowerLevels>(txn, room_id)) {
+        pl->exists  = true;
+        pl->content = std::move(event->content);
+    }
+    return pl;
+}
+
+void
+Cache::updatePowerLevelsCache(const std::string &room_id,
+                              std::optional<mtx::events::state::PowerLevels> content)
+{
+    auto pl    = std::make_shared<CachedPowerLevels>();
+    pl->exists = content.has_value();
+    if (content)
+        pl->content = std::move(*content);
+
+    pendingCacheUpdates_.push_back([this, room_id, pl = std::move(pl)]() mutable {
+        std::unique_lock<std::mutex> lock(power_levels_storage.mtx);
+        pl->generation                      = ++power_levels_storage.generation;
+        power_levels_storage.rooms[room_id] = std::move(pl);
+    });
+}
+
+std::vector<RoomMember>
+Cache::getMembers(const std::string &room_id, std::size_t startIndex, std::size_t len)
+{
+    try {
+        auto txn    = ro_txn(env_);
+        auto db     = getMembersDb(txn, room_id);
+        auto cursor = RoomCursor::open(txn, db);
+
+        std::size_t currentIndex = 0;
+
+        const auto endIndex = std::min(startIndex + len, db.size(txn));
+
+        std::vector<RoomMember> members;
+
+        std::string_view user_id, user_data;
+        while (cursor.get(user_id, user_data, MDB_NEXT)) {
+            if (currentIndex < startIndex) {
+                currentIndex += 1;
+                continue;
+            }
 
             if (currentIndex >= endIndex)
                 break;
@@ -3277,7 +4459,7 @@ Cache::getMembersFromInvite(const std::string &room_id, std::size_t startIndex,
         std::vector<RoomMember> members;
 
         auto db     = getInviteMembersDb(txn, room_id);
-        auto cursor = lmdb::cursor::open(txn, db);
+        auto cursor = RoomCursor::open(txn, db);
 
         std::size_t currentIndex = 0;
 
@@ -3363,7 +4545,7 @@ Cache::pendingEvents(const std::string &room_id)
 
     try {
         {
-            auto pendingCursor = lmdb::cursor::open(txn, pending);
+            auto pendingCursor = RoomCursor::open(txn, pending);
             std::string_view tsIgnored, pendingTxn;
             while (pendingCursor.get(tsIgnored, pendingTxn, MDB_NEXT)) {
                 related_ids.emplace_back(pendingTxn.data(), pendingTxn.size());
@@ -3376,38 +4558,39 @@ Cache::pendingEvents(const std::string &room_id)
     return related_ids;
 }
 
-std::optional<mtx::events::collections::TimelineEvent>
-Cache::firstPendingMessage(const std::string &room_id)
+std::vector<mtx::events::collections::TimelineEvent>
+Cache::pendingMessages(const std::string &room_id, size_t limit)
 {
     auto txn     = lmdb::txn::begin(env_);
     auto pending = getPendingMessagesDb(txn, room_id);
 
+    std::vector<mtx::events::collections::TimelineEvent> messages;
     try {
-        auto pendingCursor = lmdb::cursor::open(txn, pending);
+        auto eventsDb      = getEventsDb(txn, room_id);
+        auto pendingCursor = RoomCursor::open(txn, pending);
         std::string_view tsIgnored, pendingTxn;
-        while (pendingCursor.get(tsIgnored, pendingTxn, MDB_NEXT)) {
-            auto eventsDb = getEventsDb(txn, room_id);
+        while (messages.size() < limit && pendingCursor.get(tsIgnored, pendingTxn, MDB_NEXT)) {
             std::string_view event;
             if (!eventsDb.get(txn, pendingTxn, event)) {
-                pending.del(txn, tsIgnored, pendingTxn);
+                pendingCursor.del();
                 continue;
             }
 
             try {
                 mtx::events::collections::TimelineEvent te;
                 from_json(nlohmann::json::parse(event), te);
-
-                pendingCursor.close();
-                return te;
+                messages.push_back(std::move(te));
             } catch (std::exception &e) {
                 nhlog::db()->error("Failed to parse message from cache {}", e.what());
-                pending.del(txn, tsIgnored, pendingTxn);
-                continue;
+                pendingCursor.del();
             }
         }
+        pendingCursor.close();
+        txn.commit();
     } catch (const lmdb::error &e) {
+        nhlog::db()->error("pending messages error: {}", e.what());
     }
-    return std::nullopt;
+    return messages;
 }
 
 void
@@ -3417,11 +4600,11 @@ Cache::removePendingStatus(const std::string &room_id, const std::string &txn_id
     auto pending = getPendingMessagesDb(txn, room_id);
 
     {
-        auto pendingCursor = lmdb::cursor::open(txn, pending);
+        auto pendingCursor = RoomCursor::open(txn, pending);
         std::string_view tsIgnored, pendingTxn;
         while (pendingCursor.get(tsIgnored, pendingTxn, MDB_NEXT)) {
             if (std::string_view(pendingTxn.data(), pendingTxn.size()) == txn_id)
-                lmdb::cursor_del(pendingCursor);
+                pendingCursor.del();
         }
     }
 
@@ -3430,7 +4613,7 @@ Cache::removePendingStatus(const std::string &room_id, const std::string &txn_id
 
 void
 Cache::saveTimelineMessages(lmdb::txn &txn,
-                            lmdb::dbi &eventsDb,
+                            RoomDb &eventsDb,
                             const std::string &room_id,
                             const mtx::responses::Timeline &res)
 {
@@ -3441,30 +4624,39 @@ Cache::saveTimelineMessages(lmdb::txn &txn,
 
     auto orderDb     = getEventOrderDb(txn, room_id);
     auto evToOrderDb = getEventToOrderDb(txn, room_id);
+    auto tokensDb    = getBatchTokensDb(txn, room_id);
     auto msg2orderDb = getMessageToOrderDb(txn, room_id);
     auto order2msgDb = getOrderToMessageDb(txn, room_id);
+    auto visibleDb   = getVisibleOrderDb(txn, room_id);
     auto pending     = getPendingMessagesDb(txn, room_id);
 
     if (res.limited) {
-        lmdb::dbi_drop(txn, orderDb, false);
-        lmdb::dbi_drop(txn, evToOrderDb, false);
-        lmdb::dbi_drop(txn, msg2orderDb, false);
-        lmdb::dbi_drop(txn, order2msgDb, false);
-        lmdb::dbi_drop(txn, pending, true);
+        orderDb.drop(txn);
+        evToOrderDb.drop(txn);
+        tokensDb.drop(txn);
+        msg2orderDb.drop(txn);
+        order2msgDb.drop(txn);
+        visibleDb.drop(txn);
+        pending.drop(txn);
+        // membership changes in the gap are only lazy loaded, so request all members again
+        // before the next message is encrypted
+        membersLoadedDb_.del(txn, room_id);
     }
 
+    auto hiddenTypes = hiddenEventTypes(txn, room_id);
+
     using namespace mtx::events;
     using namespace mtx::events::state;
 
     std::string_view indexVal, val;
     uint64_t index = std::numeric_limits<uint64_t>::max() / 2;
-    auto cursor    = lmdb::cursor::open(txn, orderDb);
+    auto cursor    = RoomCursor::open(txn, orderDb);
     if (cursor.get(indexVal, val, MDB_LAST)) {
         index = lmdb::from_sv<uint64_t>(indexVal);
     }
 
     uint64_t msgIndex = std::numeric_limits<uint64_t>::max() / 2;
-    auto msgCursor    = lmdb::cursor::open(txn, order2msgDb);
+    auto msgCursor    = RoomCursor::open(txn, order2msgDb);
     if (msgCursor.get(indexVal, val, MDB_LAST)) {
         msgIndex = lmdb::from_sv<uint64_t>(indexVal);
     }
@@ -3482,10 +4674,7 @@ Cache::saveTimelineMessages(lmdb::txn &txn,
 
         std::string_view event_id = event_id_val;
 
-        nlohmann::json orderEntry = nlohmann::json::object();
-        orderEntry["event_id"]    = event_id_val;
-        if (first && !res.prev_batch.empty())
-            orderEntry["prev_batch"] = res.prev_batch;
+        bool storeToken = first && !res.prev_batch.empty();
 
         std::string_view txn_order;
         if (!txn_id.empty() && evToOrderDb.get(txn, txn_id, txn_order)) {
@@ -3497,9 +4686,15 @@ Cache::saveTimelineMessages(lmdb::txn &txn,
                 order2msgDb.put(txn, msg_txn_order, event_id);
                 msg2orderDb.put(txn, event_id, msg_txn_order);
                 msg2orderDb.del(txn, txn_id);
+                visibleDb.put(txn, txn_order, event_id);
             }
 
-            orderDb.put(txn, txn_order, orderEntry.dump());
+            orderDb.put(txn, txn_order, event_id);
+            // the token of the pending event is not the one of the batch it arrived with
+            if (storeToken)
+                tokensDb.put(txn, txn_order, res.prev_batch);
+            else
+                tokensDb.del(txn, txn_order);
             evToOrderDb.put(txn, event_id, txn_order);
             evToOrderDb.del(txn, txn_id);
 
@@ -3513,11 +4708,11 @@ Cache::saveTimelineMessages(lmdb::txn &txn,
                 }
             }
 
-            auto pendingCursor = lmdb::cursor::open(txn, pending);
+            auto pendingCursor = RoomCursor::open(txn, pending);
             std::string_view tsIgnored, pendingTxn;
             while (pendingCursor.get(tsIgnored, pendingTxn, MDB_NEXT)) {
                 if (std::string_view(pendingTxn.data(), pendingTxn.size()) == txn_id)
-                    lmdb::cursor_del(pendingCursor);
+                    pendingCursor.del();
             }
         } else if (auto redaction =
                      std::get_if<mtx::events::RedactionEvent<mtx::events::msg::Redaction>>(&e)) {
@@ -3560,20 +4755,25 @@ Cache::saveTimelineMessages(lmdb::txn &txn,
             if (!evToOrderDb.get(txn, event_id, unused_read)) {
                 ++index;
 
-                nhlog::db()->debug("saving '{}'", orderEntry.dump());
+                nhlog::db()->debug("saving '{}'", event_id);
 
-                cursor.put(lmdb::to_sv(index), orderEntry.dump(), MDB_APPEND);
+                cursor.put(lmdb::to_sv(index), event_id, MDB_APPEND);
+                if (storeToken)
+                    tokensDb.put(txn, lmdb::to_sv(index), res.prev_batch);
+                else
+                    tokensDb.del(txn, lmdb::to_sv(index));
                 evToOrderDb.put(txn, event_id, lmdb::to_sv(index));
 
                 // TODO(Nico): Allow blacklisting more event types in UI
-                if (!isHiddenEvent(txn, e, room_id)) {
+                if (!isHiddenEvent(e, room_id, hiddenTypes)) {
                     ++msgIndex;
                     msgCursor.put(lmdb::to_sv(msgIndex), event_id, MDB_APPEND);
 
                     msg2orderDb.put(txn, event_id, lmdb::to_sv(msgIndex));
+                    visibleDb.put(txn, lmdb::to_sv(index), event_id);
                 }
             } else {
-                nhlog::db()->warn("duplicate event '{}'", orderEntry.dump());
+                nhlog::db()->warn("duplicate event '{}'", event_id);
             }
             eventsDb.put(txn, event_id, event.dump());
 
@@ -3598,13 +4798,15 @@ Cache::saveOldMessages(const std::string &room_id, const mtx::responses::Message
 
     auto orderDb     = getEventOrderDb(txn, room_id);
     auto evToOrderDb = getEventToOrderDb(txn, room_id);
+    auto tokensDb    = getBatchTokensDb(txn, room_id);
     auto msg2orderDb = getMessageToOrderDb(txn, room_id);
     auto order2msgDb = getOrderToMessageDb(txn, room_id);
+    auto visibleDb   = getVisibleOrderDb(txn, room_id);
 
     std::string_view indexVal, val;
     uint64_t index = std::numeric_limits<uint64_t>::max() / 2;
     {
-        auto cursor = lmdb::cursor::open(txn, orderDb);
+        auto cursor = RoomCursor::open(txn, orderDb);
         if (cursor.get(indexVal, val, MDB_FIRST)) {
             index = lmdb::from_sv<uint64_t>(indexVal);
         }
@@ -3612,7 +4814,7 @@ Cache::saveOldMessages(const std::string &room_id, const mtx::responses::Message
 
     uint64_t msgIndex = std::numeric_limits<uint64_t>::max() / 2;
     {
-        auto msgCursor = lmdb::cursor::open(txn, order2msgDb);
+        auto msgCursor = RoomCursor::open(txn, order2msgDb);
         if (msgCursor.get(indexVal, val, MDB_FIRST)) {
             msgIndex = lmdb::from_sv<uint64_t>(indexVal);
         }
@@ -3620,21 +4822,19 @@ Cache::saveOldMessages(const std::string &room_id, const mtx::responses::Message
 
     if (res.chunk.empty()) {
         if (orderDb.get(txn, lmdb::to_sv(index), val)) {
-            auto orderEntry          = nlohmann::json::parse(val);
-            orderEntry["prev_batch"] = res.end;
-            orderDb.put(txn, lmdb::to_sv(index), orderEntry.dump());
+            tokensDb.put(txn, lmdb::to_sv(index), res.end);
             txn.commit();
         }
         return index;
     }
 
-    std::string event_id_val;
+    auto hiddenTypes = hiddenEventTypes(txn, room_id);
     for (const auto &e : res.chunk) {
         if (std::holds_alternative<mtx::events::RedactionEvent<mtx::events::msg::Redaction>>(e))
             continue;
 
         auto event                = mtx::accessors::serialize_event(e);
-        event_id_val              = event["event_id"].get<std::string>();
+        auto event_id_val         = event["event_id"].get<std::string>();
         std::string_view event_id = event_id_val;
 
         // This check protects against duplicates in the timeline. If the event_id is
@@ -3644,18 +4844,16 @@ Cache::saveOldMessages(const std::string &room_id, const mtx::responses::Message
         if (!evToOrderDb.get(txn, event_id, unused_read)) {
             --index;
 
-            nlohmann::json orderEntry = nlohmann::json::object();
-            orderEntry["event_id"]    = event_id_val;
-
-            orderDb.put(txn, lmdb::to_sv(index), orderEntry.dump());
+            orderDb.put(txn, lmdb::to_sv(index), event_id);
             evToOrderDb.put(txn, event_id, lmdb::to_sv(index));
 
             // TODO(Nico): Allow blacklisting more event types in UI
-            if (!isHiddenEvent(txn, e, room_id)) {
+            if (!isHiddenEvent(e, room_id, hiddenTypes)) {
                 --msgIndex;
                 order2msgDb.put(txn, lmdb::to_sv(msgIndex), event_id);
 
                 msg2orderDb.put(txn, event_id, lmdb::to_sv(msgIndex));
+                visibleDb.put(txn, lmdb::to_sv(index), event_id);
             }
         }
         eventsDb.put(txn, event_id, event.dump());
@@ -3670,12 +4868,13 @@ Cache::saveOldMessages(const std::string &room_id, const mtx::responses::Message
         }
     }
 
-    nlohmann::json orderEntry = nlohmann::json::object();
-    orderEntry["event_id"]    = event_id_val;
-    orderEntry["prev_batch"]  = res.end;
-    orderDb.put(txn, lmdb::to_sv(index), orderEntry.dump());
+    tokensDb.put(txn, lmdb::to_sv(index), res.end);
 
-    txn.commit();
+    {
+        static auto &commitMs = metrics::histogram("db.history_commit_ms");
+        metrics::Timer commitTimer(commitMs);
+        txn.commit();
+    }
 
     return msgIndex;
 }
@@ -3689,51 +4888,45 @@ Cache::clearTimeline(const std::string &room_id)
 
     auto orderDb     = getEventOrderDb(txn, room_id);
     auto evToOrderDb = getEventToOrderDb(txn, room_id);
+    auto tokensDb    = getBatchTokensDb(txn, room_id);
     auto msg2orderDb = getMessageToOrderDb(txn, room_id);
     auto order2msgDb = getOrderToMessageDb(txn, room_id);
+    auto visibleDb   = getVisibleOrderDb(txn, room_id);
 
     std::string_view indexVal, val;
-    auto cursor = lmdb::cursor::open(txn, orderDb);
+    auto cursor = RoomCursor::open(txn, orderDb);
 
     bool start                   = true;
     bool passed_pagination_token = false;
     while (cursor.get(indexVal, val, start ? MDB_LAST : MDB_PREV)) {
         start = false;
-        nlohmann::json obj;
-
-        try {
-            obj = nlohmann::json::parse(std::string_view(val.data(), val.size()));
-        } catch (std::exception &) {
-            // workaround bug in the initial db format, where we sometimes didn't store
-            // json...
-            obj = {{"event_id", std::string(val.data(), val.size())}};
-        }
 
         if (passed_pagination_token) {
-            if (obj.count("event_id") != 0) {
-                std::string event_id = obj["event_id"].get<std::string>();
-
-                if (!event_id.empty()) {
-                    evToOrderDb.del(txn, event_id);
-                    eventsDb.del(txn, event_id);
-                    relationsDb.del(txn, event_id);
-
-                    std::string_view order{};
-                    bool exists = msg2orderDb.get(txn, event_id, order);
-                    if (exists) {
-                        order2msgDb.del(txn, order);
-                        msg2orderDb.del(txn, event_id);
-                    }
+            std::string event_id(val.data(), val.size());
+
+            if (!event_id.empty()) {
+                evToOrderDb.del(txn, event_id);
+                eventsDb.del(txn, event_id);
+                relationsDb.del(txn, event_id);
+
+                std::string_view order{};
+                bool exists = msg2orderDb.get(txn, event_id, order);
+                if (exists) {
+                    order2msgDb.del(txn, order);
+                    msg2orderDb.del(txn, event_id);
                 }
             }
-            lmdb::cursor_del(cursor);
+            tokensDb.del(txn, indexVal);
+            visibleDb.del(txn, indexVal);
+            cursor.del();
         } else {
-            if (obj.count("prev_batch") != 0)
+            std::string_view ignored;
+            if (tokensDb.get(txn, indexVal, ignored))
                 passed_pagination_token = true;
         }
     }
 
-    auto msgCursor = lmdb::cursor::open(txn, order2msgDb);
+    auto msgCursor = RoomCursor::open(txn, order2msgDb);
     start          = true;
     while (msgCursor.get(indexVal, val, start ? MDB_LAST : MDB_PREV)) {
         start = false;
@@ -3744,14 +4937,7 @@ Cache::clearTimeline(const std::string &room_id)
         while (cursor.get(indexVal, eventId, innerStart ? MDB_LAST : MDB_PREV)) {
             innerStart = false;
 
-            nlohmann::json obj;
-            try {
-                obj = nlohmann::json::parse(std::string_view(eventId.data(), eventId.size()));
-            } catch (std::exception &) {
-                obj = {{"event_id", std::string(eventId.data(), eventId.size())}};
-            }
-
-            if (obj["event_id"] == std::string(val.data(), val.size())) {
+            if (eventId == val) {
                 found = true;
                 break;
             }
@@ -3763,7 +4949,7 @@ Cache::clearTimeline(const std::string &room_id)
 
     if (!start) {
         do {
-            lmdb::cursor_del(msgCursor);
+            msgCursor.del();
         } while (msgCursor.get(indexVal, val, MDB_PREV));
     }
 
@@ -3828,11 +5014,13 @@ Cache::deleteOldMessages()
     for (const auto &room_id : room_ids) {
         auto orderDb     = getEventOrderDb(txn, room_id);
         auto evToOrderDb = getEventToOrderDb(txn, room_id);
+        auto tokensDb    = getBatchTokensDb(txn, room_id);
+        auto visibleDb   = getVisibleOrderDb(txn, room_id);
         auto o2m         = getOrderToMessageDb(txn, room_id);
         auto m2o         = getMessageToOrderDb(txn, room_id);
         auto eventsDb    = getEventsDb(txn, room_id);
         auto relationsDb = getRelationsDb(txn, room_id);
-        auto cursor      = lmdb::cursor::open(txn, orderDb);
+        auto cursor      = RoomCursor::open(txn, orderDb);
 
         uint64_t first, last;
         if (cursor.get(indexVal, val, MDB_LAST)) {
@@ -3853,11 +5041,10 @@ Cache::deleteOldMessages()
         bool start = true;
         while (cursor.get(indexVal, val, start ? MDB_FIRST : MDB_NEXT) &&
                message_count-- > MAX_RESTORED_MESSAGES) {
-            start    = false;
-            auto obj = nlohmann::json::parse(std::string_view(val.data(), val.size()));
+            start = false;
 
-            if (obj.count("event_id") != 0) {
-                std::string event_id = obj["event_id"].get<std::string>();
+            std::string event_id(val.data(), val.size());
+            if (!event_id.empty()) {
                 evToOrderDb.del(txn, event_id);
                 eventsDb.del(txn, event_id);
 
@@ -3870,6 +5057,8 @@ Cache::deleteOldMessages()
                     m2o.del(txn, event_id);
                 }
             }
+            tokensDb.del(txn, indexVal);
+            visibleDb.del(txn, indexVal);
             cursor.del();
         }
         cursor.close();
@@ -3885,6 +5074,25 @@ Cache::deleteOldData() noexcept
     } catch (const lmdb::error &e) {
         nhlog::db()->error("failed to delete old messages: {}", e.what());
     }
+
+    checkReaders();
+}
+
+void
+Cache::checkReaders() noexcept
+{
+    int dead = 0;
+    if (mdb_reader_check(env_.handle(), &dead) == MDB_SUCCESS && dead > 0)
+        nhlog::db()->warn("cleared {} stale readers", dead);
+
+    MDB_envinfo info{};
+    if (mdb_env_info(env_.handle(), &info) != MDB_SUCCESS)
+        return;
+
+    if (info.me_numreaders * 4 > info.me_maxreaders * 3)
+        nhlog::db()->warn("{} of {} reader slots in use", info.me_numreaders, info.me_maxreaders);
+    else
+        nhlog::db()->debug("{} of {} reader slots in use", info.me_numreaders, info.me_maxreaders);
 }
 
 void
@@ -3937,9 +5145,9 @@ Cache::updateSpaces(lmdb::txn &txn,
                 event.state_key.at(0) == '!') {
                 const std::string &space = event.state_key;
 
-                auto pls = getStateEvent<mtx::events::state::PowerLevels>(txn, space);
+                auto pls = powerLevels_(txn, space);
 
-                if (!pls)
+                if (!pls->exists)
                     continue;
 
                 if (pls->content.user_level(event.sender) >=
@@ -3957,6 +5165,80 @@ Cache::updateSpaces(lmdb::txn &txn,
             }
         }
     }
+
+    rooms_with_updates.insert(spaces_with_updates.begin(), spaces_with_updates.end());
+    updateSpaceClosure(txn, rooms_with_updates);
+}
+
+void
+Cache::updateSpaceClosure(lmdb::txn &txn, const std::set<std::string> &rooms)
+{
+    // A room can only gain or lose ancestors or descendants, if it is or was related to one of the
+    // changed rooms. The old relations are still in the closure tables.
+    std::set<std::string> affected;
+    for (const auto &room : rooms) {
+        affected.insert(room);
+        for (auto db : {&spacesAncestorsDb_, &spacesDescendantsDb_})
+            for (auto &r : getSpaceRelatives(txn, *db, room))
+                affected.insert(std::move(r));
+        for (auto db : {&spacesParentsDb_, &spacesChildrenDb_})
+            affected.merge(walkSpaceEdges(txn, *db, room));
+    }
+
+    for (const auto &room : affected) {
+        spacesAncestorsDb_.del(txn, room);
+        spacesDescendantsDb_.del(txn, room);
+    }
+
+    for (const auto &room : affected) {
+        for (const auto &space : walkSpaceEdges(txn, spacesParentsDb_, room)) {
+            spacesAncestorsDb_.put(txn, room, space);
+            spacesDescendantsDb_.put(txn, space, room);
+        }
+        for (const auto &child : walkSpaceEdges(txn, spacesChildrenDb_, room)) {
+            spacesDescendantsDb_.put(txn, room, child);
+            spacesAncestorsDb_.put(txn, child, room);
+        }
+    }
+}
+
+std::vector<std::string>
+Cache::getSpaceRelatives(lmdb::txn &txn, lmdb::dbi &db, const std::string &room_id)
+{
+    std::vector<std::string> roomids;
+
+    auto cursor         = lmdb::cursor::open(txn, db);
+    bool first          = true;
+    std::string_view sp = room_id, relative;
+    if (cursor.get(sp, relative, MDB_SET)) {
+        while (cursor.get(sp, relative, first ? MDB_FIRST_DUP : MDB_NEXT_DUP)) {
+            first = false;
+
+            if (!relative.empty())
+                roomids.emplace_back(relative);
+        }
+    }
+    cursor.close();
+
+    return roomids;
+}
+
+std::set<std::string>
+Cache::walkSpaceEdges(lmdb::txn &txn, lmdb::dbi &edges, const std::string &room_id)
+{
+    std::set<std::string> seen{room_id};
+    std::vector<std::string> todo{room_id};
+    while (!todo.empty()) {
+        auto current = std::move(todo.back());
+        todo.pop_back();
+
+        for (auto &next : getSpaceRelatives(txn, edges, current))
+            if (seen.insert(next).second)
+                todo.push_back(std::move(next));
+    }
+
+    seen.erase(room_id);
+    return seen;
 }
 
 QMap<QString, std::optional<RoomInfo>>
@@ -3993,48 +5275,41 @@ std::vector<std::string>
 Cache::getParentRoomIds(const std::string &room_id)
 {
     auto txn = ro_txn(env_);
+    return getSpaceRelatives(txn, spacesParentsDb_, room_id);
+}
 
-    std::vector<std::string> roomids;
-    {
-        auto cursor         = lmdb::cursor::open(txn, spacesParentsDb_);
-        bool first          = true;
-        std::string_view sp = room_id, space_parent;
-        if (cursor.get(sp, space_parent, MDB_SET)) {
-            while (cursor.get(sp, space_parent, first ? MDB_FIRST_DUP : MDB_NEXT_DUP)) {
-                first = false;
-
-                if (!space_parent.empty())
-                    roomids.emplace_back(space_parent);
-            }
-        }
-        cursor.close();
-    }
+std::vector<std::string>
+Cache::getChildRoomIds(const std::string &room_id)
+{
+    auto txn = ro_txn(env_);
+    return getSpaceRelatives(txn, spacesChildrenDb_, room_id);
+}
 
-    return roomids;
+std::vector<std::string>
+Cache::getAncestorRoomIds(const std::string &room_id)
+{
+    auto txn = ro_txn(env_);
+    return getSpaceRelatives(txn, spacesAncestorsDb_, room_id);
 }
 
 std::vector<std::string>
-Cache::getChildRoomIds(const std::string &room_id)
+Cache::getDescendantRoomIds(const std::string &space_id)
 {
     auto txn = ro_txn(env_);
+    return getSpaceRelatives(txn, spacesDescendantsDb_, space_id);
+}
 
-    std::vector<std::string> roomids;
-    {
-        auto cursor         = lmdb::cursor::open(txn, spacesChildrenDb_);
-        bool first          = true;
-        std::string_view sp = room_id, space_child;
-        if (cursor.get(sp, space_child, MDB_SET)) {
-            while (cursor.get(sp, space_child, first ? MDB_FIRST_DUP : MDB_NEXT_DUP)) {
-                first = false;
+bool
+Cache::isInSpace(const std::string &room_id, const std::string &space_id)
+{
+    auto txn = ro_txn(env_);
 
-                if (!space_child.empty())
-                    roomids.emplace_back(space_child);
-            }
-        }
-        cursor.close();
-    }
+    auto cursor            = lmdb::cursor::open(txn, spacesDescendantsDb_);
+    std::string_view space = space_id, room = room_id;
+    bool found             = cursor.get(space, room, MDB_GET_BOTH);
+    cursor.close();
 
-    return roomids;
+    return found;
 }
 
 std::vector<ImagePackInfo>
@@ -4165,39 +5440,15 @@ Cache::hasEnoughPowerLevel(const std::vector<mtx::events::EventType> &eventTypes
                            const std::string &room_id,
                            const std::string &user_id)
 {
-    using namespace mtx::events;
-    using namespace mtx::events::state;
-
-    auto txn = ro_txn(env_);
-    try {
-        auto db = getStatesDb(txn, room_id);
-
-        int64_t min_event_level = std::numeric_limits<int64_t>::max();
-        int64_t user_level      = std::numeric_limits<int64_t>::min();
-
-        std::string_view event;
-        bool res = db.get(txn, to_string(EventType::RoomPowerLevels), event);
-
-        if (res) {
-            try {
-                StateEvent<PowerLevels> msg =
-                  nlohmann::json::parse(std::string_view(event.data(), event.size()))
-                    .get<StateEvent<PowerLevels>>();
-
-                user_level = msg.content.user_level(user_id);
+    auto pl = powerLevels(room_id);
+    if (!pl->exists)
+        return false;
 
-                for (const auto &ty : eventTypes)
-                    min_event_level =
-                      std::min(min_event_level, msg.content.state_level(to_string(ty)));
-            } catch (const nlohmann::json::exception &e) {
-                nhlog::db()->warn("failed to parse m.room.power_levels event: {}", e.what());
-            }
-        }
+    int64_t min_event_level = std::numeric_limits<int64_t>::max();
+    for (const auto &ty : eventTypes)
+        min_event_level = std::min(min_event_level, pl->content.state_level(to_string(ty)));
 
-        return user_level >= min_event_level;
-    } catch (...) {
-        return false;
-    }
+    return pl->content.user_level(user_id) >= min_event_level;
 }
 
 std::vector<std::string>
@@ -4211,7 +5462,7 @@ Cache::roomMembers(const std::string &room_id)
 
         auto db = getMembersDb(txn, room_id);
 
-        auto cursor = lmdb::cursor::open(txn, db);
+        auto cursor = RoomCursor::open(txn, db);
         while (cursor.get(user_id, unused, MDB_NEXT))
             members.emplace_back(user_id);
         cursor.close();
@@ -4235,10 +5486,33 @@ Cache::roomVerificationStatus(const std::string &room_id)
         auto keysDb = getUserKeysDb(txn);
         std::vector<std::string> keysToRequest;
 
-        std::string_view user_id, unused;
-        auto cursor = lmdb::cursor::open(txn, db);
-        while (cursor.get(user_id, unused, MDB_NEXT)) {
-            auto verif = verificationStatus_(std::string(user_id), txn);
+        // verify the members in parallel, which only has to be done once for their keys
+        std::vector<std::string> members;
+        {
+            std::string_view user_id, unused;
+            auto cursor = RoomCursor::open(txn, db);
+            while (cursor.get(user_id, unused, MDB_NEXT))
+                members.emplace_back(user_id);
+            cursor.close();
+        }
+
+        // only wait for this room, other rooms may have queued their members as well
+        std::vector<QFuture<void>> pending;
+        for (const auto &user_id : members) {
+            {
+                std::unique_lock<std::mutex> lock(verification_storage.verification_storage_mtx);
+                if (verification_storage.status.count(user_id))
+                    continue;
+            }
+
+            pending.push_back(QtConcurrent::run(
+              &verificationPool_, [this, user_id] { (void)verificationStatus(user_id); }));
+        }
+        for (auto &f : pending)
+            f.waitForFinished();
+
+        for (const auto &user_id : members) {
+            auto verif = verificationStatus_(user_id, txn);
             if (verif.unverified_device_count) {
                 trust = crypto::Unverified;
                 if (verif.verified_devices.empty() && verif.no_keys) {
@@ -4280,7 +5554,7 @@ Cache::getMembersWithKeys(const std::string &room_id, bool verified_only)
         auto keysDb = getUserKeysDb(txn);
 
         std::string_view user_id, unused;
-        auto cursor = lmdb::cursor::open(txn, db);
+        auto cursor = RoomCursor::open(txn, db);
         while (cursor.get(user_id, unused, MDB_NEXT)) {
             auto res = keysDb.get(txn, user_id, keys);
 
@@ -4339,32 +5613,24 @@ Cache::displayName(const QString &room_id, const QString &user_id)
     return QString::fromStdString(displayName(room_id.toStdString(), user_id.toStdString()));
 }
 
-static bool
-isDisplaynameSafe(const std::string &s)
-{
-    for (QChar c : QString::fromStdString(s).toStdU32String()) {
-        if (c.isPrint() && !c.isSpace())
-            return false;
-    }
-
-    return true;
-}
-
 std::string
 Cache::displayName(const std::string &room_id, const std::string &user_id)
 {
-    if (auto info = getMember(room_id, user_id); info && !isDisplaynameSafe(info->name))
-        return info->name;
+    if (user_id.empty() || !env_.handle())
+        return user_id;
 
-    return user_id;
+    return cachedMember(room_id, user_id).display_name;
 }
 
 QString
 Cache::avatarUrl(const QString &room_id, const QString &user_id)
 {
-    if (auto info = getMember(room_id.toStdString(), user_id.toStdString());
-        info && !info->avatar_url.empty())
-        return QString::fromStdString(info->avatar_url);
+    if (user_id.isEmpty() || !env_.handle())
+        return QString();
+
+    if (auto member = cachedMember(room_id.toStdString(), user_id.toStdString());
+        member.info && !member.info->avatar_url.empty())
+        return QString::fromStdString(member.info->avatar_url);
 
     return QString();
 }
@@ -4391,6 +5657,33 @@ Cache::presence(const std::string &user_id)
     return presence_;
 }
 
+std::map<std::string, mtx::events::presence::Presence>
+Cache::presences()
+{
+    std::map<std::string, mtx::events::presence::Presence> result;
+
+    try {
+        auto txn    = ro_txn(env_);
+        auto cursor = lmdb::cursor::open(txn, presenceDb_);
+
+        std::string_view user_id, presenceVal;
+        while (cursor.get(user_id, presenceVal, MDB_NEXT)) {
+            try {
+                result.emplace(user_id,
+                               nlohmann::json::parse(presenceVal)
+                                 .get<mtx::events::presence::Presence>());
+            } catch (const nlohmann::json::exception &e) {
+                nhlog::db()->warn("failed to parse presence of {}: {}", user_id, e.what());
+            }
+        }
+        cursor.close();
+    } catch (const lmdb::error &e) {
+        nhlog::db()->warn("failed to read presences: {}", e.what());
+    }
+
+    return result;
+}
+
 void
 to_json(nlohmann::json &j, const UserKeyCache &info)
 {
@@ -4575,32 +5868,12 @@ Cache::updateUserKeys(const std::string &sync_token, const mtx::responses::Query
 
     txn.commit();
 
-    std::map<std::string, VerificationStatus> tmp;
-    const auto local_user = utils::localUser().toStdString();
-
-    {
-        std::unique_lock<std::mutex> lock(verification_storage.verification_storage_mtx);
-        for (auto &[user_id, update] : updates) {
-            (void)update;
-            if (user_id == local_user) {
-                std::swap(tmp, verification_storage.status);
-            } else {
-                verification_storage.status.erase(user_id);
-            }
-        }
-    }
-
-    for (auto &[user_id, update] : updates) {
+    std::vector<std::string> updatedUsers;
+    for (const auto &[user_id, update] : updates) {
         (void)update;
-        if (user_id == local_user) {
-            for (const auto &[user, status] : tmp) {
-                (void)status;
-                emit verificationStatusChanged(user);
-            }
-        } else {
-            emit verificationStatusChanged(user_id);
-        }
+        updatedUsers.push_back(user_id);
     }
+    invalidateVerificationStatus(updatedUsers);
 }
 
 void
@@ -4749,6 +6022,27 @@ from_json(const nlohmann::json &j, VerificationCache &info)
     info.device_blocked  = j.at("device_blocked").get<std::set<std::string>>();
 }
 
+void
+to_json(nlohmann::json &j, const VerificationStatus &status)
+{
+    j["user_verified"]           = status.user_verified;
+    j["verified_devices"]        = status.verified_devices;
+    j["verified_device_keys"]    = status.verified_device_keys;
+    j["unverified_device_count"] = status.unverified_device_count;
+    j["no_keys"]                 = status.no_keys;
+}
+
+void
+from_json(const nlohmann::json &j, VerificationStatus &status)
+{
+    status.user_verified    = j.at("user_verified").get<crypto::Trust>();
+    status.verified_devices = j.at("verified_devices").get<std::set<std::string>>();
+    status.verified_device_keys =
+      j.at("verified_device_keys").get<std::map<std::string, crypto::Trust>>();
+    status.unverified_device_count = j.at("unverified_device_count").get<int>();
+    status.no_keys                 = j.at("no_keys").get<bool>();
+}
+
 void
 to_json(nlohmann::json &j, const OnlineBackupVersion &info)
 {
@@ -4811,25 +6105,7 @@ Cache::markDeviceVerified(const std::string &user_id, const std::string &key)
         }
     }
 
-    const auto local_user = utils::localUser().toStdString();
-    std::map<std::string, VerificationStatus> tmp;
-    {
-        std::unique_lock<std::mutex> lock(verification_storage.verification_storage_mtx);
-        if (user_id == local_user) {
-            std::swap(tmp, verification_storage.status);
-            verification_storage.status.clear();
-        } else {
-            verification_storage.status.erase(user_id);
-        }
-    }
-    if (user_id == local_user) {
-        for (const auto &[user, status] : tmp) {
-            (void)status;
-            emit verificationStatusChanged(user);
-        }
-    } else {
-        emit verificationStatusChanged(user_id);
-    }
+    invalidateVerificationStatus({user_id});
 }
 
 void
@@ -4854,52 +6130,52 @@ Cache::markDeviceUnverified(const std::string &user_id, const std::string &key)
     } catch (std::exception &) {
     }
 
-    const auto local_user = utils::localUser().toStdString();
-    std::map<std::string, VerificationStatus> tmp;
-    {
-        std::unique_lock<std::mutex> lock(verification_storage.verification_storage_mtx);
-        if (user_id == local_user) {
-            std::swap(tmp, verification_storage.status);
-        } else {
-            verification_storage.status.erase(user_id);
-        }
-    }
-    if (user_id == local_user) {
-        for (const auto &[user, status] : tmp) {
-            (void)status;
-            emit verificationStatusChanged(user);
-        }
-    }
-    emit verificationStatusChanged(user_id);
+    invalidateVerificationStatus({user_id});
 }
 
-VerificationStatus
-Cache::verificationStatus(const std::string &user_id)
-{
-    auto txn = ro_txn(env_);
-    return verificationStatus_(user_id, txn);
-}
-
-VerificationStatus
-Cache::verificationStatus_(const std::string &user_id, lmdb::txn &txn)
-{
-    std::unique_lock<std::mutex> lock(verification_storage.verification_storage_mtx);
-    if (verification_storage.status.count(user_id))
-        return verification_storage.status.at(user_id);
-
-    VerificationStatus status;
-
-    // assume there is at least one unverified device until we have checked we have the device
-    // list for that user.
-    status.unverified_device_count = 1;
-    status.no_keys                 = true;
+namespace {
+//! A hash of the keys and verified devices, from which the verification status of the user is
+//! calculated. For other users only the parts of our keys are used, that sign their keys.
+std::string
+verificationInputs(const std::string &user_id,
+                   const std::string &local_user,
+                   const std::optional<VerificationCache> &verifCache,
+                   const std::optional<UserKeyCache> &ourKeys,
+                   const std::optional<UserKeyCache> &theirKeys)
+{
+    nlohmann::json inputs = {
+      {"version", 1},
+      {"device_id", http::client()->device_id()},
+      {"identity", olm::client()->identity_keys().ed25519},
+      {"verified", verifCache ? verifCache->device_verified : std::set<std::string>()},
+    };
 
-    if (auto verifCache = verificationCache(user_id, txn)) {
-        status.verified_devices = verifCache->device_verified;
+    if (ourKeys) {
+        inputs["our_master"] = ourKeys->master_keys;
+        if (user_id != local_user)
+            inputs["our_user_signing"] = ourKeys->user_signing_keys;
+    }
+    if (theirKeys) {
+        inputs["master"]         = theirKeys->master_keys;
+        inputs["master_changed"] = theirKeys->master_key_changed;
+        inputs["self_signing"]   = theirKeys->self_signing_keys;
+        inputs["devices"]        = theirKeys->device_keys;
     }
 
-    const auto local_user = utils::localUser().toStdString();
+    return QCryptographicHash::hash(QByteArray::fromStdString(inputs.dump()),
+                                    QCryptographicHash::Sha256)
+      .toBase64()
+      .toStdString();
+}
 
+//! Verify the signature chains from our device to the devices of the user.
+void
+computeVerificationStatus(const std::string &user_id,
+                          const std::string &local_user,
+                          const std::optional<UserKeyCache> &ourKeys,
+                          const std::optional<UserKeyCache> &theirKeys,
+                          VerificationStatus &status)
+{
     crypto::Trust trustlevel = crypto::Trust::Unverified;
     if (user_id == local_user) {
         status.verified_devices.insert(http::client()->device_id());
@@ -4933,81 +6209,192 @@ Cache::verificationStatus_(const std::string &user_id, lmdb::txn &txn)
           static_cast<int>(theirDeviceKeys.size()) - currentVerifiedDevices;
     };
 
-    try {
-        // for local user verify this device_key -> our master_key -> our self_signing_key
-        // -> our device_keys
-        //
-        // for other user verify this device_key -> our master_key -> our user_signing_key
-        // -> their master_key -> their self_signing_key -> their device_keys
-        //
-        // This means verifying the other user adds 2 extra steps,verifying our user_signing
-        // key and their master key
-        auto ourKeys   = userKeys_(local_user, txn);
-        auto theirKeys = userKeys_(user_id, txn);
-        if (theirKeys)
-            status.no_keys = false;
-
-        if (!ourKeys || !theirKeys) {
-            verification_storage.status[user_id] = status;
-            return status;
+    // for local user verify this device_key -> our master_key -> our self_signing_key
+    // -> our device_keys
+    //
+    // for other user verify this device_key -> our master_key -> our user_signing_key
+    // -> their master_key -> their self_signing_key -> their device_keys
+    //
+    // This means verifying the other user adds 2 extra steps,verifying our user_signing
+    // key and their master key
+    if (theirKeys)
+        status.no_keys = false;
+
+    if (!ourKeys || !theirKeys)
+        return;
+
+    // Update verified devices count to count without cross-signing
+    updateUnverifiedDevices(theirKeys->device_keys);
+
+    {
+        auto &mk           = ourKeys->master_keys;
+        std::string dev_id = "ed25519:" + http::client()->device_id();
+        if (!mk.signatures.count(local_user) || !mk.signatures.at(local_user).count(dev_id) ||
+            !mtx::crypto::ed25519_verify_signature(olm::client()->identity_keys().ed25519,
+                                                   nlohmann::json(mk),
+                                                   mk.signatures.at(local_user).at(dev_id))) {
+            nhlog::crypto()->debug("We have not verified our own master key");
+            return;
         }
+    }
 
-        // Update verified devices count to count without cross-signing
-        updateUnverifiedDevices(theirKeys->device_keys);
+    auto master_keys = ourKeys->master_keys.keys;
 
-        {
-            auto &mk           = ourKeys->master_keys;
-            std::string dev_id = "ed25519:" + http::client()->device_id();
-            if (!mk.signatures.count(local_user) || !mk.signatures.at(local_user).count(dev_id) ||
-                !mtx::crypto::ed25519_verify_signature(olm::client()->identity_keys().ed25519,
-                                                       nlohmann::json(mk),
-                                                       mk.signatures.at(local_user).at(dev_id))) {
-                nhlog::crypto()->debug("We have not verified our own master key");
-                verification_storage.status[user_id] = status;
-                return status;
+    if (user_id != local_user) {
+        bool theirMasterKeyVerified =
+          verifyAtLeastOneSig(ourKeys->user_signing_keys, master_keys, local_user) &&
+          verifyAtLeastOneSig(theirKeys->master_keys, ourKeys->user_signing_keys.keys, local_user);
+
+        if (theirMasterKeyVerified)
+            trustlevel = crypto::Trust::Verified;
+        else if (!theirKeys->master_key_changed)
+            trustlevel = crypto::Trust::TOFU;
+        else
+            return;
+
+        master_keys = theirKeys->master_keys.keys;
+    }
+
+    status.user_verified = trustlevel;
+
+    if (!verifyAtLeastOneSig(theirKeys->self_signing_keys, master_keys, user_id))
+        return;
+
+    for (const auto &[device, device_key] : theirKeys->device_keys) {
+        (void)device;
+        try {
+            auto identkey = device_key.keys.at("curve25519:" + device_key.device_id);
+            if (verifyAtLeastOneSig(device_key, theirKeys->self_signing_keys.keys, user_id)) {
+                status.verified_devices.insert(device_key.device_id);
+                status.verified_device_keys[identkey] = trustlevel;
             }
+        } catch (...) {
         }
+    }
 
-        auto master_keys = ourKeys->master_keys.keys;
-
-        if (user_id != local_user) {
-            bool theirMasterKeyVerified =
-              verifyAtLeastOneSig(ourKeys->user_signing_keys, master_keys, local_user) &&
-              verifyAtLeastOneSig(
-                theirKeys->master_keys, ourKeys->user_signing_keys.keys, local_user);
-
-            if (theirMasterKeyVerified)
-                trustlevel = crypto::Trust::Verified;
-            else if (!theirKeys->master_key_changed)
-                trustlevel = crypto::Trust::TOFU;
-            else {
-                verification_storage.status[user_id] = status;
-                return status;
-            }
+    updateUnverifiedDevices(theirKeys->device_keys);
+}
+}
+
+VerificationStatus
+Cache::verificationStatus(const std::string &user_id)
+{
+    auto txn = ro_txn(env_);
+    return verificationStatus_(user_id, txn);
+}
+
+void
+Cache::updateVerificationStatuses(const std::vector<std::string> &user_ids, bool notify)
+{
+    for (const auto &user_id : user_ids) {
+        if (!notify) {
+            std::unique_lock<std::mutex> lock(verification_storage.verification_storage_mtx);
+            if (verification_storage.status.count(user_id))
+                continue;
+        }
+
+        verificationPool_.start([this, user_id, notify] {
+            verificationStatus(user_id);
+            if (notify)
+                emit verificationStatusChanged(user_id);
+        });
+    }
+}
+
+void
+Cache::invalidateVerificationStatus(const std::vector<std::string> &user_ids)
+{
+    const auto local_user = utils::localUser().toStdString();
 
-            master_keys = theirKeys->master_keys.keys;
+    std::set<std::string> changed(user_ids.begin(), user_ids.end());
+    {
+        std::unique_lock<std::mutex> lock(verification_storage.verification_storage_mtx);
+        verification_storage.generation++;
+        for (const auto &user_id : user_ids) {
+            if (user_id == local_user) {
+                // our keys sign everyone else's, but the stored status is only recalculated if
+                // the relevant keys changed
+                for (const auto &[user, status] : verification_storage.status) {
+                    (void)status;
+                    changed.insert(user);
+                }
+                verification_storage.status.clear();
+                break;
+            }
+            verification_storage.status.erase(user_id);
         }
+    }
+
+    updateVerificationStatuses({changed.begin(), changed.end()}, true);
+}
+
+void
+Cache::saveVerificationStatuses(lmdb::txn &txn)
+{
+    std::map<std::string, std::string> unsaved;
+    {
+        std::unique_lock<std::mutex> lock(verification_storage.verification_storage_mtx);
+        std::swap(unsaved, verification_storage.unsaved);
+    }
+
+    for (const auto &[user_id, record] : unsaved)
+        verificationStatusDb_.put(txn, user_id, record);
+}
 
-        status.user_verified = trustlevel;
+VerificationStatus
+Cache::verificationStatus_(const std::string &user_id, lmdb::txn &txn)
+{
+    uint64_t generation = 0;
+    {
+        std::unique_lock<std::mutex> lock(verification_storage.verification_storage_mtx);
+        if (auto it = verification_storage.status.find(user_id);
+            it != verification_storage.status.end())
+            return it->second;
+        generation = verification_storage.generation;
+    }
 
-        verification_storage.status[user_id] = status;
-        if (!verifyAtLeastOneSig(theirKeys->self_signing_keys, master_keys, user_id))
-            return status;
+    VerificationStatus status;
 
-        for (const auto &[device, device_key] : theirKeys->device_keys) {
-            (void)device;
+    // assume there is at least one unverified device until we have checked we have the device
+    // list for that user.
+    status.unverified_device_count = 1;
+    status.no_keys                 = true;
+
+    const auto local_user = utils::localUser().toStdString();
+
+    try {
+        auto verifCache = verificationCache(user_id, txn);
+        auto ourKeys    = userKeys_(local_user, txn);
+        auto theirKeys  = user_id == local_user ? ourKeys : userKeys_(user_id, txn);
+        auto inputs     = verificationInputs(user_id, local_user, verifCache, ourKeys, theirKeys);
+
+        bool stored = false;
+        std::string_view data;
+        if (verificationStatusDb_.get(txn, user_id, data)) {
             try {
-                auto identkey = device_key.keys.at("curve25519:" + device_key.device_id);
-                if (verifyAtLeastOneSig(device_key, theirKeys->self_signing_keys.keys, user_id)) {
-                    status.verified_devices.insert(device_key.device_id);
-                    status.verified_device_keys[identkey] = trustlevel;
+                auto record = nlohmann::json::parse(data);
+                if (record.at("inputs").get<std::string>() == inputs) {
+                    status = record.at("status").get<VerificationStatus>();
+                    stored = true;
                 }
-            } catch (...) {
+            } catch (const nlohmann::json::exception &e) {
+                nhlog::db()->warn("Invalid verification status of {}: {}", user_id, e.what());
             }
         }
 
-        updateUnverifiedDevices(theirKeys->device_keys);
-        verification_storage.status[user_id] = status;
+        if (!stored) {
+            if (verifCache)
+                status.verified_devices = verifCache->device_verified;
+            computeVerificationStatus(user_id, local_user, ourKeys, theirKeys, status);
+        }
+
+        std::unique_lock<std::mutex> lock(verification_storage.verification_storage_mtx);
+        if (!stored)
+            verification_storage.unsaved[user_id] =
+              nlohmann::json{{"inputs", inputs}, {"status", status}}.dump();
+        // the keys changed while we were verifying them
+        if (generation == verification_storage.generation)
+            verification_storage.status[user_id] = status;
         return status;
     } catch (std::exception &e) {
         nhlog::db()->error("Failed to calculate verification status of {}: {}", user_id, e.what());
@@ -5242,6 +6629,13 @@ presence(const std::string &user_id)
         return {};
     return instance_->presence(user_id);
 }
+std::map<std::string, mtx::events::presence::Presence>
+presences()
+{
+    if (!instance_)
+        return {};
+    return instance_->presences();
+}
 
 // user cache stores user keys
 std::optional<UserKeyCache>
@@ -5291,32 +6685,6 @@ invites()
     return instance_->invites();
 }
 
-QString
-getRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
-{
-    return instance_->getRoomName(txn, statesdb, membersdb);
-}
-mtx::events::state::JoinRule
-getRoomJoinRule(lmdb::txn &txn, lmdb::dbi &statesdb)
-{
-    return instance_->getRoomJoinRule(txn, statesdb);
-}
-bool
-getRoomGuestAccess(lmdb::txn &txn, lmdb::dbi &statesdb)
-{
-    return instance_->getRoomGuestAccess(txn, statesdb);
-}
-QString
-getRoomTopic(lmdb::txn &txn, lmdb::dbi &statesdb)
-{
-    return instance_->getRoomTopic(txn, statesdb);
-}
-QString
-getRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
-{
-    return instance_->getRoomAvatarUrl(txn, statesdb, membersdb);
-}
-
 std::vector<RoomMember>
 getMembers(const std::string &room_id, std::size_t startIndex, std::size_t len)
 {
@@ -5346,6 +6714,12 @@ nextBatchToken()
     return instance_->nextBatchToken();
 }
 
+void
+saveRoomSummaries(const nlohmann::json &joinedRooms)
+{
+    instance_->saveRoomSummaries(joinedRooms);
+}
+
 void
 deleteData()
 {
@@ -5363,11 +6737,6 @@ removeInvite(const std::string &room_id)
     instance_->removeInvite(room_id);
 }
 void
-removeRoom(lmdb::txn &txn, const std::string &roomid)
-{
-    instance_->removeRoom(txn, roomid);
-}
-void
 removeRoom(const std::string &roomid)
 {
     instance_->removeRoom(roomid);
@@ -17,6 +17,7 @@
 #include <mtx/events/presence.hpp>
 #include <mtx/responses/crypto.hpp>
 #include <mtxclient/crypto/types.hpp>
+#include <nlohmann/json.hpp>
 
 #include "CacheCryptoStructs.h"
 #include "CacheStructs.h"
@@ -39,6 +40,9 @@ avatarUrl(const QString &room_id, const QString &user_id);
 // presence
 mtx::events::presence::Presence
 presence(const std::string &user_id);
+//! Presence of all users with a stored presence.
+std::map<std::string, mtx::events::presence::Presence>
+presences();
 
 // user cache stores user keys
 std::optional<UserKeyCache>
@@ -62,21 +66,6 @@ roomInfo(bool withInvites = true);
 QHash<QString, RoomInfo>
 invites();
 
-//! Calculate & return the name of the room.
-QString
-getRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb);
-//! Get room join rules
-mtx::events::state::JoinRule
-getRoomJoinRule(lmdb::txn &txn, lmdb::dbi &statesdb);
-bool
-getRoomGuestAccess(lmdb::txn &txn, lmdb::dbi &statesdb);
-//! Retrieve the topic of the room if any.
-QString
-getRoomTopic(lmdb::txn &txn, lmdb::dbi &statesdb);
-//! Retrieve the room avatar's url if any.
-QString
-getRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb);
-
 //! Retrieve member info from a room.
 std::vector<RoomMember>
 getMembers(const std::string &room_id, std::size_t startIndex = 0, std::size_t len = 30);
@@ -89,6 +78,9 @@ isInitialized();
 
 std::string
 nextBatchToken();
+//! Save the member counts of the summaries in the joined rooms of a sync response.
+void
+saveRoomSummaries(const nlohmann::json &joinedRooms);
 
 void
 deleteData();
@@ -98,8 +90,6 @@ removeInvite(lmdb::txn &txn, const std::string &room_id);
 void
 removeInvite(const std::string &room_id);
 void
-removeRoom(lmdb::txn &txn, const std::string &roomid);
-void
 removeRoom(const std::string &roomid);
 void
 removeRoom(const QString &roomid);
@@ -134,11 +134,20 @@ struct VerificationStatus
     bool no_keys = false;
 };
 
+void
+to_json(nlohmann::json &j, const VerificationStatus &status);
+void
+from_json(const nlohmann::json &j, VerificationStatus &status);
+
 //! In memory cache of verification status
 struct VerificationStorage
 {
     //! mapping of user to verification status
     std::map<std::string, VerificationStatus> status;
+    //! user -> status record not yet written to the database
+    std::map<std::string, std::string> unsaved;
+    //! incremented whenever keys change, so outdated calculations are not cached
+    uint64_t generation = 0;
     std::mutex verification_storage_mtx;
 };
 
@@ -8,10 +8,15 @@
 #include <QImage>
 #include <QString>
 
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <unordered_map>
 
 #include <mtx/events/join_rules.hpp>
 #include <mtx/events/mscs/image_packs.hpp>
+#include <mtx/events/power_levels.hpp>
 
 namespace cache {
 enum class CacheVersion : int
@@ -122,6 +127,45 @@ to_json(nlohmann::json &j, const MemberInfo &info);
 void
 from_json(const nlohmann::json &j, MemberInfo &info);
 
+//! Entry of the in memory member cache.
+struct CachedMember
+{
+    //! Empty, if the user is not a member of the room.
+    std::optional<MemberInfo> info;
+    //! The display name, if it is safe to show, the user id otherwise.
+    std::string display_name;
+};
+
+//! In memory cache of room members
+struct MemberStorage
+{
+    //! room id -> user id -> member
+    std::unordered_map<std::string, std::unordered_map<std::string, CachedMember>> rooms;
+    //! incremented for every change, so a load racing with a change is not cached
+    uint64_t generation = 0;
+    std::mutex mtx;
+};
+
+//! The parsed power levels of a room, shared until a new power levels event is saved.
+struct CachedPowerLevels
+{
+    //! False, if the room has no power levels event.
+    bool exists = false;
+    mtx::events::state::PowerLevels content;
+    //! Changes whenever the power levels of the room change.
+    uint64_t generation = 0;
+};
+
+//! In memory cache of power levels
+struct PowerLevelsStorage
+{
+    //! room id -> power levels
+    std::unordered_map<std::string, std::shared_ptr<const CachedPowerLevels>> rooms;
+    //! incremented for every change, so a load racing with a change is not cached
+    uint64_t generation = 0;
+    std::mutex mtx;
+};
+
 struct RoomSearchResult
 {
     std::string room_id;
@@ -4,11 +4,15 @@
 
 #pragma once
 
+#include <functional>
 #include <limits>
+#include <mutex>
 #include <optional>
+#include <vector>
 
 #include <QDateTime>
 #include <QString>
+#include <QThreadPool>
 
 #if __has_include(<lmdbxx/lmdb++.h>)
 #include <lmdbxx/lmdb++.h>
@@ -30,6 +34,88 @@ namespace mtx::responses {
 struct Messages;
 }
 
+//! Compact number assigned to each room id in the room_ids table.
+using RoomNum = uint32_t;
+
+//! A table shared by all rooms, restricted to the entries of a single room.
+//!
+//! Every key is prefixed with the big endian number of the room, so that the entries of a room
+//! are stored next to each other and can be iterated or dropped without touching other rooms.
+//! Integer keys are stored big endian too, so that they sort numerically, but are passed in and
+//! returned in native byte order like with MDB_INTEGERKEY.
+class RoomDb
+{
+public:
+    enum Flags : unsigned
+    {
+        None       = 0,
+        IntegerKey = 1,
+    };
+
+    RoomDb() = default;
+    RoomDb(MDB_dbi dbi, RoomNum room, unsigned flags = None);
+    //! A table, which keeps the number of entries per room in `countsDb` under `countName`.
+    RoomDb(MDB_dbi dbi, RoomNum room, MDB_dbi countsDb, std::string_view countName);
+
+    bool get(MDB_txn *txn, std::string_view key, std::string_view &val) const;
+    bool put(MDB_txn *txn, std::string_view key, std::string_view val, unsigned flags = 0);
+    bool del(MDB_txn *txn, std::string_view key);
+    bool del(MDB_txn *txn, std::string_view key, std::string_view val);
+    //! Number of entries of this room. Constant time for counted tables.
+    std::size_t size(MDB_txn *txn) const;
+    //! Delete all entries of this room.
+    void drop(MDB_txn *txn);
+
+private:
+    friend class RoomCursor;
+
+    std::string prefixed(std::string_view key) const;
+    bool hasPrefix(const MDB_val &key) const;
+    void addToCount(MDB_txn *txn, int64_t diff);
+
+    MDB_dbi dbi_      = 0;
+    MDB_dbi countsDb_ = 0;
+    std::string_view countName_;
+    char prefix_[sizeof(RoomNum)] = {};
+    unsigned flags_               = None;
+};
+
+//! A cursor over the entries of one room in a RoomDb.
+//!
+//! Positioning outside of the room fails like reaching the end of a separate database would.
+class RoomCursor
+{
+public:
+    static RoomCursor open(MDB_txn *txn, const RoomDb &db);
+
+    bool get(std::string_view &key, std::string_view &val, MDB_cursor_op op);
+    bool get(std::string_view &key, MDB_cursor_op op)
+    {
+        std::string_view val;
+        return get(key, val, op);
+    }
+    //! Appending is not possible in a shared table, MDB_APPEND is ignored.
+    bool put(std::string_view key, std::string_view val, unsigned flags = 0);
+    void del(unsigned flags = 0);
+    void close() { cursor_.close(); }
+
+private:
+    RoomCursor(lmdb::cursor cursor, const RoomDb &db)
+      : cursor_(std::move(cursor))
+      , db_(db)
+    {}
+
+    bool seek(MDB_val &key, MDB_val &val, MDB_cursor_op op);
+    bool step(MDB_val &key, MDB_val &val, MDB_cursor_op op, MDB_cursor_op back);
+    std::string_view unprefixed(const MDB_val &key);
+
+    lmdb::cursor cursor_;
+    RoomDb db_;
+    std::string keyBuf_;
+    uint64_t intKey_ = 0;
+    bool positioned_ = false;
+};
+
 class Cache final : public QObject
 {
     Q_OBJECT
@@ -43,6 +129,7 @@ public:
 
     // presence
     mtx::events::presence::Presence presence(const std::string &user_id);
+    std::map<std::string, mtx::events::presence::Presence> presences();
 
     // user cache stores user keys
     std::map<std::string, std::optional<UserKeyCache>>
@@ -64,6 +151,9 @@ public:
     crypto::Trust roomVerificationStatus(const std::string &room_id);
 
     std::vector<std::string> joinedRooms();
+    //! The joined rooms, in which the user is joined or invited. Joined rooms without all members,
+    //! which have the user in m.direct or as a hero of their summary, are included as well.
+    std::vector<std::string> sharedRooms(const std::string &user_id);
     std::map<std::string, RoomInfo> getCommonRooms(const std::string &user_id);
 
     QMap<QString, RoomInfo> roomInfo(bool withInvites = true);
@@ -72,18 +162,18 @@ public:
     QMap<QString, std::optional<RoomInfo>> spaces();
 
     //! Calculate & return the name of the room.
-    QString getRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb);
+    QString getRoomName(lmdb::txn &txn, RoomDb &statesdb, RoomDb &membersdb);
     //! Get room join rules
-    mtx::events::state::JoinRule getRoomJoinRule(lmdb::txn &txn, lmdb::dbi &statesdb);
-    bool getRoomGuestAccess(lmdb::txn &txn, lmdb::dbi &statesdb);
+    mtx::events::state::JoinRule getRoomJoinRule(lmdb::txn &txn, RoomDb &statesdb);
+    bool getRoomGuestAccess(lmdb::txn &txn, RoomDb &statesdb);
     //! Retrieve the topic of the room if any.
-    QString getRoomTopic(lmdb::txn &txn, lmdb::dbi &statesdb);
+    QString getRoomTopic(lmdb::txn &txn, RoomDb &statesdb);
     //! Retrieve the room avatar's url if any.
-    QString getRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb);
+    QString getRoomAvatarUrl(lmdb::txn &txn, RoomDb &statesdb, RoomDb &membersdb);
     //! Retrieve the version of the room if any.
-    QString getRoomVersion(lmdb::txn &txn, lmdb::dbi &statesdb);
+    QString getRoomVersion(lmdb::txn &txn, RoomDb &statesdb);
     //! Retrieve if the room is a space
-    bool getRoomIsSpace(lmdb::txn &txn, lmdb::dbi &statesdb);
+    bool getRoomIsSpace(lmdb::txn &txn, RoomDb &statesdb);
 
     //! Get a specific state event
     template<typename T>
@@ -115,6 +205,17 @@ public:
                                                  std::size_t startIndex = 0,
                                                  std::size_t len        = 30);
     size_t memberCount(const std::string &room_id);
+    //! Save the member counts of the summaries in the joined rooms of a sync response.
+    void saveRoomSummaries(const nlohmann::json &joinedRooms);
+    //! Whether all members of the room are cached. Lazy loading only syncs the members that
+    //! sent events, the rest is fetched with /members on demand.
+    bool membersFullyLoaded(const std::string &room_id);
+    //! Save the complete member list of a room at the sync token `at` and mark its members as
+    //! fully loaded. Returns false without saving, if a newer sync was saved in the mean time.
+    bool
+    saveMembers(const std::string &room_id,
+                const std::vector<mtx::events::StateEvent<mtx::events::state::Member>> &members,
+                const std::string &at);
 
     void updateState(const std::string &room,
                      const mtx::responses::StateEvents &state,
@@ -125,11 +226,19 @@ public:
 
     std::string nextBatchToken();
 
+    //! The id of the uploaded sync filter, if it was uploaded with this definition.
+    std::optional<std::string> syncFilterId(const std::string &definition);
+    void saveSyncFilterId(const std::string &definition, const std::string &filter_id);
+
     void deleteData();
+    //! Directory, that holds the database files.
+    const QString &cacheDirectory() const { return cacheDirectory_; }
 
     void removeInvite(lmdb::txn &txn, const std::string &room_id);
     void removeInvite(const std::string &room_id);
     void removeRoom(lmdb::txn &txn, const std::string &roomid);
+    //! Remove the members of a room, together with their entries in the user to rooms index.
+    void dropMembers(lmdb::txn &txn, const std::string &room_id);
     void removeRoom(const std::string &roomid);
     void setup();
 
@@ -147,6 +256,8 @@ public:
     bool hasEnoughPowerLevel(const std::vector<mtx::events::EventType> &eventTypes,
                              const std::string &room_id,
                              const std::string &user_id);
+    //! The power levels of the room, parsed once and shared until they change.
+    std::shared_ptr<const CachedPowerLevels> powerLevels(const std::string &room_id);
 
     //! Adds a user to the read list for the given event.
     //!
@@ -195,6 +306,18 @@ public:
 
     std::optional<mtx::events::collections::TimelineEvent>
     getEvent(const std::string &room_id, std::string_view event_id);
+    //! The fields of an event needed to match it to the event it relates to.
+    struct EventFields
+    {
+        std::string sender;
+        std::string type;
+        uint64_t origin_server_ts = 0;
+        mtx::common::Relations relations;
+    };
+    //! Read only those fields of a stored event, without decoding the rest of it. For encrypted
+    //! events these are the fields of the encrypted event.
+    std::optional<EventFields> getEventFields(const std::string &room_id,
+                                              std::string_view event_id);
     void storeEvent(const std::string &room_id,
                     const std::string &event_id,
                     const mtx::events::collections::TimelineEvent &event);
@@ -216,13 +339,25 @@ public:
     lastVisibleEvent(const std::string &room_id, std::string_view event_id);
     std::optional<std::string> getTimelineEventId(const std::string &room_id, uint64_t index);
 
+    struct TimelineEntry
+    {
+        uint64_t index;
+        mtx::events::collections::TimelineEvent event;
+        //! Other events relate to this one, so edits may need to be applied.
+        bool has_relations = false;
+    };
+    //! Load the events between the timeline indices first and last (inclusive) in one transaction.
+    std::vector<TimelineEntry>
+    getTimelineEvents(const std::string &room_id, uint64_t first, uint64_t last);
+
     std::string previousBatchToken(const std::string &room_id);
     uint64_t saveOldMessages(const std::string &room_id, const mtx::responses::Messages &res);
     void savePendingMessage(const std::string &room_id,
                             const mtx::events::collections::TimelineEvent &message);
     std::vector<std::string> pendingEvents(const std::string &room_id);
-    std::optional<mtx::events::collections::TimelineEvent>
-    firstPendingMessage(const std::string &room_id);
+    //! The first pending messages in the order they were queued, at most limit of them.
+    std::vector<mtx::events::collections::TimelineEvent>
+    pendingMessages(const std::string &room_id, size_t limit);
     void removePendingStatus(const std::string &room_id, const std::string &txn_id);
 
     //! clear timeline keeping only the latest batch
@@ -231,10 +366,30 @@ public:
     //! Remove old unused data.
     void deleteOldMessages();
     void deleteOldData() noexcept;
+    //! Clear reader slots of dead processes and log how many slots are in use.
+    void checkReaders() noexcept;
+
+    //! Shares one read transaction between all lookups on the current thread while it is alive.
+    //! Only wrap batches of reads in it, writes are not visible until it is destroyed.
+    class ReadSnapshot
+    {
+    public:
+        explicit ReadSnapshot(lmdb::env &env);
+        ReadSnapshot(const ReadSnapshot &)            = delete;
+        ReadSnapshot &operator=(const ReadSnapshot &) = delete;
+        ~ReadSnapshot();
+    };
+    [[nodiscard]] ReadSnapshot readSnapshot() { return ReadSnapshot(env_); }
     //! Retrieve all saved room ids.
     std::vector<std::string> getRoomIds(lmdb::txn &txn);
     std::vector<std::string> getParentRoomIds(const std::string &room_id);
     std::vector<std::string> getChildRoomIds(const std::string &room_id);
+    //! Every space the room is in, directly or through subspaces.
+    std::vector<std::string> getAncestorRoomIds(const std::string &room_id);
+    //! Every room in the space, directly or through subspaces.
+    std::vector<std::string> getDescendantRoomIds(const std::string &space_id);
+    //! Whether the room is in the space, directly or through subspaces.
+    bool isInSpace(const std::string &room_id, const std::string &space_id);
 
     std::vector<ImagePackInfo>
     getImagePacks(const std::string &room_id, std::optional<bool> stickers);
@@ -339,20 +494,39 @@ private:
 
     //! Save an invited room.
     void saveInvite(lmdb::txn &txn,
-                    lmdb::dbi &statesdb,
-                    lmdb::dbi &membersdb,
+                    RoomDb &statesdb,
+                    RoomDb &membersdb,
                     const mtx::responses::InvitedRoom &room);
 
-    QString getInviteRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb);
-    QString getInviteRoomTopic(lmdb::txn &txn, lmdb::dbi &statesdb);
-    QString getInviteRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb);
-    bool getInviteRoomIsSpace(lmdb::txn &txn, lmdb::dbi &db);
+    QString getInviteRoomName(lmdb::txn &txn, RoomDb &statesdb, RoomDb &membersdb);
+    QString getInviteRoomTopic(lmdb::txn &txn, RoomDb &statesdb);
+    QString getInviteRoomAvatarUrl(lmdb::txn &txn, RoomDb &statesdb, RoomDb &membersdb);
+    bool getInviteRoomIsSpace(lmdb::txn &txn, RoomDb &db);
 
     std::optional<MemberInfo> getMember(const std::string &room_id, const std::string &user_id);
+    //! Look up a member in the member cache, reading it from the db on a miss.
+    CachedMember cachedMember(const std::string &room_id, const std::string &user_id);
+    //! Store the new membership of a user, an empty info means the user is no member anymore.
+    //! Applied once the write txn is committed.
+    void updateMemberCache(const std::string &room_id,
+                           const std::string &user_id,
+                           std::optional<MemberInfo> info);
+    void clearMemberCache(const std::string &room_id);
+    //! Begin a write txn, that may change the in memory caches.
+    lmdb::txn beginWithCacheUpdates();
+    //! Commit the txn and then apply the changes to the in memory caches made in it.
+    void commitWithCacheUpdates(lmdb::txn &txn);
+    //! Read the power levels from the db. Bypasses the cache, which doesn't contain the changes of
+    //! an open write txn yet.
+    std::shared_ptr<CachedPowerLevels> powerLevels_(lmdb::txn &txn, const std::string &room_id);
+    //! Replace the cached power levels, std::nullopt if the room has none. Applied once the write
+    //! txn is committed.
+    void updatePowerLevelsCache(const std::string &room_id,
+                                std::optional<mtx::events::state::PowerLevels> content);
 
     std::string getLastEventId(lmdb::txn &txn, const std::string &room_id);
     void saveTimelineMessages(lmdb::txn &txn,
-                              lmdb::dbi &eventsDb,
+                              RoomDb &eventsDb,
                               const std::string &room_id,
                               const mtx::responses::Timeline &res);
 
@@ -360,18 +534,21 @@ private:
     //! pass empty room_id for global account data
     std::optional<mtx::events::collections::RoomAccountDataEvents>
     getAccountData(lmdb::txn &txn, mtx::events::EventType type, const std::string &room_id);
-    bool isHiddenEvent(lmdb::txn &txn,
-                       mtx::events::collections::TimelineEvents e,
-                       const std::string &room_id);
+    //! Event types hidden in a room, look them up once per batch of events.
+    std::vector<mtx::events::EventType> hiddenEventTypes(lmdb::txn &txn,
+                                                         const std::string &room_id);
+    bool isHiddenEvent(mtx::events::collections::TimelineEvents e,
+                       const std::string &room_id,
+                       const std::vector<mtx::events::EventType> &hiddenTypes);
 
     //! Remove a room from the cache.
     // void removeLeftRoom(lmdb::txn &txn, const std::string &room_id);
     template<class T>
     void saveStateEvents(lmdb::txn &txn,
-                         lmdb::dbi &statesdb,
-                         lmdb::dbi &stateskeydb,
-                         lmdb::dbi &membersdb,
-                         lmdb::dbi &eventsDb,
+                         RoomDb &statesdb,
+                         RoomDb &stateskeydb,
+                         RoomDb &membersdb,
+                         RoomDb &eventsDb,
                          const std::string &room_id,
                          const std::vector<T> &events)
     {
@@ -381,10 +558,10 @@ private:
 
     template<class T>
     void saveStateEvent(lmdb::txn &txn,
-                        lmdb::dbi &statesdb,
-                        lmdb::dbi &stateskeydb,
-                        lmdb::dbi &membersdb,
-                        lmdb::dbi &eventsDb,
+                        RoomDb &statesdb,
+                        RoomDb &stateskeydb,
+                        RoomDb &membersdb,
+                        RoomDb &eventsDb,
                         const std::string &room_id,
                         const T &event)
     {
@@ -405,10 +582,14 @@ private:
                 MemberInfo tmp{display_name, e->content.avatar_url, e->content.reason};
 
                 membersdb.put(txn, e->state_key, nlohmann::json(tmp).dump());
+                userRoomsDb_.put(txn, e->state_key, room_id);
+                updateMemberCache(room_id, e->state_key, std::move(tmp));
                 break;
             }
             default: {
-                membersdb.del(txn, e->state_key, "");
+                membersdb.del(txn, e->state_key);
+                userRoomsDb_.del(txn, e->state_key, room_id);
+                updateMemberCache(room_id, e->state_key, std::nullopt);
                 break;
             }
             }
@@ -423,21 +604,28 @@ private:
             if (statesdb.get(txn, to_string(encr->type), temp)) {
                 return;
             }
+        } else if (auto pl = std::get_if<StateEvent<PowerLevels>>(&event)) {
+            if (pl->state_key.empty())
+                updatePowerLevelsCache(room_id, pl->content);
         }
 
         std::visit(
-          [&txn, &statesdb, &stateskeydb, &eventsDb, &membersdb](const auto &e) {
+          [this, &txn, &statesdb, &stateskeydb, &eventsDb, &membersdb, &room_id](const auto &e) {
               if constexpr (isStateEvent_<decltype(e)>) {
                   eventsDb.put(txn, e.event_id, nlohmann::json(e).dump());
 
                   if (e.type != EventType::Unsupported) {
                       if (std::is_same_v<std::remove_cv_t<std::remove_reference_t<decltype(e)>>,
                                          StateEvent<mtx::events::msg::Redacted>>) {
-                          if (e.type == EventType::RoomMember)
-                              membersdb.del(txn, e.state_key, "");
-                          else if (e.state_key.empty())
+                          if (e.type == EventType::RoomMember) {
+                              membersdb.del(txn, e.state_key);
+                              userRoomsDb_.del(txn, e.state_key, room_id);
+                              updateMemberCache(room_id, e.state_key, std::nullopt);
+                          } else if (e.state_key.empty()) {
                               statesdb.del(txn, to_string(e.type));
-                          else
+                              if (e.type == EventType::RoomPowerLevels)
+                                  updatePowerLevelsCache(room_id, std::nullopt);
+                          } else
                               stateskeydb.del(txn,
                                               to_string(e.type),
                                               nlohmann::json::object({
@@ -490,7 +678,7 @@ private:
                 std::string_view data     = d;
                 std::string_view typeStrV = typeStr;
 
-                auto cursor = lmdb::cursor::open(txn, db);
+                auto cursor = RoomCursor::open(txn, db);
                 if (!cursor.get(typeStrV, data, MDB_GET_BOTH))
                     return std::nullopt;
 
@@ -530,7 +718,7 @@ private:
             std::string_view data;
             std::string_view value;
 
-            auto cursor = lmdb::cursor::open(txn, db);
+            auto cursor = RoomCursor::open(txn, db);
             bool first  = true;
             if (cursor.get(typeStrV, data, MDB_SET)) {
                 while (cursor.get(typeStrV, data, first ? MDB_FIRST_DUP : MDB_NEXT_DUP)) {
@@ -572,83 +760,99 @@ private:
     void updateSpaces(lmdb::txn &txn,
                       const std::set<std::string> &spaces_with_updates,
                       std::set<std::string> rooms_with_updates);
+    //! Recompute the ancestors and descendants of every room related to the rooms, whose space
+    //! parents or children changed.
+    void updateSpaceClosure(lmdb::txn &txn, const std::set<std::string> &rooms);
+    //! The values of a room in one of the space tables.
+    std::vector<std::string>
+    getSpaceRelatives(lmdb::txn &txn, lmdb::dbi &db, const std::string &room_id);
+    //! Follow the edges from the room, skipping rooms already seen, so cycles end.
+    std::set<std::string>
+    walkSpaceEdges(lmdb::txn &txn, lmdb::dbi &edges, const std::string &room_id);
 
     lmdb::dbi getPendingReceiptsDb(lmdb::txn &txn)
     {
         return lmdb::dbi::open(txn, "pending_receipts", MDB_CREATE);
     }
 
-    lmdb::dbi getEventsDb(lmdb::txn &txn, const std::string &room_id)
+    //! Look up the number of a room or assign a new one, if the transaction is writable.
+    RoomNum roomNum(lmdb::txn &txn, std::string_view room_id);
+
+    RoomDb getEventsDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(txn, std::string(room_id + "/events").c_str(), MDB_CREATE);
+        return RoomDb(eventsDb_, roomNum(txn, room_id));
     }
 
-    lmdb::dbi getEventOrderDb(lmdb::txn &txn, const std::string &room_id)
+    RoomDb getEventOrderDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(
-          txn, std::string(room_id + "/event_order").c_str(), MDB_CREATE | MDB_INTEGERKEY);
+        return RoomDb(eventOrderDb_, roomNum(txn, room_id), RoomDb::IntegerKey);
+    }
+
+    RoomDb getBatchTokensDb(lmdb::txn &txn, const std::string &room_id)
+    {
+        return RoomDb(batchTokensDb_, roomNum(txn, room_id), RoomDb::IntegerKey);
     }
 
     // inverse of EventOrderDb
-    lmdb::dbi getEventToOrderDb(lmdb::txn &txn, const std::string &room_id)
+    RoomDb getEventToOrderDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(txn, std::string(room_id + "/event2order").c_str(), MDB_CREATE);
+        return RoomDb(eventToOrderDb_, roomNum(txn, room_id));
     }
 
-    lmdb::dbi getMessageToOrderDb(lmdb::txn &txn, const std::string &room_id)
+    RoomDb getMessageToOrderDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(txn, std::string(room_id + "/msg2order").c_str(), MDB_CREATE);
+        return RoomDb(messageToOrderDb_, roomNum(txn, room_id));
     }
 
-    lmdb::dbi getOrderToMessageDb(lmdb::txn &txn, const std::string &room_id)
+    RoomDb getOrderToMessageDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(
-          txn, std::string(room_id + "/order2msg").c_str(), MDB_CREATE | MDB_INTEGERKEY);
+        return RoomDb(orderToMessageDb_, roomNum(txn, room_id), RoomDb::IntegerKey);
     }
 
-    lmdb::dbi getPendingMessagesDb(lmdb::txn &txn, const std::string &room_id)
+    //! EventOrderDb restricted to the events in the MessageToOrderDb
+    RoomDb getVisibleOrderDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(
-          txn, std::string(room_id + "/pending").c_str(), MDB_CREATE | MDB_INTEGERKEY);
+        return RoomDb(visibleOrderDb_, roomNum(txn, room_id), RoomDb::IntegerKey);
     }
 
-    lmdb::dbi getRelationsDb(lmdb::txn &txn, const std::string &room_id)
+    RoomDb getPendingMessagesDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(
-          txn, std::string(room_id + "/related").c_str(), MDB_CREATE | MDB_DUPSORT);
+        return RoomDb(pendingMessagesDb_, roomNum(txn, room_id), RoomDb::IntegerKey);
     }
 
-    lmdb::dbi getInviteStatesDb(lmdb::txn &txn, const std::string &room_id)
+    RoomDb getRelationsDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(txn, std::string(room_id + "/invite_state").c_str(), MDB_CREATE);
+        return RoomDb(relationsDb_, roomNum(txn, room_id));
     }
 
-    lmdb::dbi getInviteMembersDb(lmdb::txn &txn, const std::string &room_id)
+    RoomDb getInviteStatesDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(txn, std::string(room_id + "/invite_members").c_str(), MDB_CREATE);
+        return RoomDb(inviteStatesDb_, roomNum(txn, room_id));
     }
 
-    lmdb::dbi getStatesDb(lmdb::txn &txn, const std::string &room_id)
+    RoomDb getInviteMembersDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(txn, std::string(room_id + "/state").c_str(), MDB_CREATE);
+        return RoomDb(inviteMembersDb_, roomNum(txn, room_id), entryCountsDb_, "invite_members");
     }
 
-    lmdb::dbi getStatesKeyDb(lmdb::txn &txn, const std::string &room_id)
+    RoomDb getStatesDb(lmdb::txn &txn, const std::string &room_id)
     {
-        auto db = lmdb::dbi::open(
-          txn, std::string(room_id + "/state_by_key").c_str(), MDB_CREATE | MDB_DUPSORT);
-        lmdb::dbi_set_dupsort(txn, db, compare_state_key);
-        return db;
+        return RoomDb(statesDb_, roomNum(txn, room_id));
     }
 
-    lmdb::dbi getAccountDataDb(lmdb::txn &txn, const std::string &room_id)
+    RoomDb getStatesKeyDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(txn, std::string(room_id + "/account_data").c_str(), MDB_CREATE);
+        return RoomDb(statesKeyDb_, roomNum(txn, room_id));
     }
 
-    lmdb::dbi getMembersDb(lmdb::txn &txn, const std::string &room_id)
+    RoomDb getAccountDataDb(lmdb::txn &txn, const std::string &room_id)
     {
-        return lmdb::dbi::open(txn, std::string(room_id + "/members").c_str(), MDB_CREATE);
+        return RoomDb(accountDataDb_, roomNum(txn, room_id));
+    }
+
+    RoomDb getMembersDb(lmdb::txn &txn, const std::string &room_id)
+    {
+        return RoomDb(membersDb_, roomNum(txn, room_id), entryCountsDb_, "members");
     }
 
     lmdb::dbi getUserKeysDb(lmdb::txn &txn) { return lmdb::dbi::open(txn, "user_key", MDB_CREATE); }
@@ -678,7 +882,15 @@ private:
 
     std::optional<VerificationCache> verificationCache(const std::string &user_id, lmdb::txn &txn);
     VerificationStatus verificationStatus_(const std::string &user_id, lmdb::txn &txn);
+    //! Calculate the verification status of the users on the worker pool, optionally emitting
+    //! verificationStatusChanged afterwards.
+    void updateVerificationStatuses(const std::vector<std::string> &user_ids, bool notify);
+    //! Forget the verification status of the users, whose keys changed, and recalculate it.
+    void invalidateVerificationStatus(const std::vector<std::string> &user_ids);
+    //! Write the verification status calculated since the last call.
+    void saveVerificationStatuses(lmdb::txn &txn);
     std::optional<UserKeyCache> userKeys_(const std::string &user_id, lmdb::txn &txn);
+    size_t memberCount_(lmdb::txn &txn, const std::string &room_id);
 
     void setNextBatchToken(lmdb::txn &txn, const std::string &token);
 
@@ -686,6 +898,7 @@ private:
     lmdb::dbi syncStateDb_;
     lmdb::dbi roomsDb_;
     lmdb::dbi spacesChildrenDb_, spacesParentsDb_;
+    lmdb::dbi spacesDescendantsDb_, spacesAncestorsDb_;
     lmdb::dbi invitesDb_;
     lmdb::dbi readReceiptsDb_;
     lmdb::dbi notificationsDb_;
@@ -699,6 +912,23 @@ private:
     lmdb::dbi megolmSessionDataDb_;
 
     lmdb::dbi encryptedRooms_;
+    lmdb::dbi verificationStatusDb_;
+
+    //! Tables shared by all rooms, see RoomDb.
+    lmdb::dbi roomIdsDb_, roomNumsDb_;
+    lmdb::dbi eventsDb_;
+    lmdb::dbi eventOrderDb_, eventToOrderDb_, batchTokensDb_;
+    lmdb::dbi messageToOrderDb_, orderToMessageDb_, visibleOrderDb_;
+    lmdb::dbi pendingMessagesDb_;
+    lmdb::dbi relationsDb_;
+    lmdb::dbi statesDb_, statesKeyDb_;
+    lmdb::dbi accountDataDb_;
+    lmdb::dbi membersDb_;
+    lmdb::dbi membersLoadedDb_;
+    lmdb::dbi memberCountsDb_;
+    lmdb::dbi userRoomsDb_;
+    lmdb::dbi inviteStatesDb_, inviteMembersDb_;
+    lmdb::dbi entryCountsDb_;
 
     QString localUserId_;
     QString cacheDirectory_;
@@ -706,8 +936,19 @@ private:
     std::string pickle_secret_;
 
     VerificationStorage verification_storage;
+    MemberStorage member_storage;
+    PowerLevelsStorage power_levels_storage;
+
+    //! Changes to the in memory caches from the open write txn. Only touched by the thread
+    //! holding the write txn.
+    std::vector<std::function<void()>> pendingCacheUpdates_;
+    //! Keeps the cache updates of consecutive write txns in commit order.
+    std::mutex cacheUpdatesMtx_;
 
     bool databaseReady_ = false;
+
+    //! Destroyed first, so that no verification outlives the cache.
+    QThreadPool verificationPool_;
 };
 
 namespace cache {
@@ -5,7 +5,12 @@
 #include <QApplication>
 #include <QInputDialog>
 #include <QMessageBox>
+#include <QUrl>
+#include <QtConcurrent>
 
+#include <coeurl/client.hpp>
+#include <coeurl/request.hpp>
+#include <curl/curl.h>
 #include <mtx/responses.hpp>
 
 #include "AvatarProvider.h"
@@ -16,6 +21,9 @@
 #include "Logging.h"
 #include "MainWindow.h"
 #include "MatrixClient.h"
+#include "Metrics.h"
+#include "SlidingSync.h"
+#include "StartupProfile.h"
 #include "UserSettingsPage.h"
 #include "Utils.h"
 #include "encryption/DeviceVerificationFlow.h"
@@ -27,6 +35,7 @@
 
 #include "notifications/Manager.h"
 
+#include "timeline/EventStore.h"
 #include "timeline/TimelineViewManager.h"
 
 #include "blurhash.hpp"
@@ -35,6 +44,32 @@ ChatPage *ChatPage::instance_                    = nullptr;
 static constexpr int CHECK_CONNECTIVITY_INTERVAL = 15'000;
 static constexpr int RETRY_TIMEOUT               = 5'000;
 static constexpr size_t MAX_ONETIME_KEYS         = 50;
+static constexpr int SYNC_TIMELINE_LIMIT         = 20;
+
+//! The server does not implement sliding sync, so we use the normal sync.
+static bool
+isUnsupported(const SlidingSync::Error &err)
+{
+    return err.status_code == 404 || err.status_code == 405 || err.errcode == "M_UNRECOGNIZED";
+}
+
+//! Lazy load members, which are most of the state of large rooms, and skip the ephemeral events
+//! we don't display.
+static const std::string &
+syncFilterDefinition()
+{
+    static const std::string definition =
+      nlohmann::json{
+        {"room",
+         {
+           {"state", {{"lazy_load_members", true}}},
+           {"timeline", {{"limit", SYNC_TIMELINE_LIMIT}}},
+           {"ephemeral", {{"types", nlohmann::json::array({"m.receipt", "m.typing"})}}},
+         }},
+      }
+        .dump();
+    return definition;
+}
 
 Q_DECLARE_METATYPE(std::optional<mtx::crypto::EncryptedFile>)
 Q_DECLARE_METATYPE(std::optional<RelatedInfo>)
@@ -46,8 +81,10 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QObject *parent)
   : QObject(parent)
   , isConnected_(true)
   , userSettings_{userSettings}
+  , slidingSync_(new SlidingSync(this))
   , notificationsManager(new NotificationsManager(this))
   , callManager_(new CallManager(this))
+  , syncClient_(std::make_unique<coeurl::Client>())
 {
     setObjectName(QStringLiteral("chatPage"));
 
@@ -71,6 +108,7 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QObject *parent)
         nhlog::net()->info("connectivity lost");
         isConnected_ = false;
         http::client()->shutdown();
+        stopSync();
     });
     connect(this, &ChatPage::connectionRestored, this, [this]() {
         nhlog::net()->info("trying to re-connect");
@@ -78,6 +116,7 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QObject *parent)
 
         // Drop all pending connections.
         http::client()->shutdown();
+        stopSync();
         trySync();
     });
 
@@ -102,6 +141,23 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QObject *parent)
 
     connect(this, &ChatPage::loggedOut, this, &ChatPage::logout);
 
+    connect(slidingSync_, &SlidingSync::restartRequested, this, [this] {
+        if (useSlidingSync())
+            trySync();
+    });
+    connect(slidingSync_,
+            &SlidingSync::moreRoomsAvailable,
+            view_manager_->rooms(),
+            &RoomlistModel::setMoreRoomsOnServer);
+    connect(view_manager_->rooms(),
+            &RoomlistModel::fetchMoreRoomsRequested,
+            slidingSync_,
+            &SlidingSync::extendWindow);
+    connect(view_manager_->rooms(),
+            &RoomlistModel::currentRoomChanged,
+            slidingSync_,
+            &SlidingSync::setCurrentRoom);
+
     connect(
       view_manager_,
       &TimelineViewManager::inviteUsers,
@@ -389,6 +445,8 @@ ChatPage::ChatPage(QSharedPointer<UserSettings> userSettings, QObject *parent)
     connectCallMessage<mtx::events::voip::CallNegotiate>();
 }
 
+ChatPage::~ChatPage() = default;
+
 void
 ChatPage::logout()
 {
@@ -405,7 +463,9 @@ ChatPage::dropToLoginPage(const QString &msg)
     nhlog::ui()->info("dropping to the login page: {}", msg.toStdString());
 
     http::client()->shutdown();
+    stopSync();
     connectivityTimer_.stop();
+    deferredStartupPending_ = false;
 
     auto btn = QMessageBox::warning(
       nullptr,
@@ -432,6 +492,17 @@ void
 ChatPage::resetUI()
 {
     view_manager_->clearAll();
+    // also drops the presences held back for the deferred startup tasks
+    view_manager_->presence()->clear();
+    deferredStartupPending_ = false;
+    uploadingSyncFilter_    = false;
+    {
+        std::lock_guard<std::mutex> lock(syncFilterMutex_);
+        syncFilterId_.clear();
+    }
+    pendingMemberLoads_.clear();
+    slidingSync_->reset();
+    slidingSyncUnsupported_ = false;
 
     emit unreadMessages(0);
 }
@@ -454,12 +525,16 @@ ChatPage::deleteConfigs()
     }
 
     http::client()->shutdown();
+    stopSync();
+    EventStore::waitForSavedHistory();
     cache::deleteData();
 }
 
 void
 ChatPage::bootstrap(QString userid, QString homeserver, QString token)
 {
+    startupprofile::Scope profile("bootstrap");
+
     using namespace mtx::identifiers;
 
     try {
@@ -482,6 +557,7 @@ ChatPage::bootstrap(QString userid, QString homeserver, QString token)
 
         connect(cache::client(), &Cache::databaseReady, this, [this]() {
             nhlog::db()->info("database ready");
+            startupprofile::mark("database ready");
 
             const bool isInitialized = cache::isInitialized();
             const auto cacheVersion  = cache::formatVersion();
@@ -494,7 +570,10 @@ ChatPage::bootstrap(QString userid, QString homeserver, QString token)
                         loadStateFromCache();
                         return;
                     } else if (cacheVersion == cache::CacheVersion::Older) {
-                        if (!cache::runMigrations()) {
+                        startupprofile::begin("migrations");
+                        bool migrated = cache::runMigrations();
+                        startupprofile::end("migrations");
+                        if (!migrated) {
                             QMessageBox::critical(
                               nullptr,
                               tr("Cache migration failed!"),
@@ -560,45 +639,101 @@ void
 ChatPage::loadStateFromCache()
 {
     nhlog::db()->info("restoring state from cache");
+    startupprofile::Scope profile("restore state");
+
+    // Unpickle the olm account while the room list is built. Everything else, that uses it in the
+    // meantime, like decrypting the last messages for the sidebar, waits for it in olm::client().
+    // Returns the error to show on the login page, if it failed.
+    auto account     = olm::client();
+    auto olmRestored = QtConcurrent::run([account]() -> std::optional<QString> {
+        startupprofile::Scope profile("restore olm account");
+        try {
+            account->load(cache::restoreOlmAccount(), cache::client()->pickleSecret());
+        } catch (const mtx::crypto::olm_exception &e) {
+            nhlog::crypto()->critical("failed to restore olm account: {}", e.what());
+            return tr("Failed to restore OLM account. Please login again.");
+        } catch (const lmdb::error &e) {
+            nhlog::db()->critical("failed to restore cache: {}", e.what());
+            return tr("Failed to restore save data. Please login again.");
+        } catch (const std::exception &e) {
+            nhlog::db()->critical("failed to load cache data: {}", e.what());
+            return tr("Failed to restore save data. Please login again.");
+        }
+        return std::nullopt;
+    });
+    olm::setLoading(olmRestored);
 
-    try {
-        olm::client()->load(cache::restoreOlmAccount(), cache::client()->pickleSecret());
+    view_manager_->presence()->setDeferred(true);
 
+    try {
         emit initializeEmptyViews();
-
-        cache::calculateRoomReadStatus();
-
-    } catch (const mtx::crypto::olm_exception &e) {
-        nhlog::crypto()->critical("failed to restore olm account: {}", e.what());
-        emit dropToLoginPageCb(tr("Failed to restore OLM account. Please login again."));
-        return;
     } catch (const lmdb::error &e) {
         nhlog::db()->critical("failed to restore cache: {}", e.what());
+        olmRestored.waitForFinished();
         emit dropToLoginPageCb(tr("Failed to restore save data. Please login again."));
         return;
     } catch (const nlohmann::json::exception &e) {
         nhlog::db()->critical("failed to parse cache data: {}", e.what());
+        olmRestored.waitForFinished();
         emit dropToLoginPageCb(tr("Failed to restore save data. Please login again."));
         return;
     } catch (const std::exception &e) {
         nhlog::db()->critical("failed to load cache data: {}", e.what());
+        olmRestored.waitForFinished();
         emit dropToLoginPageCb(tr("Failed to restore save data. Please login again."));
         return;
     }
 
+    if (auto error = olmRestored.result()) {
+        emit dropToLoginPageCb(*error);
+        return;
+    }
+
     nhlog::crypto()->info("ed25519   : {}", olm::client()->identity_keys().ed25519);
     nhlog::crypto()->info("curve25519: {}", olm::client()->identity_keys().curve25519);
 
+    // Start receiving events, while the read status is calculated and the rooms are painted.
+    connect(this, &ChatPage::newSyncResponse, &ChatPage::startRemoveFallbackKeyTimer);
+    trySync();
+
+    try {
+        cache::calculateRoomReadStatus();
+    } catch (const lmdb::error &e) {
+        nhlog::db()->error("failed to calculate room read status: {}", e.what());
+    }
+
     getProfileInfo();
-    getBackupVersion();
-    verifyOneTimeKeyCountAfterStartup();
-    callManager_->refreshTurnServer();
 
     emit contentLoaded();
 
-    // Start receiving events.
-    connect(this, &ChatPage::newSyncResponse, &ChatPage::startRemoveFallbackKeyTimer);
-    emit trySyncCb();
+    // Work that is not needed to show the rooms waits until they were painted once, or a few
+    // seconds, if nothing is painted.
+    deferredStartupPending_ = true;
+    auto window             = MainWindow::instance();
+    if (window && window->isVisible()) {
+        auto connection = std::make_shared<QMetaObject::Connection>();
+        *connection = connect(window, &QQuickWindow::frameSwapped, this, [this, connection] {
+            QObject::disconnect(*connection);
+            runDeferredStartupTasks();
+        });
+    }
+    QTimer::singleShot(
+      window && window->isVisible() ? 5000 : 0, this, &ChatPage::runDeferredStartupTasks);
+}
+
+void
+ChatPage::runDeferredStartupTasks()
+{
+    // frames may already be queued, when the connection is dropped
+    if (!deferredStartupPending_)
+        return;
+    deferredStartupPending_ = false;
+
+    startupprofile::Scope profile("deferred startup tasks");
+    view_manager_->presence()->setDeferred(false);
+    getBackupVersion();
+    verifyOneTimeKeyCountAfterStartup();
+    callManager_->refreshTurnServer();
 }
 
 void
@@ -662,11 +797,42 @@ ChatPage::startInitialSync()
 {
     nhlog::net()->info("trying initial sync");
 
+    if (useSlidingSync()) {
+        slidingSync_->sync(
+          "",
+          0,
+          [this](const mtx::responses::Sync &res, const std::optional<SlidingSync::Error> &err) {
+              if (err) {
+                  nhlog::net()->error("initial sliding sync error: {} {} {}",
+                                      err->status_code,
+                                      err->errcode,
+                                      err->message);
+
+                  if (isUnsupported(*err)) {
+                      nhlog::net()->warn("sliding sync is not supported, using normal sync");
+                      slidingSyncUnsupported_ = true;
+                      startInitialSync();
+                  } else if (err->errcode == "M_UNKNOWN_TOKEN" ||
+                             err->errcode == "M_MISSING_TOKEN") {
+                      emit dropToLoginPageCb(tr("Please try to login again: %1")
+                                               .arg(QString::fromStdString(err->message)));
+                  } else {
+                      QTimer::singleShot(RETRY_TIMEOUT, this, &ChatPage::startInitialSync);
+                  }
+                  return;
+              }
+
+              QTimer::singleShot(0, this, [this, res] { initialSyncCompleted(res); });
+          });
+        return;
+    }
+
     mtx::http::SyncOpts opts;
     opts.timeout      = 0;
+    opts.filter       = syncFilter();
     opts.set_presence = currentPresence();
 
-    http::client()->sync(opts, [this](const mtx::responses::Sync &res, mtx::http::RequestErr err) {
+    sync(opts, [this](const mtx::responses::Sync &res, mtx::http::RequestErr err) {
         // TODO: Initial Sync should include mentions as well...
 
         if (err) {
@@ -697,31 +863,52 @@ ChatPage::startInitialSync()
             }
         }
 
-        QTimer::singleShot(0, this, [this, res] {
-            nhlog::net()->info("initial sync completed");
-            try {
-                cache::client()->saveState(res);
+        QTimer::singleShot(0, this, [this, res] { initialSyncCompleted(res); });
+    });
+}
 
-                olm::handle_to_device_messages(res.to_device.events);
+void
+ChatPage::initialSyncCompleted(const mtx::responses::Sync &res)
+{
+    nhlog::net()->info("initial sync completed");
+    try {
+        cache::client()->saveState(res);
 
-                emit initializeViews(std::move(res));
+        olm::handle_to_device_messages(res.to_device.events);
 
-                cache::calculateRoomReadStatus();
-            } catch (const lmdb::error &e) {
-                nhlog::db()->error("failed to save state after initial sync: {}", e.what());
-                startInitialSync();
-                return;
-            }
+        emit initializeViews(res);
 
-            emit trySyncCb();
-            emit contentLoaded();
-        });
-    });
+        cache::calculateRoomReadStatus();
+    } catch (const lmdb::error &e) {
+        nhlog::db()->error("failed to save state after initial sync: {}", e.what());
+        startInitialSync();
+        return;
+    }
+
+    emit trySyncCb();
+    emit contentLoaded();
+}
+
+bool
+ChatPage::useSlidingSync() const
+{
+    return userSettings_->slidingSync() && !slidingSyncUnsupported_;
 }
 
 void
 ChatPage::handleSyncResponse(const mtx::responses::Sync &res, const std::string &prev_batch_token)
 {
+    static auto &queued    = metrics::gauge("sync.queued_responses");
+    static auto &handleMs  = metrics::histogram("sync.handle_ms");
+    static auto &saveMs    = metrics::histogram("sync.save_ms");
+    static auto &events    = metrics::histogram("sync.events");
+    static auto &rooms     = metrics::histogram("sync.rooms");
+    static auto &toDevice  = metrics::counter("sync.to_device_events");
+    static auto &responses = metrics::counter("sync.responses");
+
+    queued.add(-1);
+    metrics::Timer handleTimer(handleMs);
+
     try {
         if (prev_batch_token != cache::nextBatchToken()) {
             nhlog::net()->warn("Duplicate sync, dropping");
@@ -734,12 +921,24 @@ ChatPage::handleSyncResponse(const mtx::responses::Sync &res, const std::string
 
     nhlog::net()->debug("sync completed: {}", res.next_batch);
 
+    responses.add();
+    uint64_t eventCount = 0;
+    for (const auto &[roomId, room] : res.rooms.join)
+        eventCount += room.state.events.size() + room.timeline.events.size() +
+                      room.ephemeral.events.size() + room.account_data.events.size();
+    events.record(eventCount);
+    rooms.record(res.rooms.join.size() + res.rooms.invite.size() + res.rooms.leave.size());
+    toDevice.add(res.to_device.events.size());
+
     // Ensure that we have enough one-time keys available.
     ensureOneTimeKeyCount(res.device_one_time_keys_count, res.device_unused_fallback_key_types);
 
     // TODO: fine grained error handling
     try {
-        cache::client()->saveState(res);
+        {
+            metrics::Timer saveTimer(saveMs);
+            cache::client()->saveState(res);
+        }
         olm::handle_to_device_messages(res.to_device.events);
 
         auto updates = cache::getRoomInfo(cache::client()->roomsWithStateUpdates(res));
@@ -766,22 +965,72 @@ ChatPage::handleSyncResponse(const mtx::responses::Sync &res, const std::string
 void
 ChatPage::trySync()
 {
-    mtx::http::SyncOpts opts;
-    opts.set_presence = currentPresence();
-
     if (!connectivityTimer_.isActive())
         connectivityTimer_.start();
 
+    std::string since;
     try {
-        opts.since = cache::nextBatchToken();
+        since = cache::nextBatchToken();
     } catch (const lmdb::error &e) {
         nhlog::db()->error("failed to retrieve next batch token: {}", e.what());
         return;
     }
 
-    http::client()->sync(
-      opts, [this, since = opts.since](const mtx::responses::Sync &res, mtx::http::RequestErr err) {
+    static auto &roundTripMs = metrics::histogram("sync.round_trip_ms");
+    static auto &errors      = metrics::counter("sync.errors");
+    static auto &queued      = metrics::gauge("sync.queued_responses");
+
+    if (useSlidingSync()) {
+        slidingSync_->sync(
+          since,
+          30'000,
+          [this, since, sent = std::chrono::steady_clock::now()](
+            const mtx::responses::Sync &res, const std::optional<SlidingSync::Error> &err) {
+              roundTripMs.record(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                   std::chrono::steady_clock::now() - sent)
+                                   .count());
+
+              if (err) {
+                  errors.add();
+                  nhlog::net()->error(
+                    "sliding sync error: {} {} {}", err->status_code, err->errcode, err->message);
+
+                  if (isUnsupported(*err)) {
+                      nhlog::net()->warn("sliding sync is not supported, using normal sync");
+                      slidingSyncUnsupported_ = true;
+                      emit trySyncCb();
+                  } else if (err->errcode == "M_UNKNOWN_TOKEN" ||
+                             err->errcode == "M_MISSING_TOKEN" || !http::is_logged_in()) {
+                      emit dropToLoginPageCb(tr("Please try to login again: %1")
+                                               .arg(QString::fromStdString(err->message)));
+                  } else {
+                      emit tryDelayedSyncCb();
+                  }
+                  return;
+              }
+
+              queued.add(1);
+              emit newSyncResponse(res, since);
+          });
+        return;
+    }
+
+    mtx::http::SyncOpts opts;
+    opts.filter       = syncFilter();
+    opts.set_presence = currentPresence();
+    // the positions of sliding sync can't be used by the normal sync, so it starts over
+    opts.since = SlidingSync::isSlidingToken(since) ? "" : since;
+
+    sync(
+      opts,
+      [this, since, sent = std::chrono::steady_clock::now()](const mtx::responses::Sync &res,
+                                                             mtx::http::RequestErr err) {
+          roundTripMs.record(std::chrono::duration_cast<std::chrono::milliseconds>(
+                               std::chrono::steady_clock::now() - sent)
+                               .count());
+
           if (err) {
+              errors.add();
               const auto error = QString::fromStdString(err->matrix_error.error);
               const auto msg   = tr("Please try to login again: %1").arg(error);
 
@@ -798,10 +1047,220 @@ ChatPage::trySync()
               return;
           }
 
+          queued.add(1);
           emit newSyncResponse(res, since);
       });
 }
 
+std::string
+ChatPage::syncFilter()
+{
+    const auto &definition = syncFilterDefinition();
+    {
+        std::lock_guard<std::mutex> lock(syncFilterMutex_);
+        if (!syncFilterId_.empty())
+            return syncFilterId_;
+    }
+
+    if (auto id = cache::client()->syncFilterId(definition)) {
+        std::lock_guard<std::mutex> lock(syncFilterMutex_);
+        syncFilterId_ = *id;
+        return *id;
+    }
+
+    // The filter can also be passed inline, which we do until it was uploaded.
+    if (!uploadingSyncFilter_.exchange(true)) {
+        http::client()->upload_filter(
+          nlohmann::json::parse(definition),
+          [this, definition](const mtx::responses::FilterId &res, mtx::http::RequestErr err) {
+              if (err) {
+                  nhlog::net()->warn("failed to upload sync filter: {}", *err);
+                  uploadingSyncFilter_ = false;
+                  return;
+              }
+
+              try {
+                  cache::client()->saveSyncFilterId(definition, res.filter_id);
+              } catch (const lmdb::error &e) {
+                  nhlog::db()->warn("failed to save sync filter: {}", e.what());
+                  uploadingSyncFilter_ = false;
+              }
+          });
+    }
+
+    return definition;
+}
+
+void
+ChatPage::sync(const mtx::http::SyncOpts &opts,
+               std::function<void(const mtx::responses::Sync &,
+                                  const std::optional<mtx::http::ClientError> &)> callback)
+{
+    auto url = http::client()->server_url() + "/_matrix/client/v3/sync?timeout=" +
+               std::to_string(opts.timeout);
+    auto param = [&url](const char *name, const std::string &value) {
+        url += std::string("&") + name + "=" +
+               QUrl::toPercentEncoding(QString::fromStdString(value)).toStdString();
+    };
+    if (!opts.filter.empty())
+        param("filter", opts.filter);
+    if (!opts.since.empty())
+        param("since", opts.since);
+    if (opts.full_state)
+        param("full_state", "true");
+    if (opts.set_presence)
+        param("set_presence", mtx::presence::to_string(*opts.set_presence));
+
+    http::configure(*syncClient_);
+    syncClient_->get(
+      url,
+      [this, session = syncSession_.load(), callback = std::move(callback)](
+        const coeurl::Request &r) {
+          // the session ended or the connection was reset, while the request was running
+          if (session != syncSession_)
+              return;
+
+          mtx::http::ClientError err;
+          err.status_code = static_cast<int>(r.response_code());
+          err.error_code  = r.error_code();
+
+          if (r.error_code() != CURLE_OK) {
+              callback({}, err);
+              return;
+          }
+
+          nlohmann::json res;
+          try {
+              res = nlohmann::json::parse(r.response());
+          } catch (const nlohmann::json::exception &e) {
+              err.parse_error = e.what();
+              callback({}, err);
+              return;
+          }
+
+          if (r.response_code() >= 400) {
+              try {
+                  err.matrix_error = res.get<mtx::errors::Error>();
+              } catch (const nlohmann::json::exception &e) {
+                  err.parse_error = e.what();
+              }
+              callback({}, err);
+              return;
+          }
+
+          mtx::responses::Sync sync;
+          try {
+              sync = res.get<mtx::responses::Sync>();
+          } catch (const std::exception &e) {
+              err.parse_error = e.what();
+              callback({}, err);
+              return;
+          }
+
+          // saved before the state, which computes the member counts of the rooms
+          if (auto joined = res.find("rooms"); joined != res.end() && joined->contains("join")) {
+              std::lock_guard<std::mutex> lock(syncSessionMutex_);
+              // the cache may already be deleted
+              if (session != syncSession_)
+                  return;
+
+              try {
+                  cache::client()->saveRoomSummaries(joined->at("join"));
+              } catch (const lmdb::error &e) {
+                  nhlog::db()->warn("failed to save room summaries: {}", e.what());
+              }
+          }
+
+          callback(sync, std::nullopt);
+      },
+      {{"Authorization", "Bearer " + http::client()->access_token()}});
+}
+
+void
+ChatPage::stopSync()
+{
+    {
+        std::lock_guard<std::mutex> lock(syncSessionMutex_);
+        ++syncSession_;
+    }
+    syncClient_->shutdown();
+    slidingSync_->stop();
+}
+
+void
+ChatPage::loadMembers(const std::string &room_id,
+                      QObject *context,
+                      std::function<void(bool loaded)> callback)
+{
+    // queue behind running loads, so callbacks stay in order
+    try {
+        if (!pendingMemberLoads_.count(room_id) && cache::client()->membersFullyLoaded(room_id)) {
+            if (callback)
+                callback(true);
+            return;
+        }
+    } catch (const lmdb::error &e) {
+        nhlog::db()->warn("failed to check if the members of {} are loaded: {}", room_id, e.what());
+    }
+
+    auto &waiting = pendingMemberLoads_[room_id];
+    waiting.emplace_back(context, std::move(callback));
+    if (waiting.size() > 1)
+        return;
+
+    requestMembers(room_id, 0);
+}
+
+void
+ChatPage::requestMembers(const std::string &room_id, int attempt)
+{
+    std::string at;
+    try {
+        at = cache::nextBatchToken();
+    } catch (const lmdb::error &e) {
+        nhlog::db()->warn("failed to read the sync token: {}", e.what());
+    }
+
+    nhlog::net()->debug("loading members of {}", room_id);
+    http::client()->members(
+      room_id,
+      [this, room_id, at, attempt](const mtx::responses::Members &res, mtx::http::RequestErr err) {
+          bool loaded = false;
+          if (err) {
+              nhlog::net()->warn("failed to load members of {}: {}", room_id, *err);
+          } else {
+              try {
+                  loaded = cache::client()->saveMembers(room_id, res.chunk, at);
+                  if (!loaded && attempt < 3) {
+                      // don't overwrite what the newer sync saved, ask at its token instead
+                      requestMembers(room_id, attempt + 1);
+                      return;
+                  } else if (!loaded) {
+                      nhlog::net()->warn("members of {} changed during every request", room_id);
+                  }
+              } catch (const lmdb::error &e) {
+                  nhlog::db()->warn("failed to save members of {}: {}", room_id, e.what());
+              }
+          }
+
+          QTimer::singleShot(0, this, [this, room_id, loaded] {
+              auto node = pendingMemberLoads_.extract(room_id);
+              if (node.empty())
+                  return;
+
+              if (auto room = view_manager_->rooms()->getRoomById(QString::fromStdString(room_id)))
+                  emit room->roomMemberCountChanged();
+
+              for (const auto &[receiver, cb] : node.mapped())
+                  if (receiver && cb)
+                      cb(loaded);
+          });
+      },
+      at,
+      std::nullopt,
+      mtx::events::state::Membership::Leave);
+}
+
 void
 ChatPage::knockRoom(const QString &room,
                     const std::vector<std::string> &via,
@@ -1412,21 +1871,59 @@ ChatPage::decryptDownloadedSecrets(mtx::secret_storage::AesHmacSha2KeyDescriptio
 void
 ChatPage::startChat(QString userid, std::optional<bool> encryptionEnabled)
 {
-    auto joined_rooms = cache::joinedRooms();
-    auto room_infos   = cache::getRoomInfo(joined_rooms);
+    findDirectChat(userid, encryptionEnabled, DirectChatSearch::SharedRooms);
+}
 
-    for (const std::string &room_id : joined_rooms) {
+void
+ChatPage::findDirectChat(QString userid,
+                         std::optional<bool> encryptionEnabled,
+                         DirectChatSearch search)
+{
+    const auto user_id = userid.toStdString();
+    const auto candidates =
+      search == DirectChatSearch::SharedRooms ? cache::client()->sharedRooms(user_id)
+                                              : cache::joinedRooms();
+    auto room_infos = cache::getRoomInfo(candidates);
+
+    std::vector<std::string> unloaded;
+    for (const std::string &room_id : candidates) {
         if (const auto &info = room_infos[QString::fromStdString(room_id)];
-            info.member_count == 2 && !info.is_space) {
-            auto room_members = cache::roomMembers(room_id);
-            if (std::find(room_members.begin(), room_members.end(), (userid).toStdString()) !=
-                room_members.end()) {
-                view_manager_->rooms()->setCurrentRoom(QString::fromStdString(room_id));
-                return;
-            }
+            info.member_count != 2 || info.is_space)
+            continue;
+
+        auto room_members = cache::roomMembers(room_id);
+        if (std::find(room_members.begin(), room_members.end(), user_id) != room_members.end()) {
+            view_manager_->rooms()->setCurrentRoom(QString::fromStdString(room_id));
+            return;
+        }
+
+        try {
+            if (search != DirectChatSearch::Done && !cache::client()->membersFullyLoaded(room_id))
+                unloaded.push_back(room_id);
+        } catch (const lmdb::error &e) {
+            nhlog::db()->warn("failed to check if the members of {} are loaded: {}",
+                              room_id,
+                              e.what());
         }
     }
 
+    // With lazy loading the other member may not be cached yet. Load the members of the rooms
+    // that m.direct or the summary name first and of all other rooms with two members after.
+    auto next = search == DirectChatSearch::SharedRooms ? DirectChatSearch::AllRooms
+                                                        : DirectChatSearch::Done;
+    if (!unloaded.empty()) {
+        auto remaining = std::make_shared<size_t>(unloaded.size());
+        for (const auto &room_id : unloaded)
+            loadMembers(room_id, this, [this, remaining, userid, encryptionEnabled, next](bool) {
+                if (--*remaining == 0)
+                    findDirectChat(userid, encryptionEnabled, next);
+            });
+        return;
+    } else if (search == DirectChatSearch::SharedRooms) {
+        findDirectChat(userid, encryptionEnabled, next);
+        return;
+    }
+
     if (QMessageBox::Yes !=
         QMessageBox::question(
           nullptr,
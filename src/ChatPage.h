@@ -5,6 +5,10 @@
 #pragma once
 
 #include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <variant>
 
@@ -18,6 +22,7 @@
 
 #include <QMap>
 #include <QPoint>
+#include <QPointer>
 #include <QSharedPointer>
 #include <QTimer>
 
@@ -25,12 +30,21 @@
 #include "CacheStructs.h"
 #include "ui/RoomSummary.h"
 
+class SlidingSync;
 class TimelineViewManager;
+
+namespace coeurl {
+class Client;
+}
 class UserSettings;
 class NotificationsManager;
 class TimelineModel;
 class CallManager;
 
+namespace mtx::http {
+struct ClientError;
+struct SyncOpts;
+}
 namespace mtx::requests {
 struct CreateRoom;
 }
@@ -49,6 +63,7 @@ class ChatPage final : public QObject
 
 public:
     ChatPage(QSharedPointer<UserSettings> userSettings, QObject *parent = nullptr);
+    ~ChatPage() override;
 
     // Initialize all the components of the UI.
     void bootstrap(QString userid, QString homeserver, QString token);
@@ -72,6 +87,13 @@ public:
     //! Check if the given room is currently open.
     bool isRoomActive(const QString &room_id);
 
+    //! Run the callback once all members of the room are cached, fetching them first if the
+    //! sync only lazy loaded some. The callback is dropped, if the context is destroyed before.
+    //! It is passed false, if the members could not be loaded.
+    void loadMembers(const std::string &room_id,
+                     QObject *context,
+                     std::function<void(bool loaded)> callback);
+
     const std::unique_ptr<mtx::pushrules::PushRuleEvaluator> &pushruleEvaluator() const
     {
         return pushrules;
@@ -184,11 +206,38 @@ private slots:
     void handleSyncResponse(const mtx::responses::Sync &res, const std::string &prev_batch_token);
 
 private:
+    enum class DirectChatSearch
+    {
+        //! the rooms of the user index, m.direct and the summary heroes
+        SharedRooms,
+        //! all joined rooms with two members
+        AllRooms,
+        //! only check the rooms again, after their members were loaded
+        Done,
+    };
+    //! Open a joined room with two members, in which the user is a member, or offer to create
+    //! one.
+    void findDirectChat(QString userid,
+                        std::optional<bool> encryptionEnabled,
+                        DirectChatSearch search);
+
     static ChatPage *instance_;
 
     void startInitialSync();
+    void initialSyncCompleted(const mtx::responses::Sync &res);
     void tryInitialSync();
     void trySync();
+    //! Sliding sync is enabled and supported by the server.
+    bool useSlidingSync() const;
+    //! The id of the uploaded sync filter, or the filter itself until it was uploaded.
+    std::string syncFilter();
+    //! Request /sync. The response is parsed here instead of by mtxclient, which drops the room
+    //! summaries, so the member counts of lazy loaded rooms can be saved.
+    void sync(const mtx::http::SyncOpts &opts,
+              std::function<void(const mtx::responses::Sync &,
+                                 const std::optional<mtx::http::ClientError> &)> callback);
+    //! Cancel the running /sync and drop the responses, that are still on their way.
+    void stopSync();
     void verifyOneTimeKeyCountAfterStartup();
     void ensureOneTimeKeyCount(const std::map<std::string, uint16_t> &counts,
                                const std::optional<std::vector<std::string>> &fallback_keys);
@@ -200,7 +249,13 @@ private:
     using Membership  = mtx::events::StateEvent<mtx::events::state::Member>;
     using Memberships = std::map<std::string, Membership>;
 
+    //! Request the members of a room at the current sync token, asking again if a sync was saved
+    //! before the response.
+    void requestMembers(const std::string &room_id, int attempt);
+
     void loadStateFromCache();
+    //! Startup work that is not needed to show the rooms, run after they were painted once.
+    void runDeferredStartupTasks();
     void resetUI();
 
     template<class Collection>
@@ -213,14 +268,32 @@ private:
 
     QTimer connectivityTimer_;
     std::atomic_bool isConnected_;
+    bool deferredStartupPending_ = false;
+    std::atomic_bool uploadingSyncFilter_{false};
+    std::atomic_bool slidingSyncUnsupported_{false};
+    std::mutex syncFilterMutex_;
+    //! Looked up once, the cache is only read again until the filter was uploaded.
+    std::string syncFilterId_;
+    //! Incremented by stopSync, so a response of an earlier session is dropped.
+    std::atomic<uint64_t> syncSession_{0};
+    //! Held while a response is saved, so stopSync can't return in the middle of it.
+    std::mutex syncSessionMutex_;
+
+    //! Callbacks waiting for the members of a room, while /members is requested.
+    std::map<std::string, std::vector<std::pair<QPointer<QObject>, std::function<void(bool)>>>>
+      pendingMemberLoads_;
 
     // Global user settings.
     QSharedPointer<UserSettings> userSettings_;
 
+    SlidingSync *slidingSync_;
     NotificationsManager *notificationsManager;
     CallManager *callManager_;
 
     std::unique_ptr<mtx::pushrules::PushRuleEvaluator> pushrules;
+
+    //! Destroyed first, so no sync finishes while the other members are destroyed.
+    std::unique_ptr<coeurl::Client> syncClient_;
 };
 
 template<class Collection>
@@ -34,6 +34,7 @@
 #include "RoomDirectoryModel.h"
 #include "RoomsModel.h"
 #include "SingleImagePackModel.h"
+#include "StartupProfile.h"
 #include "TrayIcon.h"
 #include "UserDirectoryModel.h"
 #include "UserSettingsPage.h"
@@ -86,10 +87,16 @@ MainWindow::MainWindow(QWindow *parent)
     restoreWindowSize();
 
     chat_page_ = new ChatPage(userSettings_, this);
-    registerQmlTypes();
+    {
+        startupprofile::Scope profile("register qml types");
+        registerQmlTypes();
+    }
 
     setColor(Theme::paletteFromTheme(userSettings_->theme()).window().color());
-    setSource(QUrl(QStringLiteral("qrc:///qml/Root.qml")));
+    {
+        startupprofile::Scope profile("load qml");
+        setSource(QUrl(QStringLiteral("qrc:///qml/Root.qml")));
+    }
 
     trayIcon_ = new TrayIcon(QStringLiteral(":/logos/nheko.svg"), this);
 
@@ -109,6 +116,23 @@ MainWindow::MainWindow(QWindow *parent)
     dock_ = new Dock(this);
     connect(chat_page_, SIGNAL(unreadMessages(int)), dock_, SLOT(setUnreadCount(int)));
 
+    // Startup ends with the first frame of the login page or with the restored rooms.
+    startupWaitsForRooms_   = hasActiveUser();
+    startupFrameConnection_ = connect(this, &QQuickWindow::frameSwapped, this, [this] {
+        startupprofile::mark("first frame");
+        if (!startupWaitsForRooms_) {
+            startupprofile::finish();
+            disconnect(startupFrameConnection_);
+        }
+    });
+    connect(chat_page_, &ChatPage::contentLoaded, this, [this] {
+        startupprofile::mark("rooms restored");
+        startupWaitsForRooms_ = false;
+        if (!isVisible())
+            startupprofile::finish();
+    });
+    connect(chat_page_, &ChatPage::showLoginPage, this, [this] { startupWaitsForRooms_ = false; });
+
     // load cache on event loop
     QTimer::singleShot(0, this, [this] {
         if (hasActiveUser()) {
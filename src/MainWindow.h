@@ -113,6 +113,10 @@ private:
 
     QMultiHash<QString, QWindow *> roomWindows_;
 
+    //! Whether the startup profile should end with the restored rooms instead of the first frame.
+    bool startupWaitsForRooms_ = false;
+    QMetaObject::Connection startupFrameConnection_;
+
 #ifdef NHEKO_DBUS_SYS
     bool dbusAvailable_{false};
 #endif
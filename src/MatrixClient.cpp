@@ -13,8 +13,11 @@
 #include <QString>
 
 #include "nlohmann/json.hpp"
+#include <coeurl/client.hpp>
 #include <mtx/responses.hpp>
 
+#include "UserSettingsPage.h"
+
 Q_DECLARE_METATYPE(mtx::responses::Login)
 Q_DECLARE_METATYPE(mtx::responses::Messages)
 Q_DECLARE_METATYPE(mtx::responses::Notifications)
@@ -43,6 +46,14 @@ client()
     return client_.get();
 }
 
+void
+configure(coeurl::Client &raw)
+{
+    raw.set_verify_peer(!UserSettings::instance()->disableCertificateValidation());
+    // the same as mtxclient, the long polls themselves are limited by their timeout parameter
+    raw.connection_timeout(60);
+}
+
 bool
 is_logged_in()
 {
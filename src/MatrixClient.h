@@ -8,10 +8,20 @@
 
 #include "Logging.h"
 
+namespace coeurl {
+class Client;
+}
+
 namespace http {
 mtx::http::Client *
 client();
 
+//! Apply the certificate validation setting and the connection timeout used by client() to a
+//! client for the requests, whose responses mtxclient doesn't parse completely. Proxies are read
+//! from the environment by curl for both.
+void
+configure(coeurl::Client &raw);
+
 bool
 is_logged_in();
 
@@ -15,10 +15,7 @@
 MemberListBackend::MemberListBackend(const QString &room_id, QObject *parent)
   : QAbstractListModel{parent}
   , room_id_{room_id}
-  , powerLevels_{cache::client()
-                   ->getStateEvent<mtx::events::state::PowerLevels>(room_id_.toStdString())
-                   .value_or(mtx::events::StateEvent<mtx::events::state::PowerLevels>{})
-                   .content}
+  , powerLevels_{cache::client()->powerLevels(room_id_.toStdString())->content}
 {
     try {
         info_ = cache::singleRoomInfo(room_id_.toStdString());
@@ -26,14 +23,25 @@ MemberListBackend::MemberListBackend(const QString &room_id, QObject *parent)
         nhlog::db()->warn("failed to retrieve room info from cache: {}", room_id_.toStdString());
     }
 
-    try {
-        // HACK: due to QTBUG-1020169, we'll load a big chunk to speed things up
-        auto members = cache::getMembers(room_id_.toStdString(), 0, -1);
-        addUsers(members);
-        numUsersLoaded_ = (int)members.size();
-    } catch (const lmdb::error &e) {
-        nhlog::db()->critical("Failed to retrieve members from cache: {}", e.what());
-    }
+    // the sync only contains some of the members, show the spinner while the rest is fetched
+    loadingMoreMembers_ = true;
+    // show the members we have, if the rest could not be fetched
+    ChatPage::instance()->loadMembers(room_id_.toStdString(), this, [this](bool) {
+        try {
+            // HACK: due to QTBUG-1020169, we'll load a big chunk to speed things up
+            auto members = cache::getMembers(room_id_.toStdString(), 0, -1);
+            addUsers(members);
+            numUsersLoaded_    = (int)members.size();
+            info_.member_count = cache::client()->memberCount(room_id_.toStdString());
+        } catch (const lmdb::error &e) {
+            nhlog::db()->critical("Failed to retrieve members from cache: {}", e.what());
+        }
+
+        loadingMoreMembers_ = false;
+        emit memberCountChanged();
+        emit numUsersLoadedChanged();
+        emit loadingMoreMembersChanged();
+    });
 }
 
 void
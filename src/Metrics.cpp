@@ -0,0 +1,144 @@
+// SPDX-FileCopyrightText: Nheko Contributors
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "Metrics.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <QStringList>
+
+namespace {
+std::mutex registryMutex;
+std::map<std::string, std::unique_ptr<metrics::Counter>> counters;
+std::map<std::string, std::unique_ptr<metrics::Gauge>> gauges;
+std::map<std::string, std::unique_ptr<metrics::Histogram>> histograms;
+
+template<class T>
+T &
+lookup(std::map<std::string, std::unique_ptr<T>> &registry, const char *name)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    auto &metric = registry[name];
+    if (!metric)
+        metric = std::make_unique<T>();
+    return *metric;
+}
+
+QVariant
+toVariant(uint64_t value)
+{
+    return QVariant(static_cast<qulonglong>(value));
+}
+
+size_t
+bucketFor(uint64_t value)
+{
+    size_t bucket = 0;
+    while (value > 0) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+}
+
+namespace metrics {
+void
+Histogram::record(uint64_t value)
+{
+    buckets_[std::min(bucketFor(value), BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    auto max = max_.load(std::memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t
+Histogram::quantile(double q) const
+{
+    auto total = count();
+    if (total == 0)
+        return 0;
+
+    auto rank     = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return std::min(i == 0 ? 0 : (uint64_t{1} << i) - 1, max());
+    }
+    return max();
+}
+
+Counter &
+counter(const char *name)
+{
+    return lookup(counters, name);
+}
+
+Gauge &
+gauge(const char *name)
+{
+    return lookup(gauges, name);
+}
+
+Histogram &
+histogram(const char *name)
+{
+    return lookup(histograms, name);
+}
+
+QVariantMap
+snapshot()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    QVariantMap result;
+    for (const auto &[name, c] : counters)
+        result.insert(QString::fromStdString(name), toVariant(c->value()));
+    for (const auto &[name, g] : gauges)
+        result.insert(QString::fromStdString(name), QVariant(static_cast<qlonglong>(g->value())));
+    for (const auto &[name, h] : histograms) {
+        result.insert(QString::fromStdString(name),
+                      QVariantMap{
+                        {QStringLiteral("count"), toVariant(h->count())},
+                        {QStringLiteral("sum"), toVariant(h->sum())},
+                        {QStringLiteral("max"), toVariant(h->max())},
+                        {QStringLiteral("p50"), toVariant(h->quantile(0.5))},
+                        {QStringLiteral("p90"), toVariant(h->quantile(0.9))},
+                        {QStringLiteral("p99"), toVariant(h->quantile(0.99))},
+                      });
+    }
+    return result;
+}
+
+QString
+report()
+{
+    // the snapshot is sorted by name, which keeps related metrics together
+    QStringList lines;
+    const auto metrics = snapshot();
+    for (auto it = metrics.constBegin(); it != metrics.constEnd(); ++it) {
+        if (it.value().type() == QVariant::Map) {
+            auto h = it.value().toMap();
+            lines.append(QStringLiteral("%1: count %2, p50 %3, p90 %4, p99 %5, max %6")
+                           .arg(it.key(),
+                                h[QStringLiteral("count")].toString(),
+                                h[QStringLiteral("p50")].toString(),
+                                h[QStringLiteral("p90")].toString(),
+                                h[QStringLiteral("p99")].toString(),
+                                h[QStringLiteral("max")].toString()));
+        } else {
+            lines.append(QStringLiteral("%1: %2").arg(it.key(), it.value().toString()));
+        }
+    }
+    return lines.join('\n');
+}
+}
@@ -0,0 +1,102 @@
+// SPDX-FileCopyrightText: Nheko Contributors
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <QString>
+#include <QVariantMap>
+
+//! Process wide counters and histograms, to diagnose performance problems without rebuilding.
+//!
+//! Metrics are registered on first use and live until the process exits, so keep the returned
+//! reference in a static local: `static auto &saves = metrics::counter("db.saves");`
+//! Recording is lock free and can happen on any thread.
+namespace metrics {
+//! A count, that only increases.
+class Counter
+{
+public:
+    void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+//! A value that goes up and down, like the length of a queue.
+class Gauge
+{
+public:
+    void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+    void set(int64_t n) { value_.store(n, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+//! Distribution of values in power of two buckets.
+class Histogram
+{
+public:
+    void record(uint64_t value);
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    //! Upper bound of the bucket the quantile falls into, so at most twice the real value.
+    uint64_t quantile(double q) const;
+
+private:
+    static constexpr size_t BUCKETS = 40;
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+Counter &
+counter(const char *name);
+Gauge &
+gauge(const char *name);
+//! Histograms are named after the unit they record in, like `sync.save_ms`.
+Histogram &
+histogram(const char *name);
+
+//! All metrics by name. Histograms are maps of count, sum, max, p50, p90 and p99.
+QVariantMap
+snapshot();
+//! All metrics as readable text, one per line.
+QString
+report();
+
+//! Records the lifetime of the object in milliseconds.
+class Timer
+{
+public:
+    explicit Timer(Histogram &histogram)
+      : histogram_(histogram)
+      , start_(std::chrono::steady_clock::now())
+    {
+    }
+    ~Timer()
+    {
+        histogram_.record(std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - start_)
+                            .count());
+    }
+
+    Timer(const Timer &)            = delete;
+    Timer &operator=(const Timer &) = delete;
+
+private:
+    Histogram &histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+}
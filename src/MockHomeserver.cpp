@@ -0,0 +1,460 @@
+// SPDX-FileCopyrightText: Nheko Contributors
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "MockHomeserver.h"
+
+#include <QBuffer>
+#include <QImage>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+
+#include "httplib.h"
+
+#include "Logging.h"
+#include "SyncReplay.h"
+
+namespace {
+// Matches the ids used by syncreplay::generate.
+std::string
+userId(int i)
+{
+    return "@user" + std::to_string(i) + ":replay.invalid";
+}
+
+std::string
+roomId(int i)
+{
+    return "!room" + std::to_string(i) + ":replay.invalid";
+}
+
+int
+roomNumber(const std::string &id)
+{
+    static const std::regex re("!room(\\d+):");
+    std::smatch m;
+    if (std::regex_search(id, m, re))
+        return std::stoi(m[1]);
+    return -1;
+}
+
+std::string
+error(const std::string &errcode, const std::string &msg)
+{
+    return nlohmann::json{{"errcode", errcode}, {"error", msg}}.dump();
+}
+
+nlohmann::json
+textMessage(const std::string &eventId, int sender, uint64_t ts)
+{
+    return {
+      {"type", "m.room.message"},
+      {"event_id", eventId},
+      {"sender", userId(sender)},
+      {"origin_server_ts", ts},
+      {"content", {{"msgtype", "m.text"}, {"body", "Message " + eventId}}},
+    };
+}
+
+uint64_t
+now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+}
+
+MockHomeserver::Options
+MockHomeserver::parseOptions(const QString &spec, bool *ok)
+{
+    Options options;
+    bool valid = true;
+
+    for (const auto &entry : spec.split(',', Qt::SkipEmptyParts)) {
+        auto kv    = entry.split('=');
+        bool isInt = false;
+        int value  = kv.size() == 2 ? kv[1].toInt(&isInt) : 0;
+        if (!isInt || value < 0) {
+            valid = false;
+            continue;
+        }
+
+        if (kv[0] == QLatin1String("port"))
+            options.port = value;
+        else if (kv[0] == QLatin1String("rooms"))
+            options.rooms = std::max(value, 1);
+        else if (kv[0] == QLatin1String("members"))
+            options.members = std::max(value, 1);
+        else if (kv[0] == QLatin1String("history"))
+            options.history = value;
+        else if (kv[0] == QLatin1String("latency"))
+            options.latency = value;
+        else if (kv[0] == QLatin1String("bandwidth"))
+            options.bandwidth = value;
+        else if (kv[0] == QLatin1String("interval"))
+            options.messageInterval = std::max(value, 1);
+        else
+            valid = false;
+    }
+
+    if (ok)
+        *ok = valid;
+    return options;
+}
+
+MockHomeserver::MockHomeserver(Options options)
+  : options_(options)
+  , svr(std::make_unique<httplib::Server>())
+{
+    initialSync_ =
+      syncreplay::generate(options_.rooms, options_.members, 0, false).front().dump();
+    slidingRooms_ = nlohmann::json::parse(initialSync_)["rooms"]["join"];
+
+    using namespace httplib;
+
+    svr->set_logger([](const Request &req, const Response &res) {
+        nhlog::net()->info(
+          "{} {}: {}, {} bytes", req.method, req.path, res.status, res.body.size());
+    });
+    svr->set_error_handler([this](const Request &, Response &res) {
+        if (res.body.empty())
+            respond(res, error("M_UNRECOGNIZED", "Unrecognized request"));
+    });
+
+    // Both the r0 and the v3 endpoints, depending on the client.
+#define CLIENT "/_matrix/client/(?:r0|v3)"
+#define MEDIA "/_matrix/media/(?:r0|v3)"
+
+    svr->Get("/_matrix/client/versions", [this](const Request &, Response &res) {
+        respond(res,
+                R"({"versions":["r0.6.1","v1.1","v1.2","v1.3","v1.4","v1.5"],)"
+                R"("unstable_features":{"org.matrix.simplified_msc3575":true}})");
+    });
+    svr->Get(CLIENT "/login", [this](const Request &, Response &res) {
+        respond(res, R"({"flows":[{"type":"m.login.password"}]})");
+    });
+    svr->Post(CLIENT "/login", [this](const Request &, Response &res) {
+        respond(res,
+                nlohmann::json{
+                  {"user_id", userId(0)},
+                  {"access_token", "mock_access_token"},
+                  {"device_id", "MOCKDEVICE"},
+                }
+                  .dump());
+    });
+    svr->Post(CLIENT "/logout", [this](const Request &, Response &res) { respond(res, "{}"); });
+    svr->Get(CLIENT "/capabilities",
+            [this](const Request &, Response &res) { respond(res, R"({"capabilities":{}})"); });
+    svr->Post(CLIENT "/user/[^/]+/filter",
+             [this](const Request &, Response &res) { respond(res, R"({"filter_id":"1"})"); });
+    svr->Get(CLIENT "/pushrules/",
+            [this](const Request &, Response &res) { respond(res, R"({"global":{}})"); });
+    svr->Get(CLIENT "/profile/([^/]+)", [this](const Request &req, Response &res) {
+        respond(res, nlohmann::json{{"displayname", req.matches[1].str()}}.dump());
+    });
+
+    svr->Post(CLIENT "/keys/upload", [this](const Request &, Response &res) {
+        respond(res, R"({"one_time_key_counts":{"signed_curve25519":50}})");
+    });
+    svr->Post(CLIENT "/keys/query", [this](const Request &, Response &res) {
+        respond(res, R"({"device_keys":{},"failures":{}})");
+    });
+
+    svr->Get(CLIENT "/sync",
+            [this](const Request &req, Response &res) { respond(res, sync(req)); });
+    svr->Post("/_matrix/client/unstable/org.matrix.simplified_msc3575/sync",
+             [this](const Request &req, Response &res) { slidingSync(req, res); });
+    svr->Get(CLIENT "/rooms/([^/]+)/messages",
+            [this](const Request &req, Response &res) { messages(req, res); });
+    svr->Put(CLIENT "/rooms/[^/]+/send/[^/]+/[^/]+", [this](const Request &, Response &res) {
+        respond(
+          res,
+          nlohmann::json{{"event_id", "$mock" + std::to_string(++nextEvent_) + ":replay.invalid"}}
+            .dump());
+    });
+    svr->Post(CLIENT "/rooms/[^/]+/(?:receipt/.*|read_markers)",
+             [this](const Request &, Response &res) { respond(res, "{}"); });
+    svr->Put(CLIENT "/rooms/[^/]+/typing/.*",
+            [this](const Request &, Response &res) { respond(res, "{}"); });
+
+    // key backup with one undecryptable session per room
+    svr->Get(CLIENT "/room_keys/version", [this](const Request &, Response &res) {
+        respond(res,
+                nlohmann::json{
+                  {"algorithm", "m.megolm_backup.v1.curve25519-aes-sha2"},
+                  {"auth_data", {{"public_key", "mockpublickey"}, {"signatures", {}}}},
+                  {"count", options_.rooms},
+                  {"etag", "1"},
+                  {"version", "1"},
+                }
+                  .dump());
+    });
+    svr->Get(CLIENT "/room_keys/keys(?:/([^/]+)/([^/]+))?",
+            [this](const Request &req, Response &res) { roomKeys(req, res); });
+
+    svr->Get(MEDIA "/(download|thumbnail)/[^/]+/[^/]+", [this](const Request &req, Response &res) {
+        int width = 800, height = 600;
+        if (req.matches[1] == "thumbnail") {
+            width  = std::clamp(std::atoi(req.get_param_value("width").c_str()), 1, 800);
+            height = std::clamp(std::atoi(req.get_param_value("height").c_str()), 1, 600);
+        }
+        respond(res, media(width, height), "image/png");
+    });
+
+#undef CLIENT
+#undef MEDIA
+}
+
+void
+MockHomeserver::respond(httplib::Response &res, std::string body, const char *contentType) const
+{
+    auto delay = std::chrono::milliseconds(options_.latency);
+    if (options_.bandwidth > 0)
+        delay += std::chrono::milliseconds(body.size() * 1000 / options_.bandwidth);
+    if (delay.count() > 0)
+        std::this_thread::sleep_for(delay);
+
+    res.set_content(body, contentType);
+}
+
+std::string
+MockHomeserver::sync(const httplib::Request &req)
+{
+    if (!req.has_param("since"))
+        return initialSync_;
+
+    // long poll until the next message arrives or the client gives up
+    auto timeout = std::atoi(req.get_param_value("timeout").c_str());
+    if (timeout <= 0)
+        return nlohmann::json{{"next_batch", req.get_param_value("since")}}.dump();
+    std::this_thread::sleep_for(
+      std::chrono::milliseconds(std::min(timeout, options_.messageInterval)));
+
+    auto n       = ++nextEvent_;
+    int r        = static_cast<int>(n % options_.rooms);
+    auto ts      = now();
+    auto eventId = "$mock" + std::to_string(n) + ":replay.invalid";
+
+    nlohmann::json sync = {{"next_batch", "s" + std::to_string(n)}};
+    auto &room          = sync["rooms"]["join"][roomId(r)];
+    room["timeline"]    = {
+      {"limited", false},
+      {"events", {textMessage(eventId, static_cast<int>(n % options_.members), ts)}},
+    };
+    room["unread_notifications"] = {{"notification_count", 1}, {"highlight_count", 0}};
+    return sync.dump();
+}
+
+void
+MockHomeserver::slidingSync(const httplib::Request &req, httplib::Response &res)
+{
+    nlohmann::json body;
+    try {
+        body = nlohmann::json::parse(req.body);
+    } catch (const nlohmann::json::exception &e) {
+        res.status = 400;
+        respond(res, error("M_NOT_JSON", e.what()));
+        return;
+    }
+
+    // the requested window and the subscribed rooms
+    std::set<int> requested;
+    if (auto ranges = body.value(nlohmann::json::json_pointer("/lists/rooms/ranges"),
+                                 nlohmann::json::array());
+        ranges.is_array()) {
+        for (const auto &range : ranges) {
+            if (!range.is_array() || range.size() != 2)
+                continue;
+            int end = std::min(range[1].get<int>(), options_.rooms - 1);
+            for (int r = std::max(range[0].get<int>(), 0); r <= end; r++)
+                requested.insert(r);
+        }
+    }
+    for (const auto &el : body.value("room_subscriptions", nlohmann::json::object()).items())
+        if (auto r = roomNumber(el.key()); r >= 0 && r < options_.rooms)
+            requested.insert(r);
+
+    auto n = nextEvent_.load();
+
+    nlohmann::json response = {
+      {"lists", {{"rooms", {{"count", options_.rooms}}}}},
+      {"rooms", nlohmann::json::object()},
+      {"extensions", {{"to_device", {{"next_batch", "t0"}, {"events", nlohmann::json::array()}}}}},
+    };
+
+    bool initial = false;
+    {
+        std::lock_guard<std::mutex> lock(slidingMutex_);
+        if (!req.has_param("pos"))
+            slidingSent_.clear();
+
+        for (int r : requested) {
+            if (!slidingSent_.insert(r).second)
+                continue;
+
+            const auto &room = slidingRooms_[roomId(r)];
+
+            response["rooms"][roomId(r)] = {
+              {"initial", true},
+              {"required_state", room["state"]["events"]},
+              {"timeline", room["timeline"]["events"]},
+              {"limited", room["timeline"].value("limited", false)},
+              {"prev_batch", room["timeline"].value("prev_batch", "")},
+            };
+            initial = true;
+        }
+    }
+
+    // long poll for the next message, unless there are new rooms to send
+    auto timeout = std::atoi(req.get_param_value("timeout").c_str());
+    if (!initial && timeout > 0) {
+        std::this_thread::sleep_for(
+          std::chrono::milliseconds(std::min(timeout, options_.messageInterval)));
+
+        n       = ++nextEvent_;
+        int r   = static_cast<int>(n % options_.rooms);
+        auto id = "$mock" + std::to_string(n) + ":replay.invalid";
+
+        std::lock_guard<std::mutex> lock(slidingMutex_);
+        if (slidingSent_.count(r))
+            response["rooms"][roomId(r)] = {
+              {"timeline", {textMessage(id, static_cast<int>(n % options_.members), now())}},
+              {"notification_count", 1},
+            };
+    }
+
+    response["pos"] = "p" + std::to_string(n);
+    respond(res, response.dump());
+}
+
+void
+MockHomeserver::messages(const httplib::Request &req, httplib::Response &res) const
+{
+    auto r = roomNumber(req.matches[1].str());
+    if (r < 0 || r >= options_.rooms) {
+        res.status = 403;
+        respond(res, error("M_FORBIDDEN", "Not in that room"));
+        return;
+    }
+
+    // tokens are either the prev_batch of the initial sync or h<room>_<offset>
+    int offset = 0;
+    auto from  = req.get_param_value("from");
+    if (from.size() > 1 && from[0] == 'h') {
+        auto sep = from.find('_');
+        if (sep != std::string::npos)
+            offset = std::atoi(from.c_str() + sep + 1);
+    }
+    int limit = 10;
+    if (req.has_param("limit"))
+        limit = std::clamp(std::atoi(req.get_param_value("limit").c_str()), 1, 1000);
+
+    nlohmann::json chunk = nlohmann::json::array();
+    int end              = std::min(offset + limit, options_.history);
+    for (int i = offset; i < end; i++)
+        chunk.push_back(
+          textMessage("$history" + std::to_string(r) + "_" + std::to_string(i) + ":replay.invalid",
+                      i % options_.members,
+                      1600000000000 - static_cast<uint64_t>(i) * 60000));
+
+    nlohmann::json response = {{"start", from}, {"chunk", std::move(chunk)}};
+    if (end < options_.history)
+        response["end"] = "h" + std::to_string(r) + "_" + std::to_string(end);
+    respond(res, response.dump());
+}
+
+void
+MockHomeserver::roomKeys(const httplib::Request &req, httplib::Response &res) const
+{
+    auto session = [](int r) {
+        return nlohmann::json{
+          {"first_message_index", 0},
+          {"forwarded_count", 0},
+          {"is_verified", false},
+          {"session_data",
+           {{"ciphertext", std::string(344, 'A')},
+            {"ephemeral", "mockephemeral" + std::to_string(r)},
+            {"mac", "mockmac"}}},
+        };
+    };
+
+    if (req.matches[1].matched) {
+        auto r = roomNumber(req.matches[1].str());
+        if (r < 0 || r >= options_.rooms) {
+            res.status = 404;
+            respond(res, error("M_NOT_FOUND", "No backup for that session"));
+        } else {
+            respond(res, session(r).dump());
+        }
+        return;
+    }
+
+    nlohmann::json keys = {{"rooms", nlohmann::json::object()}};
+    for (int r = 0; r < options_.rooms; r++)
+        keys["rooms"][roomId(r)]["sessions"]["mocksession" + std::to_string(r)] = session(r);
+    respond(res, keys.dump());
+}
+
+std::string
+MockHomeserver::media(int width, int height)
+{
+    std::lock_guard<std::mutex> lock(mediaMutex_);
+    auto &data = mediaCache_[{width, height}];
+    if (!data.empty())
+        return data;
+
+    // noise, so the image does not compress to nothing and bandwidth limits stay meaningful
+    QImage img(width, height, QImage::Format_RGB32);
+    std::minstd_rand rng(static_cast<unsigned>(width * 4099 + height));
+    for (int y = 0; y < height; y++) {
+        auto line = reinterpret_cast<QRgb *>(img.scanLine(y));
+        for (int x = 0; x < width; x++)
+            line[x] = static_cast<QRgb>(rng()) | 0xff000000;
+    }
+
+    QByteArray bytes;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::WriteOnly);
+    img.save(&buffer, "PNG");
+
+    data = bytes.toStdString();
+    return data;
+}
+
+MockHomeserver::~MockHomeserver() = default;
+
+bool
+MockHomeserver::listen()
+{
+    return svr->listen("localhost", options_.port);
+}
+
+int
+MockHomeserver::run(const QString &spec)
+{
+    bool ok      = false;
+    auto options = parseOptions(spec, &ok);
+    if (!ok) {
+        std::cerr << "Expected a comma separated list of port, rooms, members, history, latency, "
+                     "bandwidth and interval, for example port=8008,rooms=100,latency=50"
+                  << std::endl;
+        return 1;
+    }
+
+    MockHomeserver server(options);
+    std::cout << "Serving " << options.rooms << " rooms on http://localhost:" << options.port
+              << ", log in as " << userId(0) << " with any password" << std::endl;
+    if (!server.listen()) {
+        std::cerr << "Failed to listen on port " << options.port << std::endl;
+        return 1;
+    }
+    return 0;
+}
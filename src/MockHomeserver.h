@@ -0,0 +1,82 @@
+// SPDX-FileCopyrightText: Nheko Contributors
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <QString>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+namespace httplib {
+class Server;
+struct Request;
+struct Response;
+}
+
+//! A stand-in for a Matrix homeserver, serving synthetic rooms, timelines, media and key backups
+//! with configurable latency and bandwidth, so the network paths can be load tested without a
+//! real server. It only serves; the client side is measured by logging into it with a separate
+//! profile.
+class MockHomeserver
+{
+public:
+    struct Options
+    {
+        int port    = 8008;
+        int rooms   = 100;
+        int members = 10;
+        //! Events available to back pagination per room.
+        int history = 1000;
+        //! Added to every response in milliseconds.
+        int latency = 0;
+        //! Bytes per second the responses are throttled to, 0 for unlimited.
+        int bandwidth = 0;
+        //! Milliseconds between new messages arriving in /sync.
+        int messageInterval = 5000;
+    };
+
+    //! Parse a comma separated list like `port=8008,rooms=100,latency=50`.
+    static Options parseOptions(const QString &spec, bool *ok = nullptr);
+
+    MockHomeserver(Options options);
+    ~MockHomeserver();
+
+    //! Serve requests until the process is terminated.
+    bool listen();
+
+    //! Run the mock homeserver from the command line. Returns the exit code for the application.
+    static int run(const QString &spec);
+
+private:
+    void respond(httplib::Response &res,
+                 std::string body,
+                 const char *contentType = "application/json") const;
+    std::string sync(const httplib::Request &req);
+    void slidingSync(const httplib::Request &req, httplib::Response &res);
+    void messages(const httplib::Request &req, httplib::Response &res) const;
+    void roomKeys(const httplib::Request &req, httplib::Response &res) const;
+    std::string media(int width, int height);
+
+    Options options_;
+    std::unique_ptr<httplib::Server> svr;
+
+    std::string initialSync_;
+    std::atomic<uint64_t> nextEvent_{0};
+
+    //! The joined rooms of the initial sync, which sliding sync sends on request.
+    nlohmann::json slidingRooms_;
+    std::mutex slidingMutex_;
+    //! Rooms already sent on the sliding sync connection.
+    std::set<int> slidingSent_;
+
+    std::mutex mediaMutex_;
+    std::map<std::pair<int, int>, std::string> mediaCache_;
+};
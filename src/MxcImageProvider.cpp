@@ -20,6 +20,7 @@
 
 #include "Logging.h"
 #include "MatrixClient.h"
+#include "Metrics.h"
 #include "Utils.h"
 
 QHash<QString, mtx::crypto::EncryptedFile> infos;
@@ -90,6 +91,12 @@ MxcImageProvider::requestImageResponse(const QString &id, const QSize &requested
     return new MxcImageResponse(id_, crop, radius, size);
 }
 
+bool
+MxcImageProvider::isEncrypted(const QString &mxcUrl)
+{
+    return infos.contains(mxcUrl);
+}
+
 void
 MxcImageProvider::addEncryptionInfo(mtx::crypto::EncryptedFile info)
 {
@@ -163,6 +170,10 @@ MxcImageProvider::download(const QString &id,
         return;
     }
 
+    static auto &cacheHits       = metrics::counter("media.cache_hits");
+    static auto &cacheMisses     = metrics::counter("media.cache_misses");
+    static auto &downloadedBytes = metrics::counter("media.downloaded_bytes");
+
     bool cropLocally = false;
     if (crop && requestedSize.width() > 96) {
         crop        = false;
@@ -216,12 +227,14 @@ MxcImageProvider::download(const QString &id,
                 }
 
                 if (!image.isNull()) {
+                    cacheHits.add();
                     then(id, requestedSize, image, fileInfo.absoluteFilePath());
                     return;
                 }
             }
         }
 
+        cacheMisses.add();
         mtx::http::ThumbOpts opts;
         opts.mxc_url = "mxc://" + id.toStdString();
         opts.width = static_cast<uint16_t>(requestedSize.width() > 0 ? requestedSize.width() : -1);
@@ -236,6 +249,7 @@ MxcImageProvider::download(const QString &id,
                   download(id, QSize(), then, crop, radius);
                   return;
               }
+              downloadedBytes.add(res.size());
 
               auto data    = QByteArray(res.data(), (int)res.size());
               QImage image = utils::readImage(data);
@@ -300,6 +314,7 @@ MxcImageProvider::download(const QString &id,
                             image = clipRadius(std::move(image), radius);
                         }
 
+                        cacheHits.add();
                         then(id, requestedSize, image, fileInfo.absoluteFilePath());
                         return;
                     }
@@ -311,12 +326,14 @@ MxcImageProvider::download(const QString &id,
                             image = clipRadius(std::move(image), radius);
                         }
 
+                        cacheHits.add();
                         then(id, requestedSize, image, fileInfo.absoluteFilePath());
                         return;
                     }
                 }
             }
 
+            cacheMisses.add();
             http::client()->download(
               "mxc://" + id.toStdString(),
               [fileInfo, requestedSize, then, id, radius, encryptionInfo](
@@ -330,6 +347,7 @@ MxcImageProvider::download(const QString &id,
                       return;
                   }
 
+                  downloadedBytes.add(res.size());
                   auto tempData = res;
                   QFile f(fileInfo.absoluteFilePath());
                   if (!f.open(QIODevice::Truncate | QIODevice::WriteOnly)) {
@@ -83,6 +83,9 @@ class MxcImageProvider
 public:
     MxcImageProvider(QObject *parent = nullptr);
 
+    //! Whether the media is encrypted, in which case the cached file is ciphertext.
+    static bool isEncrypted(const QString &mxcUrl);
+
 public slots:
     QQuickImageResponse *
     requestImageResponse(const QString &id, const QSize &requestedSize) override;
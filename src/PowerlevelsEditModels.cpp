@@ -565,10 +565,7 @@ PowerlevelsUserListModel::moveRows(const QModelIndex &,
 
 PowerlevelEditingModels::PowerlevelEditingModels(QString room_id, QObject *parent)
   : QObject(parent)
-  , powerLevels_(cache::client()
-                   ->getStateEvent<mtx::events::state::PowerLevels>(room_id.toStdString())
-                   .value_or(mtx::events::StateEvent<mtx::events::state::PowerLevels>{})
-                   .content)
+  , powerLevels_(cache::client()->powerLevels(room_id.toStdString())->content)
   , types_(room_id.toStdString(), powerLevels_, this)
   , users_(room_id.toStdString(), powerLevels_, this)
   , spaces_(room_id.toStdString(), powerLevels_, this)
@@ -694,10 +691,7 @@ PowerlevelsSpacesListModel::PowerlevelsSpacesListModel(const std::string &room_i
               cache::client()->getStateEvent<mtx::events::state::space::Parent>(s, space);
             if (parent && parent->content.via && !parent->content.via->empty() &&
                 parent->content.canonical) {
-                auto parentPl = cache::client()->getStateEvent<mtx::events::state::PowerLevels>(s);
-
-                spaces.push_back(Entry{
-                  s, parentPl ? parentPl->content : mtx::events::state::PowerLevels{}, false});
+                spaces.push_back(Entry{s, cache::client()->powerLevels(s)->content, false});
                 addChildren(s);
             }
         }
@@ -5,16 +5,42 @@
 #include "RoomDirectoryModel.h"
 
 #include <algorithm>
+#include <set>
 
 #include "Cache.h"
 #include "ChatPage.h"
 #include "Logging.h"
 #include "MatrixClient.h"
 
+namespace {
+//! Wait this long for the search term and server to stop changing, before asking the server.
+constexpr int SEARCH_DELAY = 250;
+
+bool
+matches(const mtx::responses::PublicRoomsChunk &room, const QString &term)
+{
+    if (QString::fromStdString(room.name).contains(term, Qt::CaseInsensitive) ||
+        QString::fromStdString(room.topic).contains(term, Qt::CaseInsensitive) ||
+        QString::fromStdString(room.room_id).contains(term, Qt::CaseInsensitive))
+        return true;
+
+    for (const auto &alias : room.aliases)
+        if (QString::fromStdString(alias).contains(term, Qt::CaseInsensitive))
+            return true;
+    return false;
+}
+}
+
 RoomDirectoryModel::RoomDirectoryModel(QObject *parent, const std::string &server)
   : QAbstractListModel(parent)
   , server_(server)
 {
+    searchTimer_.setSingleShot(true);
+    searchTimer_.setInterval(SEARCH_DELAY);
+    connect(&searchTimer_, &QTimer::timeout, this, [this] { fetchMore({}); });
+
+    connect(ChatPage::instance(), &ChatPage::loggedOut, this, [this] { cache_.clear(); });
+
     connect(ChatPage::instance(), &ChatPage::newRoom, this, [this](const QString &roomid) {
         auto roomid_ = roomid.toStdString();
 
@@ -46,6 +72,18 @@ RoomDirectoryModel::roleNames() const
 void
 RoomDirectoryModel::resetDisplayedData()
 {
+    bool cached = cache_.find({server_, userSearchString_, ""}) != nullptr;
+    // start waiting before the view can ask for rooms
+    if (cached)
+        searchTimer_.stop();
+    else
+        searchTimer_.start();
+
+    if (loadingMoreRooms_) {
+        loadingMoreRooms_ = false;
+        emit loadingMoreRoomsChanged();
+    }
+
     beginResetModel();
 
     prevBatch_    = "";
@@ -53,8 +91,46 @@ RoomDirectoryModel::resetDisplayedData()
     canFetchMore_ = true;
 
     publicRoomsData_.clear();
+    if (!cached)
+        publicRoomsData_ = locallyFilteredRooms();
+    showsLocalResults_ = !publicRoomsData_.empty();
 
     endResetModel();
+
+    if (cached)
+        fetchMore({});
+}
+
+std::vector<mtx::responses::PublicRoomsChunk>
+RoomDirectoryModel::locallyFilteredRooms() const
+{
+    if (userSearchString_.empty())
+        return {};
+
+    // the rooms of the longest earlier search term, that the current one starts with
+    const std::string *best = nullptr;
+    for (const auto &entry : cache_.pages()) {
+        const auto &term = std::get<1>(entry.first);
+        if (std::get<0>(entry.first) == server_ &&
+            userSearchString_.compare(0, term.size(), term) == 0 &&
+            (!best || term.size() > best->size()))
+            best = &term;
+    }
+    if (!best)
+        return {};
+
+    auto term = QString::fromStdString(userSearchString_);
+    std::vector<mtx::responses::PublicRoomsChunk> rooms;
+    std::set<std::string> seen;
+    for (const auto &[key, page] : cache_.pages()) {
+        if (std::get<0>(key) != server_ || std::get<1>(key) != *best)
+            continue;
+
+        for (const auto &room : page.chunk)
+            if (matches(room, term) && seen.insert(room.room_id).second)
+                rooms.push_back(room);
+    }
+    return rooms;
 }
 
 void
@@ -147,6 +223,30 @@ RoomDirectoryModel::fetchMore(const QModelIndex &)
     if (!canFetchMore_)
         return;
 
+    if (auto page = cache_.find({server_, userSearchString_, prevBatch_})) {
+        appendRooms(*page);
+        return;
+    }
+
+    reachedEndOfPagination_ = false;
+    emit reachedEndOfPaginationChanged();
+
+    if (!loadingMoreRooms_) {
+        loadingMoreRooms_ = true;
+        emit loadingMoreRoomsChanged();
+    }
+
+    // otherwise the timer sends it, when the search term stopped changing
+    if (!searchTimer_.isActive())
+        sendRequest();
+}
+
+void
+RoomDirectoryModel::sendRequest()
+{
+    if (!canFetchMore_ || !loadingMoreRooms_ || requestRunning_)
+        return;
+
     nhlog::net()->debug("Fetching more rooms from mtxclient...");
 
     mtx::requests::PublicRooms req;
@@ -156,17 +256,30 @@ RoomDirectoryModel::fetchMore(const QModelIndex &)
     // req.third_party_instance_id = third_party_instance_id;
     auto requested_server = server_;
 
-    reachedEndOfPagination_ = false;
-    emit reachedEndOfPaginationChanged();
-
-    loadingMoreRooms_ = true;
-    emit loadingMoreRoomsChanged();
+    requestRunning_ = true;
 
     auto job = QSharedPointer<FetchRoomsChunkFromDirectoryJob>::create();
     connect(job.data(),
             &FetchRoomsChunkFromDirectoryJob::fetchedRoomsBatch,
             this,
             &RoomDirectoryModel::displayRooms);
+    connect(job.data(),
+            &FetchRoomsChunkFromDirectoryJob::fetchFailed,
+            this,
+            [this](const std::string &search_term,
+                   const std::string &server,
+                   const std::string &since) {
+                requestRunning_ = false;
+                if (search_term != userSearchString_ || since != prevBatch_ ||
+                    server != server_) {
+                    if (!searchTimer_.isActive())
+                        sendRequest();
+                } else if (loadingMoreRooms_) {
+                    // don't retry until the view asks again
+                    loadingMoreRooms_ = false;
+                    emit loadingMoreRoomsChanged();
+                }
+            });
 
     http::client()->post_public_rooms(
       req,
@@ -177,6 +290,7 @@ RoomDirectoryModel::fetchMore(const QModelIndex &)
                                   mtx::errors::to_string(err->matrix_error.errcode),
                                   err->matrix_error.error,
                                   err->parse_error);
+              emit job->fetchFailed(req.filter.generic_search_term, requested_server, req.since);
           } else {
               nhlog::net()->debug("signalling chunk to GUI thread");
               emit job->fetchedRoomsBatch(res.chunk,
@@ -196,35 +310,60 @@ RoomDirectoryModel::displayRooms(std::vector<mtx::responses::PublicRoomsChunk> f
                                  const std::string &server,
                                  const std::string &since)
 {
+    requestRunning_ = false;
+
+    mtx::responses::PublicRooms page;
+    page.chunk      = std::move(fetched_rooms);
+    page.next_batch = next_batch;
+    cache_.insert({server, search_term, since}, page);
+
     if (search_term != this->userSearchString_ || since != this->prevBatch_ ||
         server != this->server_) {
+        // request the page, that is wanted now
+        if (!searchTimer_.isActive())
+            sendRequest();
         return;
     }
 
-    loadingMoreRooms_ = false;
-    emit loadingMoreRoomsChanged();
+    appendRooms(page);
+}
 
-    nhlog::net()->debug("Prev batch: {} | Next batch: {}", prevBatch_, next_batch);
+void
+RoomDirectoryModel::appendRooms(const mtx::responses::PublicRooms &page)
+{
+    if (loadingMoreRooms_) {
+        loadingMoreRooms_ = false;
+        emit loadingMoreRoomsChanged();
+    }
 
-    if (fetched_rooms.empty()) {
-        nhlog::net()->error("mtxclient helper thread yielded empty chunk!");
-        return;
+    nhlog::net()->debug("Prev batch: {} | Next batch: {}", prevBatch_, page.next_batch);
+
+    if (showsLocalResults_) {
+        beginResetModel();
+        publicRoomsData_.clear();
+        showsLocalResults_ = false;
+        endResetModel();
     }
 
-    beginInsertRows(QModelIndex(),
-                    static_cast<int>(publicRoomsData_.size()),
-                    static_cast<int>(publicRoomsData_.size() + fetched_rooms.size()) - 1);
-    this->publicRoomsData_.insert(
-      this->publicRoomsData_.end(), fetched_rooms.begin(), fetched_rooms.end());
-    endInsertRows();
+    if (page.chunk.empty()) {
+        nhlog::net()->error("mtxclient helper thread yielded empty chunk!");
+    } else {
+        beginInsertRows(QModelIndex(),
+                        static_cast<int>(publicRoomsData_.size()),
+                        static_cast<int>(publicRoomsData_.size() + page.chunk.size()) - 1);
+        this->publicRoomsData_.insert(
+          this->publicRoomsData_.end(), page.chunk.begin(), page.chunk.end());
+        endInsertRows();
+    }
 
-    if (next_batch.empty()) {
+    // an empty chunk would otherwise be requested again and again
+    if (page.next_batch.empty() || page.chunk.empty()) {
         canFetchMore_           = false;
         reachedEndOfPagination_ = true;
         emit reachedEndOfPaginationChanged();
     }
 
-    prevBatch_ = next_batch;
+    prevBatch_ = page.next_batch;
 
     nhlog::ui()->debug("Finished loading rooms");
 }
@@ -6,11 +6,14 @@
 
 #include <QAbstractListModel>
 #include <QString>
+#include <QTimer>
 #include <string>
 #include <vector>
 
 #include <mtx/responses/public_rooms.hpp>
 
+#include "SearchPageCache.h"
+
 class FetchRoomsChunkFromDirectoryJob final : public QObject
 {
     Q_OBJECT
@@ -27,6 +30,9 @@ signals:
                            const std::string &search_term,
                            const std::string &server,
                            const std::string &since);
+    void fetchFailed(const std::string &search_term,
+                     const std::string &server,
+                     const std::string &since);
 };
 
 class RoomDirectoryModel : public QAbstractListModel
@@ -79,7 +85,7 @@ public slots:
     void setSearchTerm(const QString &f);
 
 private slots:
-
+    void sendRequest();
     void displayRooms(std::vector<mtx::responses::PublicRoomsChunk> rooms,
                       const std::string &next_batch,
                       const std::string &search_term,
@@ -88,6 +94,9 @@ private slots:
 
 private:
     bool canJoinRoom(const QString &room) const;
+    void appendRooms(const mtx::responses::PublicRooms &page);
+    //! Rooms of earlier searches on the server, that also match the search term.
+    std::vector<mtx::responses::PublicRoomsChunk> locallyFilteredRooms() const;
 
     static constexpr size_t limit_ = 50;
 
@@ -98,7 +107,13 @@ private:
     bool canFetchMore_{true};
     bool loadingMoreRooms_{false};
     bool reachedEndOfPagination_{false};
+    //! Only one page is requested at a time, the wanted page is requested when it finishes.
+    bool requestRunning_{false};
+    //! The rooms are locally filtered results, that are replaced by the first page.
+    bool showsLocalResults_{false};
     std::vector<mtx::responses::PublicRoomsChunk> publicRoomsData_;
+    QTimer searchTimer_;
+    SearchPageCache<mtx::responses::PublicRooms> cache_{64};
 
     std::vector<std::string> getViasForRoom(const std::vector<std::string> &room);
     void resetDisplayedData();
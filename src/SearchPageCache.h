@@ -0,0 +1,70 @@
+// SPDX-FileCopyrightText: Nheko Contributors
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+
+//! The most recently used pages of directory search results, so that going back to an earlier
+//! search does not ask the server again.
+template<class Page>
+class SearchPageCache
+{
+public:
+    //! The server, the search term and the pagination token of a page.
+    using Key   = std::tuple<std::string, std::string, std::string>;
+    using Entry = std::pair<Key, Page>;
+
+    explicit SearchPageCache(std::size_t capacity)
+      : capacity_(capacity)
+    {
+    }
+
+    //! The cached page or nullptr. Marks the page as recently used.
+    const Page *find(const Key &key)
+    {
+        auto it = index_.find(key);
+        if (it == index_.end())
+            return nullptr;
+
+        pages_.splice(pages_.begin(), pages_, it->second);
+        return &it->second->second;
+    }
+
+    void insert(const Key &key, Page page)
+    {
+        if (auto it = index_.find(key); it != index_.end()) {
+            it->second->second = std::move(page);
+            pages_.splice(pages_.begin(), pages_, it->second);
+            return;
+        }
+
+        pages_.emplace_front(key, std::move(page));
+        index_.emplace(key, pages_.begin());
+
+        if (pages_.size() > capacity_) {
+            index_.erase(pages_.back().first);
+            pages_.pop_back();
+        }
+    }
+
+    //! All cached pages, the most recently used first.
+    const std::list<Entry> &pages() const { return pages_; }
+
+    void clear()
+    {
+        index_.clear();
+        pages_.clear();
+    }
+
+private:
+    std::size_t capacity_;
+    std::list<Entry> pages_;
+    std::map<Key, typename std::list<Entry>::iterator> index_;
+};
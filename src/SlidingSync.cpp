@@ -0,0 +1,421 @@
+// SPDX-FileCopyrightText: Nheko Contributors
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "SlidingSync.h"
+
+#include <set>
+#include <string_view>
+
+#include <QUrl>
+
+#include <coeurl/client.hpp>
+#include <coeurl/request.hpp>
+#include <curl/curl.h>
+
+#include "Cache.h"
+#include "Logging.h"
+#include "MatrixClient.h"
+
+namespace {
+constexpr std::string_view ENDPOINT = "/_matrix/client/unstable/org.matrix.simplified_msc3575/sync";
+
+constexpr std::string_view TOKEN_PREFIX   = "sliding_sync:";
+constexpr int CURRENT_ROOM_TIMELINE_LIMIT = 20;
+
+// The position and the to-device token are saved together with the state they belong to, by
+// storing them as the next batch token.
+std::string
+encodeToken(const std::string &pos, const std::string &toDeviceSince)
+{
+    return std::string(TOKEN_PREFIX) +
+           nlohmann::json{{"pos", pos}, {"to_device", toDeviceSince}}.dump();
+}
+
+//! The value at the json pointer, or null.
+nlohmann::json
+find(const nlohmann::json &obj, const char *pointer)
+{
+    nlohmann::json::json_pointer p(pointer);
+    return obj.contains(p) ? obj.at(p) : nlohmann::json();
+}
+
+nlohmann::json
+valueOr(const nlohmann::json &obj, const char *key, nlohmann::json fallback)
+{
+    if (auto it = obj.find(key); it != obj.end() && !it->is_null())
+        return *it;
+    return fallback;
+}
+
+//! Rooms are joined unless we got an invite or our own membership says otherwise.
+std::string
+membership(const nlohmann::json &room, const std::string &ownUserId)
+{
+    if (room.contains("invite_state"))
+        return "invite";
+
+    for (const auto &e : valueOr(room, "required_state", nlohmann::json::array())) {
+        if (e.value("type", "") == "m.room.member" && e.value("state_key", "") == ownUserId) {
+            auto m = e.value(nlohmann::json::json_pointer("/content/membership"), "join");
+            if (m == "leave" || m == "ban")
+                return "leave";
+        }
+    }
+    return "join";
+}
+
+//! Translate a sliding sync response to the /sync format.
+nlohmann::json
+toSync(const nlohmann::json &res, const std::string &nextBatch)
+{
+    const auto ownUserId = http::client()->user_id().to_string();
+
+    nlohmann::json sync = {
+      {"next_batch", nextBatch},
+      {"rooms",
+       {
+         {"join", nlohmann::json::object()},
+         {"invite", nlohmann::json::object()},
+         {"leave", nlohmann::json::object()},
+       }},
+    };
+    auto &joined = sync["rooms"]["join"];
+
+    for (const auto &el : valueOr(res, "rooms", nlohmann::json::object()).items()) {
+        const auto &room = el.value();
+        auto m           = membership(room, ownUserId);
+
+        if (m == "invite") {
+            sync["rooms"]["invite"][el.key()]["invite_state"]["events"] = room["invite_state"];
+            continue;
+        }
+
+        nlohmann::json timeline = {
+          {"events", valueOr(room, "timeline", nlohmann::json::array())},
+          {"limited", room.value("limited", false)},
+        };
+        if (room.contains("prev_batch"))
+            timeline["prev_batch"] = room["prev_batch"];
+
+        nlohmann::json r = {
+          {"state", {{"events", valueOr(room, "required_state", nlohmann::json::array())}}},
+          {"timeline", std::move(timeline)},
+        };
+        if (m == "leave") {
+            sync["rooms"]["leave"][el.key()] = std::move(r);
+            continue;
+        }
+
+        r["unread_notifications"] = {
+          {"notification_count", room.value("notification_count", 0)},
+          {"highlight_count", room.value("highlight_count", 0)},
+        };
+        if (room.contains("joined_count"))
+            r["summary"]["m.joined_member_count"] = room["joined_count"];
+        if (room.contains("invited_count"))
+            r["summary"]["m.invited_member_count"] = room["invited_count"];
+        joined[el.key()] = std::move(r);
+    }
+
+    // Room extensions are also sent for rooms outside the window, but only rooms that we know
+    // can be updated without their state.
+    std::set<std::string> known;
+    try {
+        for (auto &id : cache::joinedRooms())
+            known.insert(std::move(id));
+    } catch (const lmdb::error &e) {
+        nhlog::db()->warn("failed to retrieve joined rooms: {}", e.what());
+    }
+    auto roomFor = [&joined, &known](const std::string &id) -> nlohmann::json * {
+        if (!joined.contains(id) && !known.count(id))
+            return nullptr;
+        return &joined[id];
+    };
+
+    const auto extensions = valueOr(res, "extensions", nlohmann::json::object());
+
+    if (extensions.contains("to_device"))
+        sync["to_device"]["events"] =
+          valueOr(extensions["to_device"], "events", nlohmann::json::array());
+
+    if (extensions.contains("e2ee")) {
+        const auto &e2ee = extensions["e2ee"];
+        for (const auto *key : {"device_lists",
+                                "device_one_time_keys_count",
+                                "device_unused_fallback_key_types"})
+            if (e2ee.contains(key))
+                sync[key] = e2ee[key];
+    }
+
+    if (extensions.contains("account_data")) {
+        const auto &accountData = extensions["account_data"];
+        sync["account_data"]["events"] =
+          valueOr(accountData, "global", nlohmann::json::array());
+        for (const auto &el : valueOr(accountData, "rooms", nlohmann::json::object()).items())
+            if (auto r = roomFor(el.key()))
+                (*r)["account_data"]["events"] = el.value();
+    }
+
+    for (const auto *ext : {"receipts", "typing"}) {
+        if (!extensions.contains(ext))
+            continue;
+        for (const auto &el : valueOr(extensions[ext], "rooms", nlohmann::json::object()).items())
+            if (auto r = roomFor(el.key()))
+                (*r)["ephemeral"]["events"].push_back(el.value());
+    }
+
+    return sync;
+}
+}
+
+SlidingSync::SlidingSync(QObject *parent)
+  : QObject(parent)
+{
+}
+
+SlidingSync::~SlidingSync() = default;
+
+bool
+SlidingSync::isSlidingToken(const std::string &token)
+{
+    return std::string_view(token).substr(0, TOKEN_PREFIX.size()) == TOKEN_PREFIX;
+}
+
+void
+SlidingSync::sync(const std::string &since, int timeout, Callback callback)
+{
+    std::string pos, toDeviceSince;
+    if (isSlidingToken(since)) {
+        try {
+            auto j        = nlohmann::json::parse(since.substr(TOKEN_PREFIX.size()));
+            pos           = j.value("pos", "");
+            toDeviceSince = j.value("to_device", "");
+        } catch (const nlohmann::json::exception &e) {
+            nhlog::net()->warn("invalid sliding sync token {}: {}", since, e.what());
+        }
+    }
+
+    // the first response should arrive as fast as possible
+    send(pos, toDeviceSince, pos.empty() ? 0 : timeout, std::move(callback));
+}
+
+void
+SlidingSync::send(const std::string &pos,
+                  const std::string &toDeviceSince,
+                  int timeout,
+                  Callback callback)
+{
+    uint64_t generation;
+    std::string body;
+    int windowEnd;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        generation = ++generation_;
+        waiting_   = true;
+        windowEnd  = windowEnd_;
+        body       = request(toDeviceSince).dump();
+
+        // the client starts its own network thread, so only create it when it is used
+        if (!client_) {
+            client_ = std::make_unique<coeurl::Client>();
+            http::configure(*client_);
+        }
+    }
+
+    auto url = http::client()->server_url() + std::string(ENDPOINT) +
+               "?timeout=" + std::to_string(timeout);
+    if (!pos.empty())
+        url += "&pos=" + QUrl::toPercentEncoding(QString::fromStdString(pos)).toStdString();
+
+    client_->post(
+      url,
+      std::move(body),
+      "application/json",
+      [this, generation, windowEnd, pos, toDeviceSince, callback = std::move(callback)](
+        const coeurl::Request &r) {
+          {
+              std::lock_guard<std::mutex> lock(mutex_);
+              if (generation != generation_)
+                  return;
+              waiting_ = false;
+          }
+
+          if (r.error_code() != CURLE_OK) {
+              callback({}, Error{0, {}, curl_easy_strerror(r.error_code())});
+              return;
+          }
+
+          nlohmann::json res;
+          try {
+              res = nlohmann::json::parse(r.response());
+          } catch (const nlohmann::json::exception &e) {
+              callback({}, Error{r.response_code(), {}, e.what()});
+              return;
+          }
+
+          if (r.response_code() >= 400) {
+              Error err{r.response_code(), res.value("errcode", ""), res.value("error", "")};
+              if (err.errcode == "M_UNKNOWN_POS" && !pos.empty()) {
+                  // the server expired our connection, start a new one
+                  nhlog::net()->info("sliding sync position expired, starting over");
+                  send("", toDeviceSince, 0, callback);
+                  return;
+              }
+              callback({}, err);
+              return;
+          }
+
+          auto nextToDeviceSince = toDeviceSince;
+          if (auto next = find(res, "/extensions/to_device/next_batch"); next.is_string())
+              nextToDeviceSince = next.get<std::string>();
+
+          nlohmann::json translated;
+          mtx::responses::Sync sync;
+          try {
+              translated = toSync(res, encodeToken(res.value("pos", pos), nextToDeviceSince));
+              sync       = translated.get<mtx::responses::Sync>();
+          } catch (const std::exception &e) {
+              callback({}, Error{r.response_code(), {}, e.what()});
+              return;
+          }
+
+          try {
+              cache::saveRoomSummaries(translated["rooms"]["join"]);
+          } catch (const lmdb::error &e) {
+              nhlog::db()->warn("failed to save room summaries: {}", e.what());
+          }
+
+          if (auto count = find(res, "/lists/rooms/count"); count.is_number())
+              emit moreRoomsAvailable(count.get<int>() > windowEnd + 1);
+
+          callback(sync, std::nullopt);
+      },
+      {{"Authorization", "Bearer " + http::client()->access_token()}});
+}
+
+nlohmann::json
+SlidingSync::request(const std::string &toDeviceSince) const
+{
+    // what the room list needs: name, avatar, encryption, spaces and our membership
+    static const auto listState = nlohmann::json::parse(R"([
+        ["m.room.create", ""],
+        ["m.room.name", ""],
+        ["m.room.avatar", ""],
+        ["m.room.canonical_alias", ""],
+        ["m.room.topic", ""],
+        ["m.room.encryption", ""],
+        ["m.room.tombstone", ""],
+        ["m.room.power_levels", ""],
+        ["m.room.join_rules", ""],
+        ["m.space.child", "*"],
+        ["m.space.parent", "*"],
+        ["m.room.member", "$ME"],
+        ["m.room.member", "$LAZY"]
+    ])");
+
+    nlohmann::json toDevice = {{"enabled", true}};
+    if (!toDeviceSince.empty())
+        toDevice["since"] = toDeviceSince;
+
+    nlohmann::json req = {
+      {"conn_id", "nheko"},
+      {"lists",
+       {
+         {"rooms",
+          {
+            {"ranges", nlohmann::json::array({nlohmann::json::array({0, windowEnd_})})},
+            {"required_state", listState},
+            {"timeline_limit", 1},
+          }},
+       }},
+      {"room_subscriptions", nlohmann::json::object()},
+      {"extensions",
+       {
+         {"to_device", std::move(toDevice)},
+         {"e2ee", {{"enabled", true}}},
+         {"account_data", {{"enabled", true}}},
+         {"receipts", {{"enabled", true}}},
+         {"typing", {{"enabled", true}}},
+       }},
+    };
+
+    if (!currentRoom_.empty())
+        req["room_subscriptions"][currentRoom_] = {
+          {"required_state", nlohmann::json::parse(R"([["*", "*"]])")},
+          {"timeline_limit", CURRENT_ROOM_TIMELINE_LIMIT},
+        };
+
+    return req;
+}
+
+std::unique_ptr<coeurl::Client>
+SlidingSync::abandonRequest()
+{
+    ++generation_;
+    waiting_ = false;
+    return std::move(client_);
+}
+
+void
+SlidingSync::setCurrentRoom(const QString &roomId)
+{
+    std::unique_ptr<coeurl::Client> abandoned;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (currentRoom_ == roomId.toStdString())
+            return;
+        currentRoom_ = roomId.toStdString();
+
+        // cancel the running long poll, so the room does not wait for it
+        if (waiting_)
+            abandoned = abandonRequest();
+    }
+
+    if (abandoned) {
+        abandoned->shutdown();
+        emit restartRequested();
+    }
+}
+
+void
+SlidingSync::extendWindow()
+{
+    std::unique_ptr<coeurl::Client> abandoned;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        windowEnd_ += WINDOW_SIZE;
+
+        if (waiting_)
+            abandoned = abandonRequest();
+    }
+
+    if (abandoned) {
+        abandoned->shutdown();
+        emit restartRequested();
+    }
+}
+
+void
+SlidingSync::stop()
+{
+    std::unique_ptr<coeurl::Client> abandoned;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        abandoned = abandonRequest();
+    }
+
+    if (abandoned)
+        abandoned->shutdown();
+}
+
+void
+SlidingSync::reset()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        currentRoom_.clear();
+        windowEnd_ = WINDOW_SIZE - 1;
+    }
+    stop();
+}
@@ -0,0 +1,92 @@
+// SPDX-FileCopyrightText: Nheko Contributors
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <QObject>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include <mtx/responses/sync.hpp>
+#include <nlohmann/json.hpp>
+
+namespace coeurl {
+class Client;
+}
+
+//! Syncs with simplified sliding sync (MSC4186), which only sends the rooms in a window of the
+//! room list and the open room, instead of every room.
+//!
+//! Responses are translated to classic /sync responses, so they are saved and shown the same way.
+//! The position of the connection is stored as the next batch token, see isSlidingToken().
+class SlidingSync final : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Error
+    {
+        //! 0 for network errors
+        int status_code = 0;
+        std::string errcode;
+        std::string message;
+    };
+    using Callback =
+      std::function<void(const mtx::responses::Sync &, const std::optional<Error> &)>;
+
+    //! Rooms in the room list window, before it was extended.
+    static constexpr int WINDOW_SIZE = 50;
+
+    SlidingSync(QObject *parent = nullptr);
+    ~SlidingSync() override;
+
+    //! Whether the token was created by a sliding sync. Classic syncs have to start over then.
+    static bool isSlidingToken(const std::string &token);
+
+    //! Request the changes since the token, waiting up to timeout milliseconds for new events.
+    //! The callback is called on the network thread and only for the latest request.
+    void sync(const std::string &since, int timeout, Callback callback);
+
+public slots:
+    //! Send the full state and more timeline of that room.
+    void setCurrentRoom(const QString &roomId);
+    //! Add the next rooms of the room list to the window.
+    void extendWindow();
+    //! Cancel the running request, for example when the connection was lost.
+    void stop();
+    //! Forget the window and the current room and cancel the running request, for example on
+    //! logout.
+    void reset();
+
+signals:
+    //! The server has rooms outside the window.
+    void moreRoomsAvailable(bool available);
+    //! The window or current room changed while waiting for the server, so the running request
+    //! was cancelled and a new one should be started.
+    void restartRequested();
+
+private:
+    void
+    send(const std::string &pos, const std::string &toDeviceSince, int timeout, Callback callback);
+    //! The request body for the current window and room. Needs the mutex to be locked.
+    nlohmann::json request(const std::string &toDeviceSince) const;
+    //! Drop the response of the running request and hand out the client, so the caller can shut
+    //! it down after unlocking the mutex. The next request starts a new client. Needs the mutex
+    //! to be locked.
+    std::unique_ptr<coeurl::Client> abandonRequest();
+
+    std::mutex mutex_;
+    std::string currentRoom_;
+    int windowEnd_ = WINDOW_SIZE - 1;
+    //! incremented for every request, only responses to the latest one are delivered
+    uint64_t generation_ = 0;
+    bool waiting_        = false;
+
+    //! Destroyed first, so no request finishes while the other members are destroyed.
+    std::unique_ptr<coeurl::Client> client_;
+};
@@ -0,0 +1,178 @@
+// SPDX-FileCopyrightText: Nheko Contributors
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "StartupProfile.h"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QFile>
+
+#include <nlohmann/json.hpp>
+
+#include "Logging.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Initialized before main runs, so the time to get to main is part of the first phase.
+const Clock::time_point processStart = Clock::now();
+
+struct Entry
+{
+    const char *name;
+    size_t thread;
+    int64_t start;
+    //! -1 while the phase is running, equal to start for marks
+    int64_t end;
+    bool isMark;
+};
+
+std::mutex mutex;
+std::vector<Entry> entries;
+bool finished = false;
+bool verbose  = false;
+QString traceFile;
+
+int64_t
+now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - processStart)
+      .count();
+}
+
+size_t
+threadId()
+{
+    return std::hash<std::thread::id>{}(std::this_thread::get_id());
+}
+
+void
+writeTrace(const std::vector<Entry> &recorded, int64_t total)
+{
+    nlohmann::json events = nlohmann::json::array();
+    for (const auto &e : recorded) {
+        nlohmann::json event = {
+          {"name", e.name},
+          {"pid", 1},
+          {"tid", e.thread},
+          {"ts", e.start},
+        };
+        if (e.isMark) {
+            event["ph"] = "i";
+            event["s"]  = "g";
+        } else {
+            event["ph"]  = "X";
+            event["dur"] = (e.end < 0 ? total : e.end) - e.start;
+        }
+        events.push_back(std::move(event));
+    }
+
+    QFile f(traceFile);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        nhlog::ui()->warn("Failed to write startup trace to {}", traceFile.toStdString());
+        return;
+    }
+    f.write(QByteArray::fromStdString(nlohmann::json{{"traceEvents", events}}.dump()));
+    nhlog::ui()->info("Wrote startup trace to {}", traceFile.toStdString());
+}
+}
+
+namespace startupprofile {
+void
+init(const QString &file)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    verbose   = true;
+    traceFile = file;
+}
+
+void
+begin(const char *phase)
+{
+    auto ts = now();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!finished)
+        entries.push_back({phase, threadId(), ts, -1, false});
+}
+
+void
+end(const char *phase)
+{
+    auto ts = now();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        if (!it->isMark && it->end < 0 && std::strcmp(it->name, phase) == 0) {
+            it->end = ts;
+            return;
+        }
+    }
+}
+
+void
+mark(const char *milestone)
+{
+    auto ts = now();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (finished)
+        return;
+    for (const auto &e : entries)
+        if (e.isMark && std::strcmp(e.name, milestone) == 0)
+            return;
+    entries.push_back({milestone, threadId(), ts, ts, true});
+}
+
+void
+finish()
+{
+    auto total = now();
+
+    std::vector<Entry> recorded;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished)
+            return;
+        finished = true;
+        recorded = std::move(entries);
+    }
+
+    auto log = [](const std::string &line) {
+        if (verbose)
+            nhlog::ui()->info("{}", line);
+        else
+            nhlog::ui()->debug("{}", line);
+    };
+
+    nhlog::ui()->info("Startup took {:.1f} ms", total / 1000.);
+
+    // Entries are in start order, so a phase is nested in every earlier one still running.
+    std::vector<int64_t> open;
+    for (const auto &e : recorded) {
+        while (!open.empty() && open.back() >= 0 && open.back() <= e.start)
+            open.pop_back();
+
+        auto indent = std::string(open.size() * 2, ' ');
+        if (e.isMark)
+            log(fmt::format("{:>9.1f} ms  {}* {}", e.start / 1000., indent, e.name));
+        else if (e.end < 0)
+            log(fmt::format("{:>9.1f} ms  {}{} (unfinished)", e.start / 1000., indent, e.name));
+        else
+            log(fmt::format("{:>9.1f} ms  {}{}: {:.1f} ms",
+                            e.start / 1000.,
+                            indent,
+                            e.name,
+                            (e.end - e.start) / 1000.));
+
+        if (!e.isMark)
+            open.push_back(e.end);
+    }
+
+    if (!traceFile.isEmpty())
+        writeTrace(recorded, total);
+}
+}
@@ -0,0 +1,48 @@
+// SPDX-FileCopyrightText: Nheko Contributors
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <QString>
+
+//! Timestamps the phases of a cold start, so startup regressions can be diagnosed on user machines.
+//! Phases are recorded until finish() is called, which logs a summary. Recording is cheap enough
+//! to always be on; --startup-profile only makes the summary more visible and writes a trace.
+namespace startupprofile {
+//! Log the summary at info level and write a Chrome trace to traceFile, if it is not empty.
+void
+init(const QString &traceFile);
+
+//! Start a phase. Phases may nest and may end on another thread or event loop iteration.
+void
+begin(const char *phase);
+//! End the most recent phase with that name.
+void
+end(const char *phase);
+//! Record a point in time. Only the first mark with each name is kept.
+void
+mark(const char *milestone);
+
+//! Stop recording, log the summary and write the trace. Later calls do nothing.
+void
+finish();
+
+//! Records a phase for the lifetime of the object.
+class Scope
+{
+public:
+    explicit Scope(const char *phase)
+      : phase_(phase)
+    {
+        begin(phase_);
+    }
+    ~Scope() { end(phase_); }
+
+    Scope(const Scope &)            = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    const char *phase_;
+};
+}
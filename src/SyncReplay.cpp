@@ -0,0 +1,384 @@
+// SPDX-FileCopyrightText: Nheko Contributors
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "SyncReplay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+#include <mtx/responses/sync.hpp>
+#include <nlohmann/json.hpp>
+
+#include "Cache.h"
+#include "Cache_p.h"
+#include "ChatPage.h"
+#include "MatrixClient.h"
+#include "UserSettingsPage.h"
+#include "timeline/TimelineViewManager.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Fixture
+{
+    std::string name;
+    nlohmann::json sync;
+};
+
+double
+toMs(Clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+std::string
+userId(int i)
+{
+    return "@user" + std::to_string(i) + ":replay.invalid";
+}
+
+std::string
+roomId(int i)
+{
+    return "!room" + std::to_string(i) + ":replay.invalid";
+}
+
+nlohmann::json
+event(const std::string &type, const std::string &sender, nlohmann::json content, uint64_t &counter)
+{
+    ++counter;
+    return {
+      {"type", type},
+      {"event_id", "$replay" + std::to_string(counter) + ":replay.invalid"},
+      {"sender", sender},
+      {"origin_server_ts", 1600000000000 + counter},
+      {"content", std::move(content)},
+    };
+}
+
+nlohmann::json
+stateEvent(const std::string &type,
+           const std::string &stateKey,
+           const std::string &sender,
+           nlohmann::json content,
+           uint64_t &counter)
+{
+    auto e         = event(type, sender, std::move(content), counter);
+    e["state_key"] = stateKey;
+    return e;
+}
+
+nlohmann::json
+message(int room, int sender, bool encrypted, uint64_t &counter)
+{
+    if (encrypted)
+        return event("m.room.encrypted",
+                     userId(sender),
+                     {
+                       {"algorithm", "m.megolm.v1.aes-sha2"},
+                       {"ciphertext", std::string(256, 'A')},
+                       {"device_id", "REPLAY"},
+                       {"sender_key", "replaysenderkey"},
+                       {"session_id", "replaysession" + std::to_string(room)},
+                     },
+                     counter);
+
+    return event("m.room.message",
+                 userId(sender),
+                 {{"msgtype", "m.text"}, {"body", "Message " + std::to_string(counter)}},
+                 counter);
+}
+
+std::vector<Fixture>
+load(const QString &directory)
+{
+    std::vector<Fixture> fixtures;
+
+    const auto files = QDir(directory).entryInfoList(
+      {QStringLiteral("*.json")}, QDir::Files | QDir::Readable, QDir::Name);
+    for (const auto &file : files) {
+        QFile f(file.absoluteFilePath());
+        if (!f.open(QIODevice::ReadOnly))
+            throw std::runtime_error("Failed to open " + file.absoluteFilePath().toStdString());
+
+        fixtures.push_back(
+          {file.fileName().toStdString(), nlohmann::json::parse(f.readAll().toStdString())});
+    }
+
+    return fixtures;
+}
+
+//! Bytes in use on the heap, 0 if the allocator can't tell.
+size_t
+heapInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+//! Point the settings, the cache and the secrets at `dir`, so the replay never touches the data of
+//! a real profile.
+void
+isolateProfile(const QString &dir)
+{
+    qputenv("XDG_CONFIG_HOME", QDir(dir).filePath(QStringLiteral("config")).toUtf8());
+    qputenv("XDG_DATA_HOME", QDir(dir).filePath(QStringLiteral("data")).toUtf8());
+    qputenv("XDG_CACHE_HOME", QDir(dir).filePath(QStringLiteral("cache")).toUtf8());
+#if !defined(Q_OS_UNIX) || defined(Q_OS_MACOS)
+    // the XDG variables are only used on Linux and the BSDs
+    QStandardPaths::setTestModeEnabled(true);
+#endif
+
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+    QSettings::setPath(
+      QSettings::IniFormat, QSettings::UserScope, QDir(dir).filePath(QStringLiteral("config")));
+}
+
+double
+percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+
+    std::sort(values.begin(), values.end());
+    auto idx = static_cast<size_t>(p * static_cast<double>(values.size() - 1) + 0.5);
+    return values[std::min(idx, values.size() - 1)];
+}
+
+void
+printLatencies(const char *name, const std::vector<double> &latencies)
+{
+    std::vector<double> incremental(latencies.begin() + 1, latencies.end());
+    std::cout << name << ": initial sync " << latencies.front() << " ms, incremental syncs p50 "
+              << percentile(incremental, 0.5) << " ms, p90 " << percentile(incremental, 0.9)
+              << " ms, p99 " << percentile(incremental, 0.99) << " ms, max "
+              << percentile(incremental, 1) << " ms\n";
+}
+}
+
+namespace syncreplay {
+std::vector<nlohmann::json>
+generate(int rooms, int members, int syncs, bool encrypted)
+{
+    rooms   = std::max(rooms, 1);
+    members = std::max(members, 1);
+
+    uint64_t counter = 0;
+    std::vector<nlohmann::json> responses;
+
+    nlohmann::json initial = {{"next_batch", "s0"}};
+    for (int r = 0; r < rooms; r++) {
+        auto &room  = initial["rooms"]["join"][roomId(r)];
+        auto &state = room["state"]["events"];
+        state.push_back(stateEvent("m.room.create",
+                                   "",
+                                   userId(0),
+                                   {{"creator", userId(0)}, {"room_version", "10"}},
+                                   counter));
+        state.push_back(stateEvent(
+          "m.room.name", "", userId(0), {{"name", "Room " + std::to_string(r)}}, counter));
+        state.push_back(stateEvent(
+          "m.room.power_levels", "", userId(0), {{"users", {{userId(0), 100}}}}, counter));
+        if (encrypted)
+            state.push_back(stateEvent("m.room.encryption",
+                                       "",
+                                       userId(0),
+                                       {{"algorithm", "m.megolm.v1.aes-sha2"}},
+                                       counter));
+        for (int m = 0; m < members; m++)
+            state.push_back(
+              stateEvent("m.room.member",
+                         userId(m),
+                         userId(m),
+                         {{"membership", "join"}, {"displayname", "User " + std::to_string(m)}},
+                         counter));
+
+        auto &timeline         = room["timeline"];
+        timeline["limited"]    = true;
+        timeline["prev_batch"] = "p" + std::to_string(r);
+        timeline["events"]     = nlohmann::json::array();
+        for (int i = 0; i < 20; i++)
+            timeline["events"].push_back(message(r, i % members, encrypted, counter));
+    }
+    responses.push_back(std::move(initial));
+
+    // steady state: a few active rooms per sync with new messages and read receipts
+    for (int s = 1; s <= syncs; s++) {
+        nlohmann::json sync = {{"next_batch", "s" + std::to_string(s)}};
+        for (int k = 0; k < std::min(rooms, 5); k++) {
+            int r      = (s * 7 + k) % rooms;
+            auto &room = sync["rooms"]["join"][roomId(r)];
+
+            auto &timeline      = room["timeline"];
+            timeline["limited"] = false;
+            timeline["events"]  = nlohmann::json::array();
+            for (int i = 0; i < 2; i++)
+                timeline["events"].push_back(message(r, (s + i) % members, encrypted, counter));
+
+            auto lastId            = timeline["events"].back()["event_id"].get<std::string>();
+            nlohmann::json receipt = {{userId(s % members), {{"ts", 1600000000000 + counter}}}};
+            room["ephemeral"]["events"].push_back({
+              {"type", "m.receipt"},
+              {"content", {{lastId, {{"m.read", std::move(receipt)}}}}},
+            });
+            room["unread_notifications"] = {{"notification_count", s % 5}, {"highlight_count", 0}};
+        }
+        responses.push_back(std::move(sync));
+    }
+
+    return responses;
+}
+
+int
+run(const QString &source)
+{
+    std::vector<Fixture> fixtures;
+    try {
+        if (source.startsWith(QLatin1String("generate:"))) {
+            auto args = source.mid(9).split(',');
+            if (args.size() < 3) {
+                std::cerr << "Expected generate:<rooms>,<members>,<syncs>[,encrypted]" << std::endl;
+                return 1;
+            }
+            auto syncs = generate(args[0].toInt(),
+                                  args[1].toInt(),
+                                  args[2].toInt(),
+                                  args.size() > 3 && args[3] == QLatin1String("encrypted"));
+            for (size_t i = 0; i < syncs.size(); i++)
+                fixtures.push_back(
+                  {i == 0 ? "initial" : "sync " + std::to_string(i), std::move(syncs[i])});
+        } else {
+            fixtures = load(source);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Failed to load sync responses: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (fixtures.empty()) {
+        std::cerr << "No sync responses to replay" << std::endl;
+        return 1;
+    }
+
+    QTemporaryDir profile;
+    if (!profile.isValid()) {
+        std::cerr << "Failed to create a temporary profile: " << profile.errorString().toStdString()
+                  << std::endl;
+        return 1;
+    }
+    isolateProfile(profile.path());
+
+    UserSettings::initialize(std::nullopt);
+    // secrets are stored in the temporary settings instead of the keychain
+    UserSettings::instance()->qsettings()->setValue(
+      QStringLiteral("run_without_secure_secrets_service"), true);
+
+    // the generated rooms are joined by the first user
+    const auto localUser = userId(0);
+    http::client()->set_user(mtx::identifiers::parse<mtx::identifiers::User>(localUser));
+    cache::init(QString::fromStdString(localUser));
+    const auto cacheDirectory = cache::client()->cacheDirectory();
+
+    // The models are driven like in a session, only without a main window and qml.
+    ChatPage page(UserSettings::instance());
+
+    std::vector<double> latencies, modelLatencies;
+    size_t eventCount = 0;
+    double parseMs    = 0;
+    int exitCode      = 0;
+
+    const auto heapAtStart  = heapInUse();
+    size_t heapAfterInitial = 0;
+
+    for (const auto &fixture : fixtures) {
+        mtx::responses::Sync res;
+        auto parseStart = Clock::now();
+        try {
+            res = fixture.sync.get<mtx::responses::Sync>();
+        } catch (const std::exception &e) {
+            std::cerr << "Failed to parse " << fixture.name << ": " << e.what() << std::endl;
+            exitCode = 1;
+            break;
+        }
+        auto syncStart = Clock::now();
+        parseMs += toMs(syncStart - parseStart);
+
+        try {
+            // the same work ChatPage does with every sync response
+            cache::client()->saveState(res);
+            (void)cache::getRoomInfo(cache::client()->roomsWithStateUpdates(res));
+            if (latencies.empty())
+                cache::calculateRoomReadStatus();
+        } catch (const lmdb::error &e) {
+            std::cerr << "Failed to save " << fixture.name << ": " << e.what() << std::endl;
+            exitCode = 1;
+            break;
+        }
+
+        auto modelStart = Clock::now();
+        latencies.push_back(toMs(modelStart - syncStart));
+
+        // RoomlistModel::sync, CommunitiesModel::sync and TimelineModel::addEvents, then the
+        // queued updates they posted to the UI thread
+        page.timelineManager()->sync(res);
+        QCoreApplication::processEvents();
+        modelLatencies.push_back(toMs(Clock::now() - modelStart));
+
+        for (const auto &[id, room] : res.rooms.join)
+            eventCount += room.state.events.size() + room.timeline.events.size();
+
+        if (latencies.size() == 1) {
+            res              = {};
+            heapAfterInitial = heapInUse();
+        }
+    }
+
+    if (!latencies.empty()) {
+        double total = 0;
+        for (size_t i = 0; i < latencies.size(); i++)
+            total += latencies[i] + modelLatencies[i];
+
+        std::cout << "replayed " << latencies.size() << " syncs with " << eventCount
+                  << " events in " << total << " ms\n"
+                  << "throughput: " << latencies.size() * 1000 / total << " syncs/s, "
+                  << eventCount * 1000 / total << " events/s\n";
+        printLatencies("cache", latencies);
+        printLatencies("models", modelLatencies);
+        std::cout << "json parsing (not included above): " << parseMs << " ms\n"
+                  << "database size: "
+                  << QFileInfo(cacheDirectory + QStringLiteral("/data.mdb")).size() / 1024
+                  << " KiB" << std::endl;
+
+        if (heapAtStart != 0) {
+            // the parsed responses are freed, so this is what the cache and the models keep
+            auto heapAtEnd = heapInUse();
+            std::cout << "heap growth: initial sync "
+                      << (static_cast<double>(heapAfterInitial) - heapAtStart) / 1024
+                      << " KiB, incremental syncs "
+                      << (static_cast<double>(heapAtEnd) - heapAfterInitial) / 1024 << " KiB"
+                      << std::endl;
+        }
+    }
+
+    return exitCode;
+}
+}
@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: Nheko Contributors
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <QString>
+
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace syncreplay {
+//! Generate an initial sync with `rooms` rooms of `members` members each, followed by `syncs`
+//! incremental syncs with a few new messages and receipts. The first member is in every room.
+std::vector<nlohmann::json>
+generate(int rooms, int members, int syncs, bool encrypted);
+
+//! Replay sync responses without a homeserver and print timings and the heap growth.
+//!
+//! Everything runs in a temporary profile. Each response goes through the cache and then through
+//! the room list, community and timeline models of a ChatPage without a main window, and both
+//! are timed separately.
+//!
+//! `source` is either a directory of sync response json files, which are replayed in the order of
+//! their names, or `generate:<rooms>,<members>,<syncs>[,encrypted]` to replay an initial sync with
+//! that many rooms and members per room followed by that many incremental syncs.
+//! Returns the exit code for the application.
+int
+run(const QString &source);
+}
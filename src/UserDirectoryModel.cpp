@@ -9,12 +9,23 @@
 #include <mtx/responses/users.hpp>
 
 #include "Cache.h"
+#include "ChatPage.h"
 #include "Logging.h"
 #include "MatrixClient.h"
 
+namespace {
+//! Wait this long for the search string to stop changing, before asking the server.
+constexpr int SEARCH_DELAY = 250;
+}
+
 UserDirectoryModel::UserDirectoryModel(QObject *parent)
   : QAbstractListModel{parent}
 {
+    searchTimer_.setSingleShot(true);
+    searchTimer_.setInterval(SEARCH_DELAY);
+    connect(&searchTimer_, &QTimer::timeout, this, &UserDirectoryModel::sendSearch);
+
+    connect(ChatPage::instance(), &ChatPage::loggedOut, this, [this] { cache_.clear(); });
 }
 
 QHash<int, QByteArray>
@@ -34,28 +45,85 @@ UserDirectoryModel::setSearchString(const QString &f)
     nhlog::ui()->debug("Received user directory query: {}", userSearchString_);
     beginResetModel();
     results_.clear();
-    if (userSearchString_ == "")
+    canFetchMore_ = false;
+    if (userSearchString_ == "") {
         nhlog::ui()->debug("Rejecting empty search string");
-    else
+    } else if (auto page = cache_.find({"", userSearchString_, ""})) {
+        results_ = *page;
+    } else {
+        results_      = locallyFilteredResults();
         canFetchMore_ = true;
+    }
     endResetModel();
+
+    setSearchingUsers(canFetchMore_);
+    if (canFetchMore_)
+        searchTimer_.start();
+    else
+        searchTimer_.stop();
+}
+
+std::vector<mtx::responses::User>
+UserDirectoryModel::locallyFilteredResults() const
+{
+    const std::vector<mtx::responses::User> *best = nullptr;
+    std::size_t bestLength                        = 0;
+    for (const auto &[key, users] : cache_.pages()) {
+        const auto &term = std::get<1>(key);
+        if (term.size() > bestLength && userSearchString_.compare(0, term.size(), term) == 0) {
+            best       = &users;
+            bestLength = term.size();
+        }
+    }
+
+    std::vector<mtx::responses::User> results;
+    if (!best)
+        return results;
+
+    auto term = QString::fromStdString(userSearchString_);
+    for (const auto &user : *best)
+        if (QString::fromStdString(user.display_name).contains(term, Qt::CaseInsensitive) ||
+            QString::fromStdString(user.user_id).contains(term, Qt::CaseInsensitive))
+            results.push_back(user);
+    return results;
+}
+
+void
+UserDirectoryModel::setSearchingUsers(bool searching)
+{
+    if (searchingUsers_ == searching)
+        return;
+    searchingUsers_ = searching;
+    emit searchingUsersChanged();
 }
 
 void
 UserDirectoryModel::fetchMore(const QModelIndex &)
 {
-    if (!canFetchMore_)
+    if (!canFetchMore_ || requestRunning_ || searchTimer_.isActive())
+        return;
+
+    sendSearch();
+}
+
+void
+UserDirectoryModel::sendSearch()
+{
+    if (!canFetchMore_ || requestRunning_)
         return;
 
     nhlog::net()->debug("Fetching users from mtxclient...");
     std::string searchTerm = userSearchString_;
-    searchingUsers_        = true;
-    emit searchingUsersChanged();
-    auto job = QSharedPointer<FetchUsersFromDirectoryJob>::create();
+    requestRunning_        = true;
+    auto job               = QSharedPointer<FetchUsersFromDirectoryJob>::create();
     connect(job.data(),
             &FetchUsersFromDirectoryJob::fetchedSearchResults,
             this,
             &UserDirectoryModel::displaySearchResults);
+    connect(job.data(),
+            &FetchUsersFromDirectoryJob::searchFailed,
+            this,
+            &UserDirectoryModel::searchFailed);
     http::client()->search_user_directory(
       searchTerm,
       [job, searchTerm](const mtx::responses::Users &res, mtx::http::RequestErr err) {
@@ -64,6 +132,7 @@ UserDirectoryModel::fetchMore(const QModelIndex &)
                                   mtx::errors::to_string(err->matrix_error.errcode),
                                   err->matrix_error.error,
                                   err->parse_error);
+              emit job->searchFailed(searchTerm);
           } else {
               emit job->fetchedSearchResults(res.results, searchTerm);
           }
@@ -91,16 +160,38 @@ void
 UserDirectoryModel::displaySearchResults(std::vector<mtx::responses::User> results,
                                          const std::string &searchTerm)
 {
-    if (searchTerm != this->userSearchString_)
+    requestRunning_ = false;
+    cache_.insert({"", searchTerm, ""}, results);
+
+    if (searchTerm != this->userSearchString_) {
+        // the search string changed while we were waiting
+        if (!searchTimer_.isActive())
+            sendSearch();
         return;
-    searchingUsers_ = false;
-    emit searchingUsersChanged();
-    if (results.empty()) {
+    }
+
+    canFetchMore_ = false;
+    setSearchingUsers(false);
+    if (results.empty())
         nhlog::net()->debug("mtxclient helper thread yielded no results!");
+
+    beginResetModel();
+    results_ = std::move(results);
+    endResetModel();
+}
+
+void
+UserDirectoryModel::searchFailed(const std::string &searchTerm)
+{
+    requestRunning_ = false;
+
+    if (searchTerm != this->userSearchString_) {
+        if (!searchTimer_.isActive())
+            sendSearch();
         return;
     }
-    beginInsertRows(QModelIndex(), 0, static_cast<int>(results.size()) - 1);
-    results_ = results;
-    endInsertRows();
+
+    // keep the locally filtered results and don't retry until the search string changes
     canFetchMore_ = false;
+    setSearchingUsers(false);
 }
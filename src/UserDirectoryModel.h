@@ -6,11 +6,14 @@
 
 #include <QAbstractListModel>
 #include <QString>
+#include <QTimer>
 #include <string>
 #include <vector>
 
 #include <mtx/responses/users.hpp>
 
+#include "SearchPageCache.h"
+
 class FetchUsersFromDirectoryJob final : public QObject
 {
     Q_OBJECT
@@ -22,6 +25,7 @@ public:
 signals:
     void
     fetchedSearchResults(std::vector<mtx::responses::User> results, const std::string &searchTerm);
+    void searchFailed(const std::string &searchTerm);
 };
 class UserDirectoryModel : public QAbstractListModel
 {
@@ -51,10 +55,18 @@ public:
     void fetchMore(const QModelIndex &) override;
 
 private:
+    //! Results of earlier searches, that also match the search string, until the server answers.
+    std::vector<mtx::responses::User> locallyFilteredResults() const;
+    void setSearchingUsers(bool searching);
+
     std::vector<mtx::responses::User> results_;
     std::string userSearchString_;
     bool searchingUsers_{false};
     bool canFetchMore_{false};
+    //! Only one search is sent at a time, the latest search string is sent when it finishes.
+    bool requestRunning_{false};
+    QTimer searchTimer_;
+    SearchPageCache<std::vector<mtx::responses::User>> cache_{32};
 
 signals:
     void searchingUsersChanged();
@@ -64,6 +76,8 @@ public slots:
     bool searchingUsers() const { return searchingUsers_; }
 
 private slots:
+    void sendSearch();
     void
     displaySearchResults(std::vector<mtx::responses::User> results, const std::string &searchTerm);
+    void searchFailed(const std::string &searchTerm);
 };
@@ -16,8 +16,10 @@
 #include "Cache.h"
 #include "Config.h"
 #include "JdenticonProvider.h"
+#include "Logging.h"
 #include "MainWindow.h"
 #include "MatrixClient.h"
+#include "Metrics.h"
 #include "UserSettingsPage.h"
 #include "Utils.h"
 #include "encryption/Olm.h"
@@ -98,6 +100,7 @@ UserSettings::load(std::optional<QString> profile)
     privacyScreenTimeout_ =
       settings.value(QStringLiteral("user/privacy_screen_timeout"), 0).toInt();
     exposeDBusApi_ = settings.value(QStringLiteral("user/expose_dbus_api"), false).toBool();
+    slidingSync_   = settings.value(QStringLiteral("user/sliding_sync"), false).toBool();
 
     mobileMode_ = settings.value(QStringLiteral("user/mobile_mode"), false).toBool();
     emojiFont_  = settings.value(QStringLiteral("user/emoji_font_family"), "emoji").toString();
@@ -293,6 +296,17 @@ UserSettings::setExposeDBusApi(bool state)
     save();
 }
 
+void
+UserSettings::setSlidingSync(bool state)
+{
+    if (slidingSync_ == state)
+        return;
+
+    slidingSync_ = state;
+    emit slidingSyncChanged(state);
+    save();
+}
+
 void
 UserSettings::setMarkdown(bool state)
 {
@@ -901,6 +915,7 @@ UserSettings::save()
     settings.setValue(QStringLiteral("open_image_external"), openImageExternal_);
     settings.setValue(QStringLiteral("open_video_external"), openVideoExternal_);
     settings.setValue(QStringLiteral("expose_dbus_api"), exposeDBusApi_);
+    settings.setValue(QStringLiteral("sliding_sync"), slidingSync_);
 
     settings.endGroup(); // user
 
@@ -954,10 +969,22 @@ UserSettingsModel::roleNames() const
     return roles;
 }
 
+bool
+UserSettingsModel::showDebugRows() const
+{
+    return nhlog::ui()->should_log(spdlog::level::debug);
+}
+
+int
+UserSettingsModel::rowCount(const QModelIndex &) const
+{
+    return showDebugRows() ? (int)COUNT : (int)DebugSection;
+}
+
 QVariant
 UserSettingsModel::data(const QModelIndex &index, int role) const
 {
-    if (index.row() >= COUNT)
+    if (index.row() >= rowCount())
         return {};
 
     auto i = UserSettings::instance();
@@ -1066,10 +1093,16 @@ UserSettingsModel::data(const QModelIndex &index, int role) const
             return tr("Device Fingerprint");
         case Homeserver:
             return tr("Homeserver");
+        case SlidingSync:
+            return tr("Sliding sync (experimental)");
         case Version:
             return tr("Version");
         case Platform:
             return tr("Platform");
+        case DebugSection:
+            return tr("DEBUG");
+        case PerformanceMetrics:
+            return tr("Performance metrics");
         case GeneralSection:
             return tr("GENERAL");
         case AccessibilitySection:
@@ -1219,10 +1252,14 @@ UserSettingsModel::data(const QModelIndex &index, int role) const
             return utils::humanReadableFingerprint(olm::client()->identity_keys().ed25519);
         case Homeserver:
             return i->homeserver();
+        case SlidingSync:
+            return i->slidingSync();
         case Version:
             return QString::fromStdString(nheko::version);
         case Platform:
             return QString::fromStdString(nheko::build_os);
+        case PerformanceMetrics:
+            return metrics::report();
         case OnlineBackupKey:
             return cache::secret(mtx::secret_storage::secrets::megolm_backup_v1).has_value();
         case SelfSigningKey:
@@ -1369,6 +1406,7 @@ UserSettingsModel::data(const QModelIndex &index, int role) const
         case Homeserver:
         case Version:
         case Platform:
+        case DebugSection:
         case GeneralSection:
         case AccessibilitySection:
         case TimelineSection:
@@ -1381,6 +1419,10 @@ UserSettingsModel::data(const QModelIndex &index, int role) const
         case SessionKeys:
         case CrossSigningSecrets:
             return {};
+        case PerformanceMetrics:
+            return tr("Timings and counters of the sync loop, database, decryption and media "
+                      "cache since the start. Times are in milliseconds, percentiles are upper "
+                      "bounds.");
         case OnlineBackupKey:
             return tr(
               "The key to decrypt online key backups. If it is cached, you can enable online "
@@ -1399,6 +1441,11 @@ UserSettingsModel::data(const QModelIndex &index, int role) const
               "Your most important key. You don't need to have it cached, since not caching "
               "it makes it less likely it can be stolen and it is only needed to rotate your "
               "other signing keys.");
+        case SlidingSync:
+            return tr("Only sync the rooms at the top of the room list and the open room, which "
+                      "makes syncing much faster for accounts in many rooms. Other rooms are "
+                      "loaded when you scroll to them. Falls back to the normal sync, if your "
+                      "homeserver does not support it.");
         case ExposeDBusApi:
             return tr("Allow third-party plugins and applications to load information about rooms "
                       "you are in via D-Bus. "
@@ -1453,6 +1500,7 @@ UserSettingsModel::data(const QModelIndex &index, int role) const
         case ShareKeysWithTrustedUsers:
         case UseOnlineKeyBackup:
         case ExposeDBusApi:
+        case SlidingSync:
         case SpaceNotifications:
         case FancyEffects:
         case ReducedMotion:
@@ -1465,6 +1513,7 @@ UserSettingsModel::data(const QModelIndex &index, int role) const
         case Homeserver:
         case Version:
         case Platform:
+        case PerformanceMetrics:
             return ReadOnlyText;
         case GeneralSection:
         case AccessibilitySection:
@@ -1475,6 +1524,7 @@ UserSettingsModel::data(const QModelIndex &index, int role) const
         case VoipSection:
         case EncryptionSection:
         case LoginInfoSection:
+        case DebugSection:
             return SectionTitle;
         case SessionKeys:
             return SessionKeyImportExport;
@@ -1938,6 +1988,13 @@ UserSettingsModel::setData(const QModelIndex &index, const QVariant &value, int
             } else
                 return false;
         }
+        case SlidingSync: {
+            if (value.userType() == QMetaType::Bool) {
+                i->setSlidingSync(value.toBool());
+                return true;
+            } else
+                return false;
+        }
         }
     }
     return false;
@@ -2039,10 +2096,26 @@ UserSettingsModel::downloadCrossSigningSecrets()
     olm::download_cross_signing_keys();
 }
 
+void
+UserSettingsModel::setPageVisible(bool visible)
+{
+    if (!visible || !showDebugRows()) {
+        metricsTimer_.stop();
+    } else if (!metricsTimer_.isActive()) {
+        emit dataChanged(index(PerformanceMetrics), index(PerformanceMetrics), {Value});
+        metricsTimer_.start();
+    }
+}
+
 UserSettingsModel::UserSettingsModel(QObject *p)
   : QAbstractListModel(p)
 {
     auto s = UserSettings::instance();
+
+    metricsTimer_.setInterval(std::chrono::seconds(2));
+    connect(&metricsTimer_, &QTimer::timeout, this, [this]() {
+        emit dataChanged(index(PerformanceMetrics), index(PerformanceMetrics), {Value});
+    });
     connect(s.get(), &UserSettings::themeChanged, this, [this]() {
         emit dataChanged(index(Theme), index(Theme), {Value});
     });
@@ -2187,4 +2260,7 @@ UserSettingsModel::UserSettingsModel(QObject *p)
     connect(s.get(), &UserSettings::exposeDBusApiChanged, this, [this] {
         emit dataChanged(index(ExposeDBusApi), index(ExposeDBusApi), {Value});
     });
+    connect(s.get(), &UserSettings::slidingSyncChanged, this, [this] {
+        emit dataChanged(index(SlidingSync), index(SlidingSync), {Value});
+    });
 }
@@ -8,6 +8,7 @@
 #include <QProcessEnvironment>
 #include <QSettings>
 #include <QSharedPointer>
+#include <QTimer>
 
 #include <optional>
 
@@ -121,6 +122,7 @@ class UserSettings final : public QObject
                  hiddenWidgetsChanged)
     Q_PROPERTY(
       bool exposeDBusApi READ exposeDBusApi WRITE setExposeDBusApi NOTIFY exposeDBusApiChanged)
+    Q_PROPERTY(bool slidingSync READ slidingSync WRITE setSlidingSync NOTIFY slidingSyncChanged)
 
     UserSettings();
 
@@ -205,6 +207,7 @@ public:
     void setOpenVideoExternal(bool state);
     void setCollapsedSpaces(QList<QStringList> spaces);
     void setExposeDBusApi(bool state);
+    void setSlidingSync(bool state);
 
     QString theme() const { return !theme_.isEmpty() ? theme_ : defaultTheme_; }
     bool messageHoverHighlight() const { return messageHoverHighlight_; }
@@ -277,6 +280,7 @@ public:
     bool openVideoExternal() const { return openVideoExternal_; }
     QList<QStringList> collapsedSpaces() const { return collapsedSpaces_; }
     bool exposeDBusApi() const { return exposeDBusApi_; }
+    bool slidingSync() const { return slidingSync_; }
 
 signals:
     void groupViewStateChanged(bool state);
@@ -339,6 +343,7 @@ signals:
     void hiddenWidgetsChanged();
     void recentReactionsChanged();
     void exposeDBusApiChanged(bool state);
+    void slidingSyncChanged(bool state);
 
 private:
     // Default to system theme if QT_QPA_PLATFORMTHEME var is set.
@@ -410,6 +415,7 @@ private:
     bool openImageExternal_;
     bool openVideoExternal_;
     bool exposeDBusApi_;
+    bool slidingSync_;
 
     QSettings settings;
 
@@ -498,9 +504,14 @@ class UserSettingsModel final : public QAbstractListModel
         LoginInfoSection,
         UserId,
         Homeserver,
+        SlidingSync,
         Profile,
         Version,
         Platform,
+
+        // only shown, when debug logging is enabled
+        DebugSection,
+        PerformanceMetrics,
         COUNT,
         // hidden for now
         AccessToken,
@@ -544,11 +555,7 @@ public:
 
     UserSettingsModel(QObject *parent = nullptr);
     QHash<int, QByteArray> roleNames() const override;
-    int rowCount(const QModelIndex &parent = QModelIndex()) const override
-    {
-        (void)parent;
-        return (int)COUNT;
-    }
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
     QVariant data(const QModelIndex &index, int role) const override;
     bool setData(const QModelIndex &index, const QVariant &value, int role) override;
 
@@ -556,4 +563,12 @@ public:
     Q_INVOKABLE void exportSessionKeys();
     Q_INVOKABLE void requestCrossSigningSecrets();
     Q_INVOKABLE void downloadCrossSigningSecrets();
+    //! Called by the settings page, so that the metrics are only refreshed while it is shown.
+    Q_INVOKABLE void setPageVisible(bool visible);
+
+private:
+    bool showDebugRows() const;
+
+    //! Refreshes the performance metrics while they are shown.
+    QTimer metricsTimer_;
 };
@@ -15,6 +15,7 @@ init()
     qDBusRegisterMetaType<RoomInfoItem>();
     qDBusRegisterMetaType<QVector<RoomInfoItem>>();
     qDBusRegisterMetaType<QImage>();
+    qDBusRegisterMetaType<QMap<QString, QString>>();
 }
 
 bool
@@ -118,6 +119,23 @@ rooms()
         return {};
 }
 
+QVector<RoomInfoItem>
+roomsSince(quint64 since, QStringList &removedRooms, quint64 &generation)
+{
+    if (QDBusInterface interface{QStringLiteral(NHEKO_DBUS_SERVICE_NAME), QStringLiteral("/")};
+        interface.isValid()) {
+        auto reply = interface.call(QStringLiteral("roomsSince"), since);
+        if (reply.type() != QDBusMessage::ReplyMessage || reply.arguments().size() != 3)
+            return {};
+
+        const auto &args = reply.arguments();
+        removedRooms     = args.at(1).toStringList();
+        generation       = args.at(2).toULongLong();
+        return qdbus_cast<QVector<RoomInfoItem>>(args.at(0));
+    } else
+        return {};
+}
+
 QImage
 image(const QString &mxcuri)
 {
@@ -128,6 +146,28 @@ image(const QString &mxcuri)
         return {};
 }
 
+QMap<QString, QString>
+images(const QStringList &uris, int size)
+{
+    if (QDBusInterface interface{QStringLiteral(NHEKO_DBUS_SERVICE_NAME), QStringLiteral("/")};
+        interface.isValid())
+        return QDBusReply<QMap<QString, QString>>{
+          interface.call(QStringLiteral("images"), uris, size)}
+          .value();
+    else
+        return {};
+}
+
+QVariantMap
+metrics()
+{
+    if (QDBusInterface interface{QStringLiteral(NHEKO_DBUS_SERVICE_NAME), QStringLiteral("/")};
+        interface.isValid())
+        return QDBusReply<QVariantMap>{interface.call(QStringLiteral("metrics"))}.value();
+    else
+        return {};
+}
+
 void
 activateRoom(const QString &alias)
 {
@@ -8,6 +8,7 @@
 #include <QDBusArgument>
 #include <QIcon>
 #include <QObject>
+#include <QVariantMap>
 #include <QVersionNumber>
 
 namespace nheko::dbus {
@@ -18,7 +19,11 @@ init();
 
 //! The nheko D-Bus API version provided by this file. The API version number follows semantic
 //! versioning as defined by https://semver.org.
-inline const QVersionNumber dbusApiVersion{1, 0, 1};
+inline const QVersionNumber dbusApiVersion{1, 3, 0};
+
+//! Returned by roomsSince as the only removed room, if the rooms left since the passed generation
+//! are not known anymore. The result then contains all joined rooms, every other room was left.
+inline const QString fullSnapshotMarker = QStringLiteral("*");
 
 //! Compare the installed Nheko API to the version that your client app targets to see if they
 //! are compatible.
@@ -67,9 +72,24 @@ nhekoVersion();
 //! Call this function to get a list of all joined rooms.
 QVector<RoomInfoItem>
 rooms();
+//! Get the joined rooms, that changed after the given generation of the room list, and the ids of
+//! the rooms that were left since then. Pass 0 to get all rooms. `generation` is set to the
+//! generation to pass next time. The RoomsChanged signal carries the same changes as they happen.
+//! If `since` is too old, all rooms and the fullSnapshotMarker are returned.
+QVector<RoomInfoItem>
+roomsSince(quint64 since, QStringList &removedRooms, quint64 &generation);
 //! Fetch an image using a matrix URI
 QImage
 image(const QString &uri);
+//! Fetch thumbnails of size x size pixels for a batch of matrix URIs. Returns the paths of the
+//! cached image files by URI, which are empty for images that could not be fetched. Encrypted
+//! images are never stored decrypted, so they are empty as well; use image() for them.
+QMap<QString, QString>
+images(const QStringList &uris, int size);
+//! Get the performance metrics of the running nheko instance by name. Histograms are maps with
+//! count, sum, max, p50, p90 and p99.
+QVariantMap
+metrics();
 //! Activates a currently joined room.
 void
 activateRoom(const QString &alias);
@@ -4,81 +4,297 @@
 
 #include "NhekoDBusBackend.h"
 
-#include <mutex>
+#include <algorithm>
 
 #include "Cache.h"
 #include "Cache_p.h"
 #include "ChatPage.h"
 #include "Logging.h"
 #include "MainWindow.h"
+#include "Metrics.h"
 #include "MxcImageProvider.h"
 #include "timeline/RoomlistModel.h"
 
 #include <QDBusConnection>
+#include <QFileInfo>
+#include <QTimer>
+
+#include <memory>
+
+namespace {
+//! How many left rooms are remembered for roomsSince.
+constexpr int maxRemovedRooms = 256;
+}
 
 NhekoDBusBackend::NhekoDBusBackend(RoomlistModel *parent)
   : QObject{parent}
   , m_parent{parent}
 {
+    connect(m_parent,
+            &RoomlistModel::dataChanged,
+            this,
+            [this](const QModelIndex &topLeft,
+                   const QModelIndex &bottomRight,
+                   const QVector<int> &roles) {
+                if (roles.isEmpty() || roles.contains(RoomlistModel::RoomName) ||
+                    roles.contains(RoomlistModel::AvatarUrl) ||
+                    roles.contains(RoomlistModel::NotificationCount))
+                    markRowsChanged(topLeft.row(), bottomRight.row());
+            });
+    connect(m_parent,
+            &RoomlistModel::rowsInserted,
+            this,
+            [this](const QModelIndex &, int first, int last) { markRowsChanged(first, last); });
+    connect(m_parent,
+            &RoomlistModel::rowsAboutToBeRemoved,
+            this,
+            [this](const QModelIndex &, int first, int last) { markRowsChanged(first, last); });
+    connect(m_parent, &RoomlistModel::modelReset, this, [this]() {
+        for (auto it = m_rooms.keyBegin(); it != m_rooms.keyEnd(); ++it)
+            markChanged(*it);
+        markRowsChanged(0, m_parent->rowCount() - 1);
+    });
+
+    markRowsChanged(0, m_parent->rowCount() - 1);
+    flushChanges();
 }
 
 namespace {
-struct RoomReplyState
+nheko::dbus::RoomInfoItem
+roomInfoItem(const TimelineModel &room)
 {
-    QVector<nheko::dbus::RoomInfoItem> model;
-    std::map<QString, RoomInfo> roominfos;
-    std::mutex m;
-};
+    const auto aliases = cache::client()->getStateEvent<mtx::events::state::CanonicalAlias>(
+      room.roomId().toStdString());
+    QString alias;
+    if (aliases.has_value()) {
+        const auto &val = aliases.value().content;
+        if (!val.alias.empty())
+            alias = QString::fromStdString(val.alias);
+        else if (val.alt_aliases.size() > 0)
+            alias = QString::fromStdString(val.alt_aliases.front());
+    }
+
+    return nheko::dbus::RoomInfoItem{room.roomId(),
+                                     alias,
+                                     room.plainRoomName(),
+                                     room.roomAvatarUrl(),
+                                     room.notificationCount()};
 }
 
-QVector<nheko::dbus::RoomInfoItem>
-NhekoDBusBackend::rooms() const
+bool
+sameRoomInfo(const nheko::dbus::RoomInfoItem &a, const nheko::dbus::RoomInfoItem &b)
 {
-    nhlog::ui()->debug("Rooms requested over D-Bus.");
+    return a.alias() == b.alias() && a.roomName() == b.roomName() &&
+           a.avatarUrl() == b.avatarUrl() && a.unreadNotifications() == b.unreadNotifications();
+}
+}
 
-    const auto roomListModel = m_parent->models;
-    QVector<nheko::dbus::RoomInfoItem> model;
+void
+NhekoDBusBackend::markChanged(const QString &roomId)
+{
+    m_changedRooms.insert(roomId);
+
+    if (!m_flushScheduled) {
+        m_flushScheduled = true;
+        QTimer::singleShot(0, this, &NhekoDBusBackend::flushChanges);
+    }
+}
 
-    for (const auto &room : roomListModel) {
-        const auto aliases = cache::client()->getStateEvent<mtx::events::state::CanonicalAlias>(
-          room->roomId().toStdString());
-        QString alias;
-        if (aliases.has_value()) {
-            const auto &val = aliases.value().content;
-            if (!val.alias.empty())
-                alias = QString::fromStdString(val.alias);
-            else if (val.alt_aliases.size() > 0)
-                alias = QString::fromStdString(val.alt_aliases.front());
+void
+NhekoDBusBackend::markRowsChanged(int first, int last)
+{
+    for (int row = std::max(first, 0); row <= last && row < m_parent->rowCount(); row++)
+        markChanged(m_parent->roomids[row]);
+}
+
+void
+NhekoDBusBackend::flushChanges()
+{
+    m_flushScheduled = false;
+    if (m_changedRooms.isEmpty())
+        return;
+
+    auto snapshot = cache::client()->readSnapshot();
+
+    QVector<nheko::dbus::RoomInfoItem> changed;
+    QStringList removed;
+    quint64 generation = m_generation + 1;
+
+    for (const auto &roomId : qAsConst(m_changedRooms)) {
+        auto room = m_parent->getRoomById(roomId);
+        if (room) {
+            auto item   = roomInfoItem(*room);
+            auto cached = m_rooms.find(roomId);
+            if (cached != m_rooms.end() && sameRoomInfo(cached->item, item))
+                continue;
+
+            m_rooms.insert(roomId, CachedRoom{item, generation});
+            m_removedRooms.remove(roomId);
+            changed.push_back(std::move(item));
+        } else if (m_rooms.remove(roomId)) {
+            m_removedRooms.insert(roomId, generation);
+            removed.push_back(roomId);
         }
+    }
+    m_changedRooms.clear();
 
-        model.push_back(nheko::dbus::RoomInfoItem{room->roomId(),
-                                                  alias,
-                                                  room->plainRoomName(),
-                                                  room->roomAvatarUrl(),
-                                                  room->notificationCount()});
+    // forget the oldest left rooms, clients that last synced before them get all rooms instead
+    while (m_removedRooms.size() > maxRemovedRooms) {
+        auto oldest = std::min_element(m_removedRooms.begin(), m_removedRooms.end());
+        m_removedRoomsPrunedAt = std::max(m_removedRoomsPrunedAt, oldest.value());
+        m_removedRooms.erase(oldest);
     }
 
+    if (changed.isEmpty() && removed.isEmpty())
+        return;
+
+    m_generation = generation;
+    emit RoomsChanged(m_generation, changed, removed);
+}
+
+QVector<nheko::dbus::RoomInfoItem>
+NhekoDBusBackend::rooms()
+{
+    nhlog::ui()->debug("Rooms requested over D-Bus.");
+
+    QStringList removed;
+    quint64 generation;
+    auto model = roomsSince(0, removed, generation);
+
     nhlog::ui()->debug("Sending {} rooms over D-Bus...", model.size());
     return model;
 }
 
-QImage
-NhekoDBusBackend::image(const QString &uri, const QDBusMessage &message) const
+QVector<nheko::dbus::RoomInfoItem>
+NhekoDBusBackend::roomsSince(quint64 since, QStringList &removedRooms, quint64 &generation)
 {
-    message.setDelayedReply(true);
-    nhlog::ui()->debug("Rooms requested over D-Bus.");
-    MainWindow::instance()->imageProvider()->download(
+    flushChanges();
+
+    // the client may have missed some of the forgotten left rooms
+    if (since > 0 && since < m_removedRoomsPrunedAt) {
+        since = 0;
+        removedRooms.push_back(nheko::dbus::fullSnapshotMarker);
+    }
+
+    QVector<nheko::dbus::RoomInfoItem> model;
+    for (const auto &room : qAsConst(m_rooms))
+        if (room.generation > since)
+            model.push_back(room.item);
+
+    if (since > 0)
+        for (auto it = m_removedRooms.constBegin(); it != m_removedRooms.constEnd(); ++it)
+            if (it.value() > since)
+                removedRooms.push_back(it.key());
+
+    generation = m_generation;
+    return model;
+}
+
+namespace {
+QString
+imageKey(const QString &uri, const QSize &size)
+{
+    return QStringLiteral("%1_%2x%3").arg(uri).arg(size.width()).arg(size.height());
+}
+}
+
+void
+NhekoDBusBackend::fetchImage(const QString &uri, const QSize &size, ImageCallback callback)
+{
+    auto key      = imageKey(uri, size);
+    auto &waiting = m_pendingImages[key];
+    waiting.push_back(std::move(callback));
+    if (waiting.size() > 1)
+        return;
+
+    // the cached file of encrypted media is ciphertext, so only the image itself can be shared
+    const bool encrypted = MxcImageProvider::isEncrypted(uri);
+
+    MxcImageProvider::download(
       QString(uri).remove("mxc://"),
-      {96, 96},
-      [message](const QString &, const QSize &, const QImage &image, const QString &) {
-          auto reply = message.createReply();
-          reply << QVariant::fromValue(image);
-          QDBusConnection::sessionBus().send(reply);
+      size,
+      [this, key, encrypted](
+        const QString &, const QSize &, const QImage &image, const QString &downloadedPath) {
+          auto path = encrypted || image.isNull() ? QString() : downloadedPath;
+
+          // downloads can finish on the network thread
+          QMetaObject::invokeMethod(
+            this,
+            [this, key, image, path]() {
+                if (!path.isEmpty())
+                    m_imagePaths.insert(key, path);
+
+                auto callbacks = m_pendingImages.take(key);
+                for (const auto &callback : callbacks)
+                    callback(image, path);
+            },
+            Qt::QueuedConnection);
       },
       true);
+}
+
+QImage
+NhekoDBusBackend::image(const QString &uri, const QDBusMessage &message)
+{
+    message.setDelayedReply(true);
+    nhlog::ui()->debug("Image requested over D-Bus.");
+    fetchImage(uri, {96, 96}, [message](const QImage &image, const QString &) {
+        auto reply = message.createReply();
+        reply << QVariant::fromValue(image);
+        QDBusConnection::sessionBus().send(reply);
+    });
+    return {};
+}
+
+QMap<QString, QString>
+NhekoDBusBackend::images(const QStringList &uris, int size, const QDBusMessage &message)
+{
+    nhlog::ui()->debug("{} images requested over D-Bus.", uris.size());
+
+    QSize imageSize(std::clamp(size, 16, 512), std::clamp(size, 16, 512));
+
+    struct PendingReply
+    {
+        QDBusMessage message;
+        QMap<QString, QString> paths;
+        int missing = 0;
+    };
+    auto reply     = std::make_shared<PendingReply>();
+    reply->message = message;
+
+    QStringList toFetch;
+    for (const auto &uri : uris) {
+        auto path = m_imagePaths.value(imageKey(uri, imageSize));
+        if (!path.isEmpty() && QFileInfo::exists(path))
+            reply->paths.insert(uri, path);
+        else if (!toFetch.contains(uri))
+            toFetch.push_back(uri);
+    }
+
+    if (toFetch.isEmpty())
+        return reply->paths;
+
+    message.setDelayedReply(true);
+    reply->missing = toFetch.size();
+    for (const auto &uri : qAsConst(toFetch)) {
+        fetchImage(uri, imageSize, [reply, uri](const QImage &, const QString &path) {
+            reply->paths.insert(uri, path);
+            if (--reply->missing == 0) {
+                auto r = reply->message.createReply();
+                r << QVariant::fromValue(reply->paths);
+                QDBusConnection::sessionBus().send(r);
+            }
+        });
+    }
     return {};
 }
 
+QVariantMap
+NhekoDBusBackend::metrics() const
+{
+    return ::metrics::snapshot();
+}
+
 void
 NhekoDBusBackend::activateRoom(const QString &alias) const
 {
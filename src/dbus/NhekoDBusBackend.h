@@ -6,7 +6,12 @@
 #define NHEKODBUSBACKEND_H
 
 #include <QDBusMessage>
+#include <QHash>
 #include <QObject>
+#include <QSet>
+
+#include <functional>
+#include <vector>
 
 #include "NhekoDBusApi.h"
 #include "config/nheko.h"
@@ -27,9 +32,22 @@ public slots:
     //! Get the nheko version.
     Q_SCRIPTABLE QString nhekoVersion() const { return nheko::version; }
     //! Call this function to get a list of all joined rooms.
-    Q_SCRIPTABLE QVector<nheko::dbus::RoomInfoItem> rooms() const;
+    Q_SCRIPTABLE QVector<nheko::dbus::RoomInfoItem> rooms();
+    //! Get the joined rooms, that changed after the given generation of the room list, and the
+    //! ids of the rooms that were left since then. Pass 0 to get all rooms. If the left rooms
+    //! are not known that far back, all rooms and the fullSnapshotMarker are returned.
+    Q_SCRIPTABLE QVector<nheko::dbus::RoomInfoItem>
+    roomsSince(quint64 since, QStringList &removedRooms, quint64 &generation);
     //! Call this function to convert a URI into an image
-    Q_SCRIPTABLE QImage image(const QString &uri, const QDBusMessage &message) const;
+    Q_SCRIPTABLE QImage image(const QString &uri, const QDBusMessage &message);
+    //! Fetch thumbnails of size x size pixels for a batch of URIs. Returns a map from each URI to
+    //! the path of the cached image file or an empty string, if it could not be fetched or is
+    //! encrypted.
+    Q_SCRIPTABLE QMap<QString, QString>
+    images(const QStringList &uris, int size, const QDBusMessage &message);
+    //! Get the performance metrics by name. Histograms are maps with count, sum, max, p50, p90
+    //! and p99.
+    Q_SCRIPTABLE QVariantMap metrics() const;
     //! Activates a currently joined room.
     Q_SCRIPTABLE void activateRoom(const QString &alias) const;
     //! Joins a room. It is your responsibility to ask for confirmation (if desired).
@@ -40,10 +58,45 @@ public slots:
     //! Sets the user's status message.
     Q_SCRIPTABLE void setStatusMessage(const QString &message);
 
+signals:
+    //! Emitted when the name, alias, avatar or unread count of joined rooms changed or rooms were
+    //! left. Carries only the changed rooms.
+    Q_SCRIPTABLE void RoomsChanged(quint64 generation,
+                                   const QVector<nheko::dbus::RoomInfoItem> &rooms,
+                                   const QStringList &removedRooms);
+
 private:
+    struct CachedRoom
+    {
+        nheko::dbus::RoomInfoItem item;
+        quint64 generation;
+    };
+    using ImageCallback = std::function<void(const QImage &image, const QString &path)>;
+
     void bringWindowToTop() const;
+    void markChanged(const QString &roomId);
+    void markRowsChanged(int first, int last);
+    //! Refresh the changed rooms in the room table and notify listeners.
+    void flushChanges();
+    //! Download an image once, even if it is requested again before the download finished.
+    void fetchImage(const QString &uri, const QSize &size, ImageCallback callback);
 
     RoomlistModel *m_parent;
+
+    //! Room list as sent over D-Bus, so that requests don't have to touch the database.
+    QHash<QString, CachedRoom> m_rooms;
+    //! room id -> generation, in which the room was left
+    QHash<QString, quint64> m_removedRooms;
+    //! The left rooms up to this generation were forgotten, to keep m_removedRooms bounded.
+    quint64 m_removedRoomsPrunedAt = 0;
+    QSet<QString> m_changedRooms;
+    quint64 m_generation  = 0;
+    bool m_flushScheduled = false;
+
+    //! uri and size -> cached image file
+    QHash<QString, QString> m_imagePaths;
+    //! uri and size -> callbacks waiting for the download
+    QHash<QString, std::vector<ImageCallback>> m_pendingImages;
 };
 
 #endif // NHEKODBUSBACKEND_H
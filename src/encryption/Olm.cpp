@@ -9,6 +9,8 @@
 #include <QTimer>
 
 #include <nlohmann/json.hpp>
+#include <atomic>
+#include <mutex>
 #include <variant>
 
 #include <mtx/responses/common.hpp>
@@ -21,12 +23,17 @@
 #include "EventAccessors.h"
 #include "Logging.h"
 #include "MatrixClient.h"
+#include "Metrics.h"
 #include "UserSettingsPage.h"
 #include "Utils.h"
 
 namespace {
 auto client_ = std::make_unique<mtx::crypto::OlmClient>();
 
+std::atomic<bool> loading_{false};
+std::mutex loadingMutex_;
+QFuture<void> pendingLoad_;
+
 std::map<std::string, std::string> request_id_to_secret_name;
 
 constexpr auto MEGOLM_ALGO = "m.megolm.v1.aes-sha2";
@@ -58,9 +65,29 @@ from_json(const nlohmann::json &obj, OlmMessage &msg)
 mtx::crypto::OlmClient *
 client()
 {
+    if (loading_.load()) {
+        QFuture<void> pending;
+        {
+            std::lock_guard<std::mutex> lock(loadingMutex_);
+            pending = pendingLoad_;
+        }
+        pending.waitForFinished();
+
+        std::lock_guard<std::mutex> lock(loadingMutex_);
+        if (pendingLoad_ == pending)
+            loading_ = false;
+    }
     return client_.get();
 }
 
+void
+setLoading(const QFuture<void> &loading)
+{
+    std::lock_guard<std::mutex> lock(loadingMutex_);
+    pendingLoad_ = loading;
+    loading_     = !loading.isFinished();
+}
+
 static void
 handle_secret_request(const mtx::events::DeviceEvent<mtx::events::msg::SecretRequest> *e,
                       const std::string &sender)
@@ -1221,10 +1248,10 @@ send_megolm_key_to_device(const std::string &user_id,
     nhlog::crypto()->debug("Forwarded key to {}:{}", user_id, device_id);
 }
 
-DecryptionResult
-decryptEvent(const MegolmSessionIndex &index,
-             const mtx::events::EncryptedEvent<mtx::events::msg::Encrypted> &event,
-             bool dont_write_db)
+static DecryptionResult
+decryptMegolmEvent(const MegolmSessionIndex &index,
+                   const mtx::events::EncryptedEvent<mtx::events::msg::Encrypted> &event,
+                   bool dont_write_db)
 {
     try {
         if (!cache::client()->inboundMegolmSessionExists(index)) {
@@ -1285,6 +1312,26 @@ decryptEvent(const MegolmSessionIndex &index,
     }
 }
 
+DecryptionResult
+decryptEvent(const MegolmSessionIndex &index,
+             const mtx::events::EncryptedEvent<mtx::events::msg::Encrypted> &event,
+             bool dont_write_db)
+{
+    static auto &decrypted      = metrics::counter("crypto.decrypted");
+    static auto &missingSession = metrics::counter("crypto.missing_session");
+    static auto &failed         = metrics::counter("crypto.decryption_failed");
+
+    auto result = decryptMegolmEvent(index, event, dont_write_db);
+    if (result.error == DecryptionErrorCode::NoError)
+        decrypted.add();
+    else if (result.error == DecryptionErrorCode::MissingSession ||
+             result.error == DecryptionErrorCode::MissingSessionIndex)
+        missingSession.add();
+    else
+        failed.add();
+    return result;
+}
+
 crypto::Trust
 calculate_trust(const std::string &user_id, const MegolmSessionIndex &index)
 {
@@ -5,6 +5,9 @@
 #pragma once
 
 #include <memory>
+
+#include <QFuture>
+
 #include <mtx/events.hpp>
 #include <mtx/events/encrypted.hpp>
 #include <mtxclient/crypto/client.hpp>
@@ -47,8 +50,14 @@ struct OlmMessage
 void
 from_json(const nlohmann::json &obj, OlmMessage &msg);
 
+//! The olm account. Waits while it is loaded on another thread, see setLoading().
 mtx::crypto::OlmClient *
 client();
+//! The account is loaded on another thread until `loading` finishes, so client() waits for it
+//! instead of handing out a half loaded account. The loading itself has to use the pointer it got
+//! from client() before.
+void
+setLoading(const QFuture<void> &loading);
 
 void
 handle_to_device_messages(const std::vector<mtx::events::collections::DeviceEvents> &msgs);
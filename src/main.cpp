@@ -25,6 +25,9 @@
 #include "Logging.h"
 #include "MainWindow.h"
 #include "MatrixClient.h"
+#include "MockHomeserver.h"
+#include "StartupProfile.h"
+#include "SyncReplay.h"
 #include "Utils.h"
 #include "config/nheko.h"
 #include "singleapplication.h"
@@ -150,6 +153,8 @@ createStandardDirectory(QStandardPaths::StandardLocation path)
 int
 main(int argc, char *argv[])
 {
+    startupprofile::begin("application setup");
+
     QCoreApplication::setApplicationName(QStringLiteral("nheko"));
     QCoreApplication::setApplicationVersion(nheko::version);
     QCoreApplication::setOrganizationName(QStringLiteral("nheko"));
@@ -240,8 +245,55 @@ main(int argc, char *argv[])
       QCoreApplication::tr("profile name"));
     parser.addOption(configName);
 
+    QCommandLineOption replaySync(
+      QStringLiteral("replay-sync"),
+      QCoreApplication::tr("Replay sync responses into a temporary cache, print timings and exit. "
+                           "Takes a directory of sync JSON files or "
+                           "'generate:<rooms>,<members>,<syncs>[,encrypted]'."),
+      QCoreApplication::tr("source"));
+    parser.addOption(replaySync);
+
+    QCommandLineOption mockHomeserver(
+      QStringLiteral("mock-homeserver"),
+      QCoreApplication::tr("Serve synthetic rooms, timelines, media and key backups as a local "
+                           "homeserver for load testing. Takes a comma separated list of "
+                           "port, rooms, members, history, latency (ms), bandwidth (bytes/s) and "
+                           "interval (ms), for example 'port=8008,rooms=100,latency=50'."),
+      QCoreApplication::tr("options"));
+    parser.addOption(mockHomeserver);
+
+    QCommandLineOption startupProfile(
+      QStringLiteral("startup-profile"),
+      QCoreApplication::tr("Log how long each phase of the startup took."));
+    parser.addOption(startupProfile);
+    QCommandLineOption startupTrace(
+      QStringLiteral("startup-trace"),
+      QCoreApplication::tr("Like --startup-profile, but also write a trace of the startup phases "
+                           "to the given file, which can be opened in chrome://tracing."),
+      QCoreApplication::tr("file"));
+    parser.addOption(startupTrace);
+
     parser.process(app);
 
+    // The replay uses a temporary profile of its own and the mock homeserver none, so they can run
+    // next to a running nheko.
+    if (parser.isSet(replaySync) || parser.isSet(mockHomeserver)) {
+        try {
+            nhlog::init(parser.isSet(logLevel) ? parser.value(logLevel)
+                                               : qEnvironmentVariable("NHEKO_LOG_LEVEL"),
+                        QString(),
+                        true);
+        } catch (const spdlog::spdlog_ex &ex) {
+            std::cerr << "Log initialization failed: " << ex.what() << std::endl;
+            return 1;
+        }
+        if (parser.isSet(mockHomeserver))
+            return MockHomeserver::run(parser.value(mockHomeserver));
+
+        http::init();
+        return syncreplay::run(parser.value(replaySync));
+    }
+
     // This check needs to happen _after_ process(), so that we actually print help for --help when
     // Nheko is already running.
     if (app.isSecondary()) {
@@ -311,6 +363,9 @@ main(int argc, char *argv[])
         std::exit(1);
     }
 
+    if (parser.isSet(startupProfile) || parser.isSet(startupTrace))
+        startupprofile::init(parser.value(startupTrace));
+
     if (parser.isSet(configName))
         UserSettings::initialize(parser.value(configName));
     else
@@ -343,7 +398,10 @@ main(int argc, char *argv[])
       QLocale(), QStringLiteral("nheko"), QStringLiteral("_"), QStringLiteral(":/translations"));
     app.installTranslator(&appTranslator);
 
+    startupprofile::end("application setup");
+    startupprofile::begin("main window");
     MainWindow w;
+    startupprofile::end("main window");
     // QQuickView w;
 
     // Move the MainWindow to the center
@@ -13,6 +13,7 @@
 #include "Logging.h"
 #include "MatrixClient.h"
 #include "Permissions.h"
+#include "StartupProfile.h"
 #include "UserSettingsPage.h"
 #include "Utils.h"
 #include "timeline/TimelineModel.h"
@@ -276,6 +277,8 @@ addChildren(temptree &t,
 void
 CommunitiesModel::initializeSidebar()
 {
+    startupprofile::Scope profile("initialize sidebar");
+
     beginResetModel();
     tags_.clear();
     spaceOrder_.tree.clear();
@@ -4,7 +4,14 @@
 
 #include "EventStore.h"
 
+#include <chrono>
+#include <optional>
+#include <set>
+
+#include <QDateTime>
+#include <QPointer>
 #include <QThread>
+#include <QThreadPool>
 #include <QTimer>
 
 #include <mtx/responses/common.hpp>
@@ -25,6 +32,34 @@ QCache<EventStore::IdIndex, olm::DecryptionResult> EventStore::decryptedEvents_{
 QCache<EventStore::IdIndex, mtx::events::collections::TimelineEvents> EventStore::events_by_id_{
   1000};
 QCache<EventStore::Index, mtx::events::collections::TimelineEvents> EventStore::events_{1000};
+int EventStore::sendsInFlight_ = 0;
+std::vector<QPointer<EventStore>> EventStore::waitingForSend_;
+
+namespace {
+//! Messages, reactions and other events of one room that are sent at the same time.
+constexpr size_t MAX_PARALLEL_SENDS_PER_ROOM = 4;
+//! Sends of all rooms at the same time.
+constexpr int MAX_PARALLEL_SENDS = 8;
+//! Pending events looked at for something that can be sent.
+constexpr size_t PENDING_LOOKAHEAD = 16;
+constexpr int RETRY_DELAY          = 1000;
+//! Read receipts for our own messages are collected for this long and only the latest is sent.
+constexpr int RECEIPT_DELAY = 500;
+
+//! Saves pages of history, so that logging out can wait for the pages still being saved.
+QThreadPool &
+historyPool()
+{
+    static QThreadPool pool;
+    return pool;
+}
+}
+
+void
+EventStore::waitForSavedHistory()
+{
+    historyPool().waitForDone();
+}
 
 EventStore::EventStore(std::string room_id, QObject *)
   : room_id_(std::move(room_id))
@@ -71,7 +106,41 @@ EventStore::EventStore(std::string room_id, QObject *)
               return;
           }
 
-          uint64_t newFirst = cache::client()->saveOldMessages(room_id_, res);
+          // Decrypting and storing a whole page of history takes a while, so keep it off the UI
+          // thread and only update the model once the page is committed.
+          // The store may be destroyed while the page is saved, for example when leaving the room,
+          // so the result is posted to the ChatPage and only then checked for the store.
+          historyPool().start(
+            [self = QPointer<EventStore>(this), room_id = room_id_, res] {
+                std::optional<uint64_t> newFirst;
+                try {
+                    newFirst = cache::client()->saveOldMessages(room_id, res);
+                } catch (const lmdb::error &e) {
+                    nhlog::db()->error("failed to save old messages of {}: {}", room_id, e.what());
+                } catch (const std::exception &e) {
+                    nhlog::db()->error("failed to save old messages of {}: {}", room_id, e.what());
+                }
+
+                QMetaObject::invokeMethod(
+                  ChatPage::instance(),
+                  [self, newFirst] {
+                      if (!self)
+                          return;
+                      if (newFirst)
+                          emit self->oldMessagesSaved(*newFirst);
+                      else
+                          emit self->fetchedMore();
+                  },
+                  Qt::QueuedConnection);
+            });
+      },
+      Qt::QueuedConnection);
+
+    connect(
+      this,
+      &EventStore::oldMessagesSaved,
+      this,
+      [this](uint64_t newFirst) {
           if (newFirst == first)
               fetchMore();
           else {
@@ -99,63 +168,58 @@ EventStore::EventStore(std::string room_id, QObject *)
       },
       Qt::QueuedConnection);
 
+    receiptTimer_.setInterval(RECEIPT_DELAY);
+    receiptTimer_.setSingleShot(true);
+    connect(&receiptTimer_, &QTimer::timeout, this, &EventStore::sendReadReceipt);
+
     connect(this, &EventStore::processPending, this, [this]() {
-        if (!current_txn.empty()) {
-            nhlog::ui()->debug("Already processing {}", current_txn);
+        auto events = cache::client()->pendingMessages(room_id_, PENDING_LOOKAHEAD);
+        if (events.empty()) {
+            nhlog::ui()->debug("No event to send");
             return;
         }
 
-        auto event = cache::client()->firstPendingMessage(room_id_);
+        const auto now = std::chrono::steady_clock::now();
 
-        if (!event) {
-            nhlog::ui()->debug("No event to send");
-            return;
-        }
+        // Messages are sent one after another, so they arrive in order. Reactions can be sent
+        // in between, once the event they refer to was sent.
+        std::set<std::string, std::less<>> earlier;
+        bool orderedBlocked = false;
+        for (const auto &event : events) {
+            const auto txn_id  = mtx::accessors::event_id(event.data);
+            const bool ordered = isOrdered(event.data);
 
-        std::visit(
-          [this](const auto &e) {
-              const auto &txn_id = e.event_id;
-              this->current_txn  = txn_id;
+            if (txn_id.empty() || txn_id[0] != 'm') {
+                nhlog::ui()->debug("Invalid txn id '{}'", txn_id);
+                cache::client()->removePendingStatus(room_id_, txn_id);
+                continue;
+            }
 
-              if (txn_id.empty() || txn_id[0] != 'm') {
-                  nhlog::ui()->debug("Invalid txn id '{}'", txn_id);
-                  cache::client()->removePendingStatus(room_id_, txn_id);
-                  return;
-              }
+            bool ready = !sending_.count(txn_id) && !(ordered && orderedBlocked);
+            if (auto failure = sendFailures_.find(txn_id);
+                failure != sendFailures_.end() && failure->second.retryAt > now)
+                ready = false;
+            for (const auto &rel : mtx::accessors::relations(event.data).relations)
+                if (earlier.count(rel.event_id))
+                    ready = false;
+
+            earlier.insert(txn_id);
+            if (ordered)
+                orderedBlocked = true;
+            if (!ready)
+                continue;
+
+            if (sending_.size() >= MAX_PARALLEL_SENDS_PER_ROOM)
+                break;
+            if (sendsInFlight_ >= MAX_PARALLEL_SENDS) {
+                waitingForSend_.emplace_back(this);
+                break;
+            }
 
-              if constexpr (mtx::events::message_content_to_type<decltype(e.content)> !=
-                            mtx::events::EventType::Unsupported)
-                  http::client()->send_room_message(
-                    room_id_,
-                    txn_id,
-                    e.content,
-                    [this, txn_id, e](const mtx::responses::EventId &event_id,
-                                      mtx::http::RequestErr err) {
-                        if (err) {
-                            const int status_code = static_cast<int>(err->status_code);
-                            nhlog::net()->warn("[{}] failed to send message: {} {}",
-                                               txn_id,
-                                               err->matrix_error.error,
-                                               status_code);
-                            emit messageFailed(txn_id);
-                            return;
-                        }
-
-                        emit messageSent(txn_id, event_id.event_id.to_string());
-                        if constexpr (std::is_same_v<decltype(e.content),
-                                                     mtx::events::msg::Encrypted>) {
-                            auto event = decryptEvent({room_id_, e.event_id}, e);
-                            if (event->event) {
-                                if (auto dec = std::get_if<mtx::events::RoomEvent<
-                                      mtx::events::msg::KeyVerificationRequest>>(
-                                      &event->event.value())) {
-                                    emit updateFlowEventId(event_id.event_id.to_string());
-                                }
-                            }
-                        }
-                    });
-          },
-          event->data);
+            sending_[txn_id] = ordered;
+            ++sendsInFlight_;
+            send(event);
+        }
     });
 
     connect(
@@ -163,17 +227,20 @@ EventStore::EventStore(std::string room_id, QObject *)
       &EventStore::messageFailed,
       this,
       [this](std::string txn_id) {
-          if (current_txn == txn_id) {
-              current_txn_error_count++;
-              if (current_txn_error_count > 10) {
-                  nhlog::ui()->debug("failing txn id '{}'", txn_id);
-                  cache::client()->removePendingStatus(room_id_, txn_id);
-                  current_txn_error_count = 0;
-              }
+          finishSending(txn_id);
+
+          auto &failure = sendFailures_[txn_id];
+          if (++failure.count > 10) {
+              nhlog::ui()->debug("failing txn id '{}'", txn_id);
+              cache::client()->removePendingStatus(room_id_, txn_id);
+              sendFailures_.erase(txn_id);
+          } else {
+              failure.retryAt =
+                std::chrono::steady_clock::now() + std::chrono::milliseconds(RETRY_DELAY);
           }
-          QTimer::singleShot(1000, this, [this]() {
+
+          QTimer::singleShot(RETRY_DELAY, this, [this]() {
               nhlog::ui()->debug("timeout");
-              this->current_txn = "";
               emit processPending();
           });
       },
@@ -268,15 +335,8 @@ EventStore::EventStore(std::string room_id, QObject *)
               }
           }
 
-          http::client()->read_event(
-            room_id_,
-            event_id,
-            [this, event_id](mtx::http::RequestErr err) {
-                if (err) {
-                    nhlog::net()->warn("failed to read_event ({}, {})", room_id_, event_id);
-                }
-            },
-            !UserSettings::instance()->readReceipts());
+          if (auto it = sending_.find(txn_id); it != sending_.end() && it->second)
+              queueReadReceipt(event_id);
 
           auto idx = idToIndex(event_id);
 
@@ -284,13 +344,128 @@ EventStore::EventStore(std::string room_id, QObject *)
               emit dataChanged(*idx, *idx);
 
           cache::client()->removePendingStatus(room_id_, txn_id);
-          this->current_txn             = "";
-          this->current_txn_error_count = 0;
+          sendFailures_.erase(txn_id);
+          finishSending(txn_id);
           emit processPending();
       },
       Qt::QueuedConnection);
 }
 
+EventStore::~EventStore()
+{
+    // the responses for the running sends check for the store and are dropped without it
+    releaseSendSlots(static_cast<int>(sending_.size()));
+}
+
+bool
+EventStore::isOrdered(const mtx::events::collections::TimelineEvents &event)
+{
+    return !std::holds_alternative<mtx::events::RoomEvent<mtx::events::msg::Reaction>>(event);
+}
+
+void
+EventStore::send(const mtx::events::collections::TimelineEvent &event)
+{
+    std::visit(
+      [this](const auto &e) {
+          const auto &txn_id = e.event_id;
+
+          // The store may be destroyed before the response arrives, for example when leaving the
+          // room, so the response is posted to the ChatPage and only then checked for the store.
+          if constexpr (mtx::events::message_content_to_type<decltype(e.content)> !=
+                        mtx::events::EventType::Unsupported)
+              http::client()->send_room_message(
+                room_id_,
+                txn_id,
+                e.content,
+                [self = QPointer<EventStore>(this), txn_id, e](
+                  const mtx::responses::EventId &event_id, mtx::http::RequestErr err) {
+                    if (err) {
+                        const int status_code = static_cast<int>(err->status_code);
+                        nhlog::net()->warn("[{}] failed to send message: {} {}",
+                                           txn_id,
+                                           err->matrix_error.error,
+                                           status_code);
+                    }
+
+                    QMetaObject::invokeMethod(
+                      ChatPage::instance(),
+                      [self, txn_id, e, failed = bool(err), id = event_id.event_id.to_string()] {
+                          if (!self)
+                              return;
+                          if (failed) {
+                              emit self->messageFailed(txn_id);
+                              return;
+                          }
+
+                          emit self->messageSent(txn_id, id);
+                          if constexpr (std::is_same_v<decltype(e.content),
+                                                       mtx::events::msg::Encrypted>) {
+                              auto event = self->decryptEvent({self->room_id_, e.event_id}, e);
+                              if (event->event) {
+                                  if (std::holds_alternative<mtx::events::RoomEvent<
+                                        mtx::events::msg::KeyVerificationRequest>>(
+                                        event->event.value()))
+                                      emit self->updateFlowEventId(id);
+                              }
+                          }
+                      },
+                      Qt::QueuedConnection);
+                });
+          else
+              emit messageFailed(txn_id);
+      },
+      event.data);
+}
+
+void
+EventStore::finishSending(const std::string &txn_id)
+{
+    if (sending_.erase(txn_id))
+        releaseSendSlots(1);
+}
+
+void
+EventStore::releaseSendSlots(int count)
+{
+    if (count <= 0)
+        return;
+    sendsInFlight_ -= count;
+
+    // let the rooms that ran out of slots try again
+    auto waiting = std::move(waitingForSend_);
+    waitingForSend_.clear();
+    for (const auto &store : waiting)
+        if (store && store != this)
+            emit store->processPending();
+}
+
+void
+EventStore::queueReadReceipt(const std::string &event_id)
+{
+    pendingReceipt_ = event_id;
+    if (!receiptTimer_.isActive())
+        receiptTimer_.start();
+}
+
+void
+EventStore::sendReadReceipt()
+{
+    if (pendingReceipt_.empty())
+        return;
+
+    http::client()->read_event(
+      room_id_,
+      pendingReceipt_,
+      [room_id = room_id_, event_id = pendingReceipt_](mtx::http::RequestErr err) {
+          if (err) {
+              nhlog::net()->warn("failed to read_event ({}, {})", room_id, event_id);
+          }
+      },
+      !UserSettings::instance()->readReceipts());
+    pendingReceipt_.clear();
+}
+
 void
 EventStore::addPending(mtx::events::collections::TimelineEvents event)
 {
@@ -523,6 +698,8 @@ std::vector<mtx::events::collections::TimelineEvents>
 EventStore::edits(const std::string &event_id)
 {
     auto event_ids = cache::client()->relatedEvents(room_id_, event_id);
+    if (event_ids.empty())
+        return {};
 
     auto original_event = get(event_id, "", false, false);
     if (!original_event ||
@@ -534,6 +711,12 @@ EventStore::edits(const std::string &event_id)
 
     std::vector<mtx::events::collections::TimelineEvents> edits;
     for (const auto &id : event_ids) {
+        // Most related events are reactions or replies, so only decode the edits.
+        if (auto fields = cache::client()->getEventFields(room_id_, id);
+            fields && (fields->relations.replaces() != event_id ||
+                       fields->sender != original_sender))
+            continue;
+
         auto related_event = get(id, event_id, false, false);
         if (!related_event)
             continue;
@@ -645,17 +828,21 @@ EventStore::get(int idx, bool decrypt)
         if (!event_id)
             return nullptr;
 
-        std::optional<mtx::events::collections::TimelineEvent> event;
         auto edits_ = edits(*event_id);
-        if (edits_.empty())
-            event = cache::client()->getEvent(room_id_, *event_id);
-        else
-            event = {edits_.back()};
-
-        if (!event)
-            return nullptr;
-        else
-            event_ptr = new mtx::events::collections::TimelineEvents(std::move(event->data));
+        if (edits_.empty()) {
+            // edits() may already have decoded the event, reuse it instead of parsing it again
+            auto original = events_by_id_.object({room_id_, *event_id});
+            if (original) {
+                event_ptr = new mtx::events::collections::TimelineEvents(*original);
+            } else {
+                auto event = cache::client()->getEvent(room_id_, *event_id);
+                if (!event)
+                    return nullptr;
+                event_ptr = new mtx::events::collections::TimelineEvents(std::move(event->data));
+            }
+        } else {
+            event_ptr = new mtx::events::collections::TimelineEvents(std::move(edits_.back()));
+        }
         events_.insert(index, event_ptr);
     }
 
@@ -671,6 +858,43 @@ EventStore::get(int idx, bool decrypt)
     return event_ptr;
 }
 
+void
+EventStore::prefetch(int from, int to)
+{
+    if (this->thread() != QThread::currentThread())
+        nhlog::db()->warn("{} called from a different thread!", __func__);
+
+    from = std::max(from, 0);
+    to   = std::min(to, size() - 1);
+    if (from > to)
+        return;
+
+    bool missing = false;
+    for (int i = from; i <= to && !missing; i++)
+        missing = !events_.contains({room_id_, toInternalIdx(i)});
+    if (!missing)
+        return;
+
+    for (auto &entry :
+         cache::client()->getTimelineEvents(room_id_, toInternalIdx(from), toInternalIdx(to))) {
+        Index index{room_id_, entry.index};
+        if (events_.contains(index))
+            continue;
+
+        // edits are resolved by get()
+        if (entry.has_relations) {
+            get(toExternalIdx(entry.index));
+            continue;
+        }
+
+        auto event_ptr = new mtx::events::collections::TimelineEvents(std::move(entry.event.data));
+        if (auto encrypted =
+              std::get_if<mtx::events::EncryptedEvent<mtx::events::msg::Encrypted>>(event_ptr))
+            decryptEvent({room_id_, encrypted->event_id}, *encrypted);
+        events_.insert(index, event_ptr);
+    }
+}
+
 std::optional<int>
 EventStore::idToIndex(std::string_view id) const
 {
@@ -4,11 +4,16 @@
 
 #pragma once
 
+#include <chrono>
 #include <limits>
+#include <map>
 #include <string>
+#include <vector>
 
 #include <QCache>
 #include <QObject>
+#include <QPointer>
+#include <QTimer>
 #include <QVariant>
 
 #include <mtx/events/collections.hpp>
@@ -26,8 +31,11 @@ class EventStore final : public QObject
 
 public:
     EventStore(std::string room_id, QObject *parent);
+    ~EventStore() override;
 
     static void refetchOnlineKeyBackupKeys(TimelineModel *room);
+    //! Block until the pages of history that are being saved are committed.
+    static void waitForSavedHistory();
 
     // taken from QtPrivate::QHashCombine
     static uint hashCombine(uint hash, uint seed)
@@ -79,6 +87,9 @@ public:
                                                   bool resolve_edits = true);
     // always returns a proper event as long as the idx is valid
     mtx::events::collections::TimelineEvents *get(int idx, bool decrypt = true);
+    //! Load and decrypt the events between the indices from and to in one go, so that the
+    //! following calls to get() don't need to hit the database.
+    void prefetch(int from, int to);
 
     QVariantList reactions(const std::string &event_id);
     std::vector<mtx::events::collections::TimelineEvents> edits(const std::string &event_id);
@@ -110,6 +121,7 @@ signals:
                       std::string relatedTo,
                       mtx::events::collections::TimelineEvents timeline);
     void oldMessagesRetrieved(const mtx::responses::Messages &);
+    void oldMessagesSaved(uint64_t newFirst);
     void fetchedMore();
 
     void processPending();
@@ -124,8 +136,17 @@ public slots:
     void receivedSessionKey(const std::string &session_id);
     void clearTimeline();
     void enableKeyRequests(bool suppressKeyRequests_);
+    //! Mark the event as read. Receipts are sent in batches, so only the latest one is sent.
+    void queueReadReceipt(const std::string &event_id);
 
 private:
+    //! Whether the event has to wait for the messages queued before it. Reactions don't.
+    static bool isOrdered(const mtx::events::collections::TimelineEvents &event);
+    void send(const mtx::events::collections::TimelineEvent &event);
+    void finishSending(const std::string &txn_id);
+    void releaseSendSlots(int count);
+    void sendReadReceipt();
+
     olm::DecryptionResult *
     decryptEvent(const IdIndex &idx,
                  const mtx::events::EncryptedEvent<mtx::events::msg::Encrypted> &e);
@@ -147,8 +168,21 @@ private:
     };
     std::map<std::string, PendingKeyRequests> pending_key_requests;
 
-    std::string current_txn;
-    int current_txn_error_count = 0;
+    struct SendFailure
+    {
+        int count = 0;
+        std::chrono::steady_clock::time_point retryAt;
+    };
+    //! The txn ids being sent and whether they are ordered.
+    std::map<std::string, bool> sending_;
+    std::map<std::string, SendFailure> sendFailures_;
+    //! Sends of all rooms, shared between the stores of the UI thread.
+    static int sendsInFlight_;
+    static std::vector<QPointer<EventStore>> waitingForSend_;
+
+    std::string pendingReceipt_;
+    QTimer receiptTimer_;
+
     bool noMoreMessages         = false;
     bool suppressKeyRequests    = true;
 };
@@ -1300,6 +1300,9 @@ InputBar::startTyping()
     if (!typingRefresh_.isActive()) {
         typingRefresh_.start();
 
+        // fetch the members for mention completion, unless the sync already had all of them
+        ChatPage::instance()->loadMembers(room->roomId().toStdString(), this, {});
+
         if (ChatPage::instance()->userSettings()->typingNotifications()) {
             http::client()->start_typing(
               room->roomId().toStdString(), 10'000, [](mtx::http::RequestErr err) {
@@ -1315,10 +1318,12 @@ InputBar::startTyping()
 void
 InputBar::stopTyping()
 {
+    // only tell the server once, not for every edit of an empty input
+    bool wasTyping = typingRefresh_.isActive();
     typingRefresh_.stop();
     typingTimeout_.stop();
 
-    if (!ChatPage::instance()->userSettings()->typingNotifications())
+    if (!wasTyping || !ChatPage::instance()->userSettings()->typingNotifications())
         return;
 
     http::client()->stop_typing(room->roomId().toStdString(), [](mtx::http::RequestErr err) {
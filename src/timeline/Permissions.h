@@ -6,8 +6,12 @@
 
 #include <QObject>
 
+#include <memory>
+
 #include <mtx/events/power_levels.hpp>
 
+#include "CacheStructs.h"
+
 class TimelineModel;
 
 class Permissions final : public QObject
@@ -33,9 +37,12 @@ public:
 
     void invalidate();
 
-    const mtx::events::state::PowerLevels &powerlevelEvent() const { return pl; };
+    const mtx::events::state::PowerLevels &powerlevelEvent() const { return pl(); };
 
 private:
+    const mtx::events::state::PowerLevels &pl() const { return pl_->content; }
+
     QString roomId_;
-    mtx::events::state::PowerLevels pl;
+    //! shared with the cache, replaced there when the power levels change
+    std::shared_ptr<const CachedPowerLevels> pl_;
 };
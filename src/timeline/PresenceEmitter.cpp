@@ -4,20 +4,30 @@
 
 #include "PresenceEmitter.h"
 
-#include <QCache>
+#include <QHash>
+#include <QMultiHash>
+#include <QSet>
 #include <Utils.h>
 
+#include <utility>
+
 #include "Cache.h"
 
 namespace {
 struct CacheEntry
 {
     QString status;
-    mtx::presence::PresenceState state;
+    mtx::presence::PresenceState state = mtx::presence::PresenceState::offline;
 };
 }
 
-static QCache<QString, CacheEntry> presences;
+//! Presence of all known users, loaded from the db on first use and updated from syncs.
+static QHash<QString, CacheEntry> presences;
+static bool presencesLoaded = false;
+static QMultiHash<QString, UserPresence *> subscribers;
+//! Until the rooms were painted once, see PresenceEmitter::setDeferred().
+static bool deferred = false;
+static std::vector<mtx::events::Event<mtx::events::presence::Presence>> deferredPresences;
 
 static QString
 presenceToStr(mtx::presence::PresenceState state)
@@ -33,25 +43,81 @@ presenceToStr(mtx::presence::PresenceState state)
     }
 }
 
-static CacheEntry *
+static CacheEntry
+toEntry(const mtx::events::presence::Presence &p)
+{
+    return CacheEntry{utils::replaceEmoji(QString::fromStdString(p.status_msg).toHtmlEscaped()),
+                      p.presence};
+}
+
+static CacheEntry
 pullPresence(const QString &id)
 {
-    auto p = cache::presence(id.toStdString());
-    auto c = new CacheEntry{
-      utils::replaceEmoji(QString::fromStdString(p.status_msg).toHtmlEscaped()), p.presence};
-    presences.insert(id, c);
-    return c;
+    if (!presencesLoaded && deferred) {
+        // only the few users on screen, the table is loaded after the first paint
+        if (auto it = presences.constFind(id); it != presences.constEnd())
+            return *it;
+        auto entry = toEntry(cache::presence(id.toStdString()));
+        presences.insert(id, entry);
+        return entry;
+    }
+
+    if (!presencesLoaded) {
+        presencesLoaded = true;
+        for (const auto &[user, p] : cache::presences()) {
+            auto userid = QString::fromStdString(user);
+            // keep newer updates received before the table was loaded
+            if (!presences.contains(userid))
+                presences.insert(userid, toEntry(p));
+        }
+    }
+
+    return presences.value(id);
 }
 
 void
 PresenceEmitter::sync(
   const std::vector<mtx::events::Event<mtx::events::presence::Presence>> &presences_)
 {
+    if (deferred) {
+        deferredPresences.insert(deferredPresences.end(), presences_.begin(), presences_.end());
+        return;
+    }
+
+    QSet<QString> changed;
     for (const auto &p : presences_) {
         auto id = QString::fromStdString(p.sender);
-        presences.remove(id);
-        emit presenceChanged(std::move(id));
+        presences.insert(id, toEntry(p.content));
+        changed.insert(std::move(id));
     }
+
+    for (const auto &id : qAsConst(changed)) {
+        for (auto it = subscribers.constFind(id); it != subscribers.constEnd() && it.key() == id;
+             ++it)
+            emit it.value()->presenceChanged();
+    }
+}
+
+void
+PresenceEmitter::setDeferred(bool defer)
+{
+    deferred = defer;
+    if (!defer)
+        sync(std::exchange(deferredPresences, {}));
+}
+
+void
+PresenceEmitter::clear()
+{
+    presences.clear();
+    presencesLoaded = false;
+    deferred        = false;
+    deferredPresences.clear();
+
+    // Subscribers unregister themselves when destroyed, but the ones still alive should not keep
+    // showing the presence from the old session.
+    for (auto it = subscribers.constBegin(); it != subscribers.constEnd(); ++it)
+        emit it.value()->presenceChanged();
 }
 
 QString
@@ -59,10 +125,8 @@ PresenceEmitter::userPresence(QString id) const
 {
     if (id.isEmpty())
         return {};
-    else if (auto p = presences[id])
-        return presenceToStr(p->state);
     else
-        return presenceToStr(pullPresence(id)->state);
+        return presenceToStr(pullPresence(id).state);
 }
 
 QString
@@ -70,8 +134,44 @@ PresenceEmitter::userStatus(QString id) const
 {
     if (id.isEmpty())
         return {};
-    else if (auto p = presences[id])
-        return p->status;
     else
-        return pullPresence(id)->status;
+        return pullPresence(id).status;
+}
+
+UserPresence::~UserPresence()
+{
+    if (!userId_.isEmpty())
+        subscribers.remove(userId_, this);
+}
+
+void
+UserPresence::setUserId(const QString &id)
+{
+    if (id == userId_)
+        return;
+
+    if (!userId_.isEmpty())
+        subscribers.remove(userId_, this);
+    userId_ = id;
+    if (!userId_.isEmpty())
+        subscribers.insert(userId_, this);
+
+    emit userIdChanged();
+    emit presenceChanged();
+}
+
+QString
+UserPresence::presence() const
+{
+    if (userId_.isEmpty())
+        return {};
+    return presenceToStr(pullPresence(userId_).state);
+}
+
+QString
+UserPresence::status() const
+{
+    if (userId_.isEmpty())
+        return {};
+    return pullPresence(userId_).status;
 }
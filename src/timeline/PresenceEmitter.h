@@ -22,10 +22,42 @@ public:
     }
 
     void sync(const std::vector<mtx::events::Event<mtx::events::presence::Presence>> &presences);
+    //! While deferred, presences of syncs are held back and only the presence of users, that are
+    //! shown, is read from the cache, so the rooms are painted sooner at startup.
+    void setDeferred(bool defer);
+    //! Forget the presences of the previous session.
+    void clear();
 
     Q_INVOKABLE QString userPresence(QString id) const;
     Q_INVOKABLE QString userStatus(QString id) const;
+};
+
+//! Presence of a single user. Only notified, when the presence of that user changes.
+class UserPresence final : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(QString userId READ userId WRITE setUserId NOTIFY userIdChanged)
+    Q_PROPERTY(QString presence READ presence NOTIFY presenceChanged)
+    Q_PROPERTY(QString status READ status NOTIFY presenceChanged)
+
+public:
+    UserPresence(QObject *p = nullptr)
+      : QObject(p)
+    {
+    }
+    ~UserPresence() override;
+
+    QString userId() const { return userId_; }
+    void setUserId(const QString &id);
+
+    QString presence() const;
+    QString status() const;
 
 signals:
-    void presenceChanged(QString userid);
+    void userIdChanged();
+    void presenceChanged();
+
+private:
+    QString userId_;
 };
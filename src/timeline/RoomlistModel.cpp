@@ -4,6 +4,8 @@
 
 #include "RoomlistModel.h"
 
+#include <algorithm>
+
 #include <QClipboard>
 #include <QGuiApplication>
 
@@ -14,6 +16,7 @@
 #include "MainWindow.h"
 #include "MatrixClient.h"
 #include "MxcImageProvider.h"
+#include "StartupProfile.h"
 #include "TimelineModel.h"
 #include "TimelineViewManager.h"
 #include "UserSettingsPage.h"
@@ -87,6 +90,7 @@ RoomlistModel::roleNames() const
       {IsSpace, "isSpace"},
       {Tags, "tags"},
       {ParentSpaces, "parentSpaces"},
+      {AncestorSpaces, "ancestorSpaces"},
       {IsDirect, "isDirect"},
       {DirectChatOtherUserId, "directChatOtherUserId"},
     };
@@ -98,8 +102,10 @@ RoomlistModel::data(const QModelIndex &index, int role) const
     if (index.row() >= 0 && static_cast<size_t>(index.row()) < roomids.size()) {
         auto roomid = roomids.at(index.row());
 
-        if (role == Roles::ParentSpaces) {
-            auto parents = cache::client()->getParentRoomIds(roomid.toStdString());
+        if (role == Roles::ParentSpaces || role == Roles::AncestorSpaces) {
+            auto parents = role == Roles::ParentSpaces
+                             ? cache::client()->getParentRoomIds(roomid.toStdString())
+                             : cache::client()->getAncestorRoomIds(roomid.toStdString());
             QStringList list;
             list.reserve(static_cast<int>(parents.size()));
             for (const auto &t : parents)
@@ -251,7 +257,7 @@ void
 RoomlistModel::updateReadStatus(const std::map<QString, bool> &roomReadStatus_)
 {
     std::vector<int> roomsToUpdate;
-    roomsToUpdate.resize(roomReadStatus_.size());
+    roomsToUpdate.reserve(roomReadStatus_.size());
     for (const auto &[roomid, roomUnread] : roomReadStatus_) {
         if (roomUnread != roomReadStatus[roomid]) {
             roomsToUpdate.push_back(this->roomidToIndex(roomid));
@@ -260,12 +266,46 @@ RoomlistModel::updateReadStatus(const std::map<QString, bool> &roomReadStatus_)
         this->roomReadStatus[roomid] = roomUnread;
     }
 
-    for (auto idx : roomsToUpdate) {
-        emit dataChanged(index(idx),
-                         index(idx),
-                         {
-                           Roles::HasUnreadMessages,
-                         });
+    rowsChanged(std::move(roomsToUpdate), {Roles::HasUnreadMessages});
+}
+
+void
+RoomlistModel::appendRoomId(QString roomid)
+{
+    roomidIndex.insert(roomid, (int)roomids.size());
+    roomids.push_back(std::move(roomid));
+}
+
+void
+RoomlistModel::removeRoomIdAt(int idx)
+{
+    roomidIndex.remove(roomids[idx]);
+    roomids.erase(roomids.begin() + idx);
+    for (int i = idx; i < (int)roomids.size(); i++)
+        roomidIndex[roomids[i]] = i;
+}
+
+void
+RoomlistModel::clearRoomIds()
+{
+    roomids.clear();
+    roomidIndex.clear();
+}
+
+void
+RoomlistModel::rowsChanged(std::vector<int> rows, const QVector<int> &roles)
+{
+    rows.erase(std::remove(rows.begin(), rows.end(), -1), rows.end());
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+    for (size_t first = 0; first < rows.size();) {
+        size_t last = first;
+        while (last + 1 < rows.size() && rows[last + 1] == rows[last] + 1)
+            last++;
+
+        emit dataChanged(index(rows[first]), index(rows[last]), roles);
+        first = last + 1;
     }
 }
 void
@@ -286,18 +326,25 @@ RoomlistModel::addRoom(const QString &room_id, bool suppressInsertNotification)
                 &RoomlistModel::currentRoomChanged,
                 newRoom.data(),
                 &TimelineModel::updateLastReadId);
-        connect(MainWindow::instance(),
-                &MainWindow::activeChanged,
-                newRoom.data(),
-                &TimelineModel::lastReadIdOnWindowFocus);
-        connect(newRoom.data(),
-                &TimelineModel::newEncryptedImage,
-                MainWindow::instance()->imageProvider(),
-                &MxcImageProvider::addEncryptionInfo);
+        // there is no main window when replaying syncs
+        if (auto window = MainWindow::instance()) {
+            connect(window,
+                    &MainWindow::activeChanged,
+                    newRoom.data(),
+                    &TimelineModel::lastReadIdOnWindowFocus);
+            connect(newRoom.data(),
+                    &TimelineModel::newEncryptedImage,
+                    window->imageProvider(),
+                    &MxcImageProvider::addEncryptionInfo);
+        }
         connect(newRoom.data(),
                 &TimelineModel::forwardToRoom,
                 manager,
                 &TimelineViewManager::forwardMessageToRoom);
+        connect(newRoom.data(),
+                &TimelineModel::newCallEvent,
+                ChatPage::instance()->callManager(),
+                &CallManager::syncEvent);
         connect(newRoom.data(), &TimelineModel::lastMessageChanged, this, [room_id, this]() {
             auto idx = this->roomidToIndex(room_id);
             emit dataChanged(index(idx),
@@ -383,7 +430,7 @@ RoomlistModel::addRoom(const QString &room_id, bool suppressInsertNotification)
             previewedRooms.remove(room_id);
             emit dataChanged(index(idx), index(idx));
         } else {
-            roomids.push_back(room_id);
+            appendRoomId(room_id);
         }
 
         if ((wasInvite || wasPreview) && currentRoomPreview_ &&
@@ -395,7 +442,7 @@ RoomlistModel::addRoom(const QString &room_id, bool suppressInsertNotification)
 
         for (auto p : previewsToAdd) {
             previewedRooms.insert(p, std::nullopt);
-            roomids.push_back(std::move(p));
+            appendRoomId(std::move(p));
         }
 
         if (!suppressInsertNotification && ((!wasInvite && !wasPreview) || !previewedRooms.empty()))
@@ -516,14 +563,15 @@ RoomlistModel::sync(const mtx::responses::Sync &sync_)
     for (const auto &e : sync_.account_data.events) {
         if (auto event =
               std::get_if<mtx::events::AccountDataEvent<mtx::events::account_data::Direct>>(&e)) {
-            auto updatedDMs = updateDMs(*event);
-            for (const auto &r : updatedDMs) {
-                if (auto idx = roomidToIndex(r); idx != -1)
-                    emit dataChanged(index(idx), index(idx), {IsDirect, DirectChatOtherUserId});
-            }
+            std::vector<int> rows;
+            for (const auto &r : updateDMs(*event))
+                rows.push_back(roomidToIndex(r));
+            rowsChanged(std::move(rows), {IsDirect, DirectChatOtherUserId});
         }
     }
 
+    std::vector<int> tagsChanged;
+
     for (const auto &[room_id, room] : sync_.rooms.join) {
         auto qroomid = QString::fromStdString(room_id);
 
@@ -532,11 +580,6 @@ RoomlistModel::sync(const mtx::responses::Sync &sync_)
         const auto &room_model = models.value(qroomid);
         room_model->sync(room);
         // room_model->addEvents(room.timeline);
-        connect(room_model.data(),
-                &TimelineModel::newCallEvent,
-                ChatPage::instance()->callManager(),
-                &CallManager::syncEvent,
-                Qt::UniqueConnection);
 
         if (ChatPage::instance()->userSettings()->typingNotifications()) {
             for (const auto &ev : room.ephemeral.events) {
@@ -556,11 +599,11 @@ RoomlistModel::sync(const mtx::responses::Sync &sync_)
         for (const auto &e : room.account_data.events) {
             if (std::holds_alternative<
                   mtx::events::AccountDataEvent<mtx::events::account_data::Tags>>(e)) {
-                if (auto idx = roomidToIndex(qroomid); idx != -1)
-                    emit dataChanged(index(idx), index(idx), {Tags});
+                tagsChanged.push_back(roomidToIndex(qroomid));
             }
         }
     }
+    rowsChanged(std::move(tagsChanged), {Tags});
 
     for (const auto &[room_id, room] : sync_.rooms.leave) {
         (void)room;
@@ -573,7 +616,7 @@ RoomlistModel::sync(const mtx::responses::Sync &sync_)
         auto idx = this->roomidToIndex(qroomid);
         if (idx != -1) {
             beginRemoveRows(QModelIndex(), idx, idx);
-            roomids.erase(roomids.begin() + idx);
+            removeRoomIdAt(idx);
             if (models.contains(qroomid))
                 models.remove(qroomid);
             else if (invites.contains(qroomid))
@@ -582,6 +625,7 @@ RoomlistModel::sync(const mtx::responses::Sync &sync_)
         }
     }
 
+    std::vector<int> invitesChanged;
     for (const auto &[room_id, room] : sync_.rooms.invite) {
         (void)room;
         auto qroomid = QString::fromStdString(room_id);
@@ -592,26 +636,31 @@ RoomlistModel::sync(const mtx::responses::Sync &sync_)
 
         if (invites.contains(qroomid)) {
             invites[qroomid] = *invite;
-            auto idx         = roomidToIndex(qroomid);
-            emit dataChanged(index(idx), index(idx));
+            invitesChanged.push_back(roomidToIndex(qroomid));
         } else {
             beginInsertRows(QModelIndex(), (int)roomids.size(), (int)roomids.size());
             invites.insert(qroomid, *invite);
-            roomids.push_back(std::move(qroomid));
+            appendRoomId(std::move(qroomid));
             endInsertRows();
         }
     }
+    rowsChanged(std::move(invitesChanged));
 }
 
 void
 RoomlistModel::initializeRooms()
 {
+    startupprofile::Scope profile("initialize rooms");
+
     beginResetModel();
     models.clear();
-    roomids.clear();
+    clearRoomIds();
     invites.clear();
     currentRoom_ = nullptr;
 
+    // every room reads its state and timeline, share one snapshot for all of them
+    auto snapshot = cache::client()->readSnapshot();
+
     auto e = cache::client()->getAccountData(mtx::events::EventType::Direct);
     if (e) {
         if (auto event =
@@ -623,7 +672,7 @@ RoomlistModel::initializeRooms()
 
     invites = cache::client()->invites();
     for (auto id = invites.keyBegin(); id != invites.keyEnd(); ++id) {
-        roomids.push_back(*id);
+        appendRoomId(*id);
     }
 
     for (const auto &id : cache::client()->roomIds())
@@ -637,7 +686,9 @@ RoomlistModel::initializeRooms()
     if (MainWindow::instance()->dbusAvailable()) {
         dbusInterface_ = new NhekoDBusBackend{this};
         if (!QDBusConnection::sessionBus().registerObject(
-              "/", dbusInterface_, QDBusConnection::ExportScriptableSlots))
+              "/",
+              dbusInterface_,
+              QDBusConnection::ExportScriptableSlots | QDBusConnection::ExportScriptableSignals))
             nhlog::ui()->warn("Failed to register rooms with D-Bus");
     }
 #endif
@@ -649,12 +700,21 @@ RoomlistModel::clear()
     beginResetModel();
     models.clear();
     invites.clear();
-    roomids.clear();
-    currentRoom_ = nullptr;
+    clearRoomIds();
+    currentRoom_       = nullptr;
+    moreRoomsOnServer_ = false;
     emit currentRoomChanged("");
     endResetModel();
 }
 
+void
+RoomlistModel::fetchMore(const QModelIndex &)
+{
+    // asked again, once the server sent the next rooms
+    moreRoomsOnServer_ = false;
+    emit fetchMoreRoomsRequested();
+}
+
 void
 RoomlistModel::joinPreview(const QString &roomid)
 {
@@ -689,7 +749,7 @@ RoomlistModel::declineInvite(QString roomid)
 
         if (idx != -1) {
             beginRemoveRows(QModelIndex(), idx, idx);
-            roomids.erase(roomids.begin() + idx);
+            removeRoomIdAt(idx);
             invites.remove(roomid);
             endRemoveRows();
             ChatPage::instance()->leaveRoom(roomid, "");
@@ -704,7 +764,7 @@ RoomlistModel::leave(QString roomid, QString reason)
 
         if (idx != -1) {
             beginRemoveRows(QModelIndex(), idx, idx);
-            roomids.erase(roomids.begin() + idx);
+            removeRoomIdAt(idx);
             models.remove(roomid);
             endRemoveRows();
             ChatPage::instance()->leaveRoom(roomid, reason);
@@ -966,10 +1026,11 @@ FilteredRoomlistModel::filterAcceptsRow(int sourceRow, const QModelIndex &) cons
         }
 
         if (!hiddenSpaces.empty()) {
-            auto parents = sourceModel()
-                             ->data(sourceModel()->index(sourceRow, 0), RoomlistModel::ParentSpaces)
-                             .toStringList();
-            for (const auto &t : parents)
+            auto spaces =
+              sourceModel()
+                ->data(sourceModel()->index(sourceRow, 0), RoomlistModel::AncestorSpaces)
+                .toStringList();
+            for (const auto &t : spaces)
                 if (hiddenSpaces.contains(t))
                     return false;
         }
@@ -1005,10 +1066,11 @@ FilteredRoomlistModel::filterAcceptsRow(int sourceRow, const QModelIndex &) cons
         }
 
         if (!hiddenSpaces.empty()) {
-            auto parents = sourceModel()
-                             ->data(sourceModel()->index(sourceRow, 0), RoomlistModel::ParentSpaces)
-                             .toStringList();
-            for (const auto &t : parents)
+            auto spaces =
+              sourceModel()
+                ->data(sourceModel()->index(sourceRow, 0), RoomlistModel::AncestorSpaces)
+                .toStringList();
+            for (const auto &t : spaces)
                 if (hiddenSpaces.contains(t))
                     return false;
         }
@@ -1043,10 +1105,11 @@ FilteredRoomlistModel::filterAcceptsRow(int sourceRow, const QModelIndex &) cons
         }
 
         if (!hiddenSpaces.empty()) {
-            auto parents = sourceModel()
-                             ->data(sourceModel()->index(sourceRow, 0), RoomlistModel::ParentSpaces)
-                             .toStringList();
-            for (const auto &t : parents)
+            auto spaces =
+              sourceModel()
+                ->data(sourceModel()->index(sourceRow, 0), RoomlistModel::AncestorSpaces)
+                .toStringList();
+            for (const auto &t : spaces)
                 if (hiddenSpaces.contains(t))
                     return false;
         }
@@ -1064,11 +1127,13 @@ FilteredRoomlistModel::filterAcceptsRow(int sourceRow, const QModelIndex &) cons
                            .toString())
             return true;
 
-        auto parents = sourceModel()
-                         ->data(sourceModel()->index(sourceRow, 0), RoomlistModel::ParentSpaces)
-                         .toStringList();
-
-        if (!parents.contains(filterStr))
+        // rooms in subspaces are shown too
+        auto roomid = sourceModel()
+                        ->data(sourceModel()->index(sourceRow, 0), RoomlistModel::RoomId)
+                        .toString()
+                        .toStdString();
+        auto space  = filterStr.toStdString();
+        if (!cache::client()->isInSpace(roomid, space))
             return false;
 
         if (!hiddenTags.empty()) {
@@ -1081,19 +1146,18 @@ FilteredRoomlistModel::filterAcceptsRow(int sourceRow, const QModelIndex &) cons
                     return false;
         }
 
+        // only hidden spaces below the filtered one hide the room
         if (!hiddenSpaces.empty()) {
-            for (const auto &t : parents)
-                if (t != filterStr && hiddenSpaces.contains(t))
+            auto spaces =
+              sourceModel()
+                ->data(sourceModel()->index(sourceRow, 0), RoomlistModel::AncestorSpaces)
+                .toStringList();
+            for (const auto &t : spaces)
+                if (t != filterStr && hiddenSpaces.contains(t) &&
+                    cache::client()->isInSpace(t.toStdString(), space))
                     return false;
         }
 
-        if (sourceModel()
-              ->data(sourceModel()->index(sourceRow, 0), RoomlistModel::IsSpace)
-              .toBool() &&
-            !parents.contains(filterStr)) {
-            return false;
-        }
-
         if (hideDMs) {
             return !sourceModel()
                       ->data(sourceModel()->index(sourceRow, 0), RoomlistModel::IsDirect)
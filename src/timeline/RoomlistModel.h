@@ -72,6 +72,7 @@ public:
         IsPreviewFetched,
         Tags,
         ParentSpaces,
+        AncestorSpaces,
         IsDirect,
         DirectChatOtherUserId,
     };
@@ -84,6 +85,9 @@ public:
         return (int)roomids.size();
     }
     QVariant data(const QModelIndex &index, int role) const override;
+    //! Only with sliding sync, which does not send all rooms at once.
+    bool canFetchMore(const QModelIndex &) const override { return moreRoomsOnServer_; }
+    void fetchMore(const QModelIndex &) override;
     QSharedPointer<TimelineModel> getRoomById(QString id) const
     {
         if (models.contains(id))
@@ -99,15 +103,7 @@ public slots:
     void initializeRooms();
     void sync(const mtx::responses::Sync &sync_);
     void clear();
-    int roomidToIndex(const QString &roomid)
-    {
-        for (int i = 0; i < (int)roomids.size(); i++) {
-            if (roomids[i] == roomid)
-                return i;
-        }
-
-        return -1;
-    }
+    int roomidToIndex(const QString &roomid) const { return roomidIndex.value(roomid, -1); }
     void joinPreview(const QString &roomid);
     void acceptInvite(QString roomid);
     void declineInvite(QString roomid);
@@ -115,6 +111,7 @@ public slots:
     TimelineModel *currentRoom() const { return currentRoom_.get(); }
     RoomPreview currentRoomPreview() const { return currentRoomPreview_.value_or(RoomPreview{}); }
     void setCurrentRoom(const QString &roomid);
+    void setMoreRoomsOnServer(bool available) { moreRoomsOnServer_ = available; }
     void resetCurrentRoom()
     {
         currentRoom_ = nullptr;
@@ -130,14 +127,22 @@ signals:
     void currentRoomChanged(QString currentRoomId);
     void fetchedPreview(QString roomid, RoomInfo info);
     void spaceSelected(QString roomId);
+    void fetchMoreRoomsRequested();
 
 private:
     void addRoom(const QString &room_id, bool suppressInsertNotification = false);
     void fetchPreviews(QString roomid, const std::string &from = "");
     std::set<QString> updateDMs(mtx::events::AccountDataEvent<mtx::events::account_data::Direct> e);
+    void appendRoomId(QString roomid);
+    void removeRoomIdAt(int idx);
+    void clearRoomIds();
+    //! Emits one dataChanged per contiguous range of rows.
+    void rowsChanged(std::vector<int> rows, const QVector<int> &roles = {});
 
     TimelineViewManager *manager = nullptr;
     std::vector<QString> roomids;
+    //! room id -> row in roomids
+    QHash<QString, int> roomidIndex;
     QHash<QString, RoomInfo> invites;
     QHash<QString, QSharedPointer<TimelineModel>> models;
     std::map<QString, bool> roomReadStatus;
@@ -147,6 +152,7 @@ private:
     std::optional<RoomPreview> currentRoomPreview_;
 
     std::map<QString, std::vector<QString>> directChatToUser;
+    bool moreRoomsOnServer_ = false;
 
 #ifdef NHEKO_DBUS_SYS
     NhekoDBusBackend *dbusInterface_;
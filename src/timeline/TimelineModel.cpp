@@ -956,7 +956,8 @@ TimelineModel::syncState(const mtx::responses::State &s)
     for (const auto &e : s.events) {
         if (std::holds_alternative<StateEvent<state::Avatar>>(e))
             emit roomAvatarUrlChanged();
-        else if (std::holds_alternative<StateEvent<state::Name>>(e))
+        else if (std::holds_alternative<StateEvent<state::Name>>(e) ||
+                 std::holds_alternative<StateEvent<state::CanonicalAlias>>(e))
             emit roomNameChanged();
         else if (std::holds_alternative<StateEvent<state::Topic>>(e))
             emit roomTopicChanged();
@@ -1034,7 +1035,8 @@ TimelineModel::addEvents(const mtx::responses::Timeline &timeline)
               e);
         else if (std::holds_alternative<StateEvent<state::Avatar>>(e))
             emit roomAvatarUrlChanged();
-        else if (std::holds_alternative<StateEvent<state::Name>>(e))
+        else if (std::holds_alternative<StateEvent<state::Name>>(e) ||
+                 std::holds_alternative<StateEvent<state::CanonicalAlias>>(e))
             emit roomNameChanged();
         else if (std::holds_alternative<StateEvent<state::Topic>>(e))
             emit roomTopicChanged();
@@ -1203,13 +1205,32 @@ TimelineModel::updateLastMessage()
     }
 }
 
+void
+TimelineModel::prefetch(int first, int last)
+{
+    if (first < 0 && last < 0)
+        return;
+    if (first < 0)
+        first = last;
+    if (last < 0)
+        last = first;
+    if (first > last)
+        std::swap(first, last);
+
+    // rows are in reverse order of the event store
+    constexpr int margin = 10;
+    events.prefetch(events.size() - last - 1 - margin, events.size() - first - 1 + margin);
+}
+
 void
 TimelineModel::setCurrentIndex(int index)
 {
     auto oldIndex = idToIndex(currentId);
     currentId     = indexToId(index);
-    if (index != oldIndex)
+    if (index != oldIndex) {
+        prefetch(index, index);
         emit currentIndexChanged(index);
+    }
 
     if (!QGuiApplication::focusWindow() || !QGuiApplication::focusWindow()->isActive() ||
         MainWindow::instance()->windowForRoom(roomId()) != QGuiApplication::focusWindow())
@@ -1231,16 +1252,7 @@ TimelineModel::setCurrentIndex(int index)
 void
 TimelineModel::readEvent(const std::string &id)
 {
-    http::client()->read_event(
-      room_id_.toStdString(),
-      id,
-      [this](mtx::http::RequestErr err) {
-          if (err) {
-              nhlog::net()->warn(
-                "failed to read_event ({}, {})", room_id_.toStdString(), currentId.toStdString());
-          }
-      },
-      !UserSettings::instance()->readReceipts());
+    events.queueReadReceipt(id);
 }
 
 QString
@@ -1524,34 +1536,44 @@ TimelineModel::sendEncryptedMessage(mtx::events::RoomEvent<T> msg, mtx::events::
 {
     const auto room_id = room_id_.toStdString();
 
-    using namespace mtx::events;
+    // The session has to be shared with all members, not only the lazy loaded ones.
+    ChatPage::instance()->loadMembers(room_id, this, [this, room_id, msg, eventType](bool loaded) {
+        // the others could not decrypt the message
+        if (!loaded) {
+            nhlog::crypto()->critical("failed to load the members of {} to encrypt for", room_id);
+            emit ChatPage::instance()->showNotification(
+              tr("Failed to encrypt event, sending aborted!"));
+            return;
+        }
 
-    nlohmann::json doc = {{"type", mtx::events::to_string(eventType)},
-                          {"content", nlohmann::json(msg.content)},
-                          {"room_id", room_id}};
-
-    try {
-        mtx::events::EncryptedEvent<mtx::events::msg::Encrypted> event;
-        event.content  = olm::encrypt_group_message(room_id, http::client()->device_id(), doc);
-        event.event_id = msg.event_id;
-        event.room_id  = room_id;
-        event.sender   = http::client()->user_id().to_string();
-        event.type     = mtx::events::EventType::RoomEncrypted;
-        event.origin_server_ts = QDateTime::currentMSecsSinceEpoch();
-
-        emit this->addPendingMessageToStore(event);
-
-        // TODO: Let the user know about the errors.
-    } catch (const lmdb::error &e) {
-        nhlog::db()->critical("failed to open outbound megolm session ({}): {}", room_id, e.what());
-        emit ChatPage::instance()->showNotification(
-          tr("Failed to encrypt event, sending aborted!"));
-    } catch (const mtx::crypto::olm_exception &e) {
-        nhlog::crypto()->critical(
-          "failed to open outbound megolm session ({}): {}", room_id, e.what());
-        emit ChatPage::instance()->showNotification(
-          tr("Failed to encrypt event, sending aborted!"));
-    }
+        nlohmann::json doc = {{"type", mtx::events::to_string(eventType)},
+                              {"content", nlohmann::json(msg.content)},
+                              {"room_id", room_id}};
+
+        try {
+            mtx::events::EncryptedEvent<mtx::events::msg::Encrypted> event;
+            event.content  = olm::encrypt_group_message(room_id, http::client()->device_id(), doc);
+            event.event_id = msg.event_id;
+            event.room_id  = room_id;
+            event.sender   = http::client()->user_id().to_string();
+            event.type     = mtx::events::EventType::RoomEncrypted;
+            event.origin_server_ts = QDateTime::currentMSecsSinceEpoch();
+
+            emit this->addPendingMessageToStore(event);
+
+            // TODO: Let the user know about the errors.
+        } catch (const lmdb::error &e) {
+            nhlog::db()->critical(
+              "failed to open outbound megolm session ({}): {}", room_id, e.what());
+            emit ChatPage::instance()->showNotification(
+              tr("Failed to encrypt event, sending aborted!"));
+        } catch (const mtx::crypto::olm_exception &e) {
+            nhlog::crypto()->critical(
+              "failed to open outbound megolm session ({}): {}", room_id, e.what());
+            emit ChatPage::instance()->showNotification(
+              tr("Failed to encrypt event, sending aborted!"));
+        }
+    });
 }
 
 struct SendMessageVisitor
@@ -282,6 +282,8 @@ public:
     static QString getBareRoomLink(const QString &);
     static QString getRoomVias(const QString &);
 
+    //! Load the rows between first and last and a few around them ahead of the view.
+    Q_INVOKABLE void prefetch(int first, int last);
     Q_INVOKABLE QString displayName(const QString &id) const;
     Q_INVOKABLE QString avatarUrl(const QString &id) const;
     Q_INVOKABLE QString formatDateSeparator(QDate date) const;
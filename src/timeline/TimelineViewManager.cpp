@@ -119,6 +119,7 @@ TimelineViewManager::TimelineViewManager(CallManager *, ChatPage *parent)
     qmlRegisterSingletonInstance("im.nheko", 1, 0, "Communities", self->communities_);
     qmlRegisterSingletonInstance("im.nheko", 1, 0, "VerificationManager", verificationManager_);
     qmlRegisterSingletonInstance("im.nheko", 1, 0, "Presence", presenceEmitter);
+    qmlRegisterType<UserPresence>("im.nheko", 1, 0, "UserPresence");
 
     updateColorPalette();
 
@@ -141,6 +142,7 @@ TimelineViewManager::TimelineViewManager(CallManager *, ChatPage *parent)
     connect(parent, &ChatPage::loggedOut, this, [this]() {
         isInitialSync_ = true;
         emit initialSyncChanged(true);
+        presenceEmitter->clear();
     });
     connect(parent, &ChatPage::connectionLost, this, [this] {
         isConnected_ = false;
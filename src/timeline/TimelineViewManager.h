@@ -116,6 +116,7 @@ public slots:
     void forwardMessageToRoom(mtx::events::collections::TimelineEvents *e, QString roomId);
 
     RoomlistModel *rooms() { return rooms_; }
+    PresenceEmitter *presence() { return presenceEmitter; }
 
 private:
     bool isInitialSync_ = true;